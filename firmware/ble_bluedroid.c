@@ -0,0 +1,406 @@
+/**
+ * BLE transport on the Bluedroid host (see ble_transport.h)
+ */
+
+#include "sdkconfig.h"
+
+#if CONFIG_BT_BLUEDROID_ENABLED
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_bt.h"
+#include "esp_gap_ble_api.h"
+#include "esp_gatts_api.h"
+#include "esp_bt_defs.h"
+#include "esp_bt_main.h"
+#include "esp_gatt_common_api.h"
+#include "esp_timer.h"
+#include "ble_transport.h"
+
+#define GATTS_NUM_HANDLE    8        // Service, 2 x (decl + value), CCCD, spare
+#define APP_ID              0
+#define ADV_CONFIG_FLAG     (1 << 0)
+#define ADV_FAST_MIN        0x20     // 20 ms (original)
+#define ADV_FAST_MAX        0x40     // 40 ms (original)
+#define ADV_SLOW_MIN        0x320    // 500 ms
+#define ADV_SLOW_MAX        0x640    // 1 s
+
+static const char *TAG = "SmartGlasses";
+
+static const ble_transport_cb_t *app;
+static uint8_t adv_config_done = 0;
+
+// Advertising parameters - match original for compatibility; the
+// intervals follow adv_mode
+static esp_ble_adv_params_t adv_params = {
+    .adv_int_min        = ADV_FAST_MIN,
+    .adv_int_max        = ADV_FAST_MAX,
+    .adv_type           = ADV_TYPE_IND,
+    .own_addr_type      = BLE_ADDR_TYPE_PUBLIC,
+    .channel_map        = ADV_CHNL_ALL,
+    .adv_filter_policy  = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
+};
+
+// Reconnect burst after a dropout, aimed at the last peer (filled in on
+// connect). The intervals are unused at high duty.
+static esp_ble_adv_params_t adv_direct_params = {
+    .adv_int_min        = 0x20,
+    .adv_int_max        = 0x40,
+    .adv_type           = ADV_TYPE_DIRECT_IND_HIGH,
+    .own_addr_type      = BLE_ADDR_TYPE_PUBLIC,
+    .channel_map        = ADV_CHNL_ALL,
+    .adv_filter_policy  = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
+};
+static esp_timer_handle_t adv_direct_timer;
+static uint8_t adv_peer_known = 0;
+static volatile uint8_t adv_bursting = 0;        // Directed burst running
+static volatile uint8_t adv_ready = 0;           // Advertising data set
+static volatile uint8_t adv_mode = BLE_ADV_FAST; // ble_adv_mode_t
+
+// 0x00FF in 128-bit form; the stack lists it as a 16-bit UUID
+static uint8_t adv_service_uuid[16] = {
+    0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00, 0x00, 0x80,
+    0x00, 0x10, 0x00, 0x00,
+    BLE_SERVICE_UUID & 0xFF, BLE_SERVICE_UUID >> 8, 0x00, 0x00,
+};
+
+// Advertising data: flags, name and service, so scans can filter on 0x00FF
+static esp_ble_adv_data_t adv_data = {
+    .set_scan_rsp = false,
+    .include_name = true,
+    .include_txpower = false,
+    .service_uuid_len = sizeof(adv_service_uuid),
+    .p_service_uuid = adv_service_uuid,
+    .flag = (ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT),
+};
+
+static uint16_t gatt_service_handle = 0;
+static uint16_t gatt_cmd_handle = 0;            // FF01 value
+static uint16_t gatt_telem_handle = 0;          // FF02 value
+static uint16_t gatt_telem_cccd_handle = 0;     // FF02 client config
+static esp_gatt_if_t gatt_if = ESP_GATT_IF_NONE;
+static uint16_t gatt_conn_id = 0;
+static esp_bd_addr_t gatt_peer_bda;
+static volatile uint8_t gatt_connected = 0;
+static volatile uint8_t gatt_telem_notify = 0;  // CCCD notification bit
+static uint16_t gatt_mtu = 23;                  // Negotiated ATT MTU
+static esp_attr_value_t gatt_char_val = {
+    .attr_max_len = 100,
+    .attr_len = 0,
+    .attr_value = NULL,
+};
+
+// Undirected advertising in adv_mode
+static void adv_start(void)
+{
+    uint8_t mode = adv_mode;
+    if (mode == BLE_ADV_OFF) {
+        return;
+    }
+    adv_params.adv_int_min = mode == BLE_ADV_SLOW ? ADV_SLOW_MIN : ADV_FAST_MIN;
+    adv_params.adv_int_max = mode == BLE_ADV_SLOW ? ADV_SLOW_MAX : ADV_FAST_MAX;
+    esp_ble_gap_start_advertising(&adv_params);
+}
+
+// Burst over (the controller ends high duty on its own): back to normal
+// advertising if the peer did not come back
+static void adv_direct_timer_cb(void *arg)
+{
+    adv_bursting = 0;
+    if (!gatt_connected) {
+        esp_ble_gap_stop_advertising();
+        adv_start();
+    }
+}
+
+static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+{
+    switch (event) {
+    case ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT:
+        adv_config_done &= (~ADV_CONFIG_FLAG);
+        if (adv_config_done == 0) {
+            adv_ready = 1;
+            adv_start();
+        }
+        break;
+    case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
+        app->on_stage(BLE_STAGE_ADVERTISING);
+        break;
+    case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+        if (param->update_conn_params.status == ESP_BT_STATUS_SUCCESS) {
+            app->on_conn_params(param->update_conn_params.conn_int,
+                                param->update_conn_params.latency,
+                                param->update_conn_params.timeout);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void gatts_profile_event_handler(esp_gatts_cb_event_t event,
+                                         esp_gatt_if_t gatts_if,
+                                         esp_ble_gatts_cb_param_t *param)
+{
+    switch (event) {
+    case ESP_GATTS_REG_EVT:
+    {
+        gatt_if = gatts_if;
+        esp_ble_gap_set_device_name(BLE_DEVICE_NAME);
+        adv_config_done |= ADV_CONFIG_FLAG;
+        esp_ble_gap_config_adv_data(&adv_data);
+
+        esp_gatt_srvc_id_t service_id = {
+            .is_primary = true,
+            .id = {
+                .inst_id = 0,
+                .uuid = {
+                    .len = ESP_UUID_LEN_16,
+                    .uuid = { .uuid16 = BLE_SERVICE_UUID },
+                },
+            },
+        };
+        esp_ble_gatts_create_service(gatts_if, &service_id, GATTS_NUM_HANDLE);
+        break;
+    }
+
+    case ESP_GATTS_CREATE_EVT:
+    {
+        gatt_service_handle = param->create.service_handle;
+        esp_ble_gatts_start_service(gatt_service_handle);
+        // WRITE_NR lets real-time streams skip the ATT write response
+        esp_gatt_char_prop_t property = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE |
+                                        ESP_GATT_CHAR_PROP_BIT_WRITE_NR;
+        esp_bt_uuid_t char_uuid = {
+            .len = ESP_UUID_LEN_16,
+            .uuid = { .uuid16 = BLE_CHAR_UUID_CMD },
+        };
+        esp_ble_gatts_add_char(gatt_service_handle, &char_uuid,
+                               ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
+                               property, &gatt_char_val, NULL);
+        break;
+    }
+
+    case ESP_GATTS_ADD_CHAR_EVT:
+        // Characteristics are added one after the other: FF01, then FF02
+        if (param->add_char.char_uuid.uuid.uuid16 == BLE_CHAR_UUID_CMD) {
+            gatt_cmd_handle = param->add_char.attr_handle;
+            esp_bt_uuid_t telem_uuid = {
+                .len = ESP_UUID_LEN_16,
+                .uuid = { .uuid16 = BLE_CHAR_UUID_TELEM },
+            };
+            esp_ble_gatts_add_char(gatt_service_handle, &telem_uuid, ESP_GATT_PERM_READ,
+                                   ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY,
+                                   NULL, NULL);
+        } else if (param->add_char.char_uuid.uuid.uuid16 == BLE_CHAR_UUID_TELEM) {
+            gatt_telem_handle = param->add_char.attr_handle;
+            esp_bt_uuid_t cccd_uuid = {
+                .len = ESP_UUID_LEN_16,
+                .uuid = { .uuid16 = ESP_GATT_UUID_CHAR_CLIENT_CONFIG },
+            };
+            esp_ble_gatts_add_char_descr(gatt_service_handle, &cccd_uuid,
+                                         ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, NULL, NULL);
+        }
+        break;
+
+    case ESP_GATTS_ADD_CHAR_DESCR_EVT:
+        gatt_telem_cccd_handle = param->add_char_descr.attr_handle;
+        break;
+
+    case ESP_GATTS_WRITE_EVT:
+        // ALWAYS send response first to prevent GATT stack from blocking
+        if (param->write.need_rsp) {
+            esp_ble_gatts_send_response(gatts_if, param->write.conn_id,
+                                        param->write.trans_id, ESP_GATT_OK, NULL);
+        }
+
+        if (param->write.handle == gatt_telem_cccd_handle) {
+            // Notifications bit of the FF02 client config
+            if (param->write.len == 2) {
+                gatt_telem_notify = param->write.value[0] & 0x01;
+                app->on_subscribe(gatt_telem_notify);
+            }
+        } else if (param->write.handle == gatt_cmd_handle && param->write.len > 0) {
+            app->on_write(param->write.value, param->write.len);
+        }
+        break;
+
+    case ESP_GATTS_READ_EVT:
+    {
+        if (!param->read.need_rsp) {
+            break;
+        }
+        static esp_gatt_rsp_t rsp;
+        memset(&rsp, 0, sizeof(rsp));
+        rsp.attr_value.handle = param->read.handle;
+        int n;
+        if (param->read.handle == gatt_telem_cccd_handle) {
+            rsp.attr_value.value[0] = gatt_telem_notify;
+            n = 2;
+        } else if (param->read.handle == gatt_telem_handle) {
+            // Short, so built fresh; offset reads are not needed
+            n = app->on_telem_read(rsp.attr_value.value, gatt_mtu - 1);
+        } else {
+            // Long reads come in pieces at increasing offsets
+            n = app->on_read(param->read.offset, rsp.attr_value.value, gatt_mtu - 1);
+        }
+        esp_gatt_status_t status = ESP_GATT_OK;
+        if (n < 0) {
+            status = ESP_GATT_INVALID_OFFSET;
+        } else {
+            rsp.attr_value.offset = param->read.offset;
+            rsp.attr_value.len = n;
+        }
+        esp_ble_gatts_send_response(gatts_if, param->read.conn_id,
+                                    param->read.trans_id, status, &rsp);
+        break;
+    }
+
+    case ESP_GATTS_MTU_EVT:
+        gatt_mtu = param->mtu.mtu;
+        break;
+
+    case ESP_GATTS_CONNECT_EVT:
+        ESP_LOGI(TAG, "Client connected");
+        gatt_conn_id = param->connect.conn_id;
+        memcpy(gatt_peer_bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+        memcpy(adv_direct_params.peer_addr, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+        adv_direct_params.peer_addr_type = param->connect.ble_addr_type;
+        adv_peer_known = 1;
+        adv_bursting = 0;
+        esp_timer_stop(adv_direct_timer);
+        gatt_connected = 1;
+        app->on_connect();
+        app->on_conn_params(param->connect.conn_params.interval,
+                            param->connect.conn_params.latency,
+                            param->connect.conn_params.timeout);
+        break;
+
+    case ESP_GATTS_DISCONNECT_EVT:
+    {
+        // A link that was closed on purpose is free for any central; one that
+        // dropped gets a directed burst so the same host is back at once
+        bool dropout = adv_peer_known &&
+                       param->disconnect.reason != ESP_GATT_CONN_TERMINATE_PEER_USER &&
+                       param->disconnect.reason != ESP_GATT_CONN_TERMINATE_LOCAL_HOST;
+        ESP_LOGI(TAG, "Client disconnected (0x%02x), restarting advertising%s",
+                 param->disconnect.reason, dropout ? " (directed)" : "");
+        gatt_mtu = 23;
+        gatt_connected = 0;
+        gatt_telem_notify = 0;
+        app->on_disconnect();
+        adv_mode = BLE_ADV_FAST;
+        if (dropout) {
+            adv_bursting = 1;
+            esp_ble_gap_start_advertising(&adv_direct_params);
+            esp_timer_start_once(adv_direct_timer, BLE_ADV_DIRECT_MS * 1000);
+        } else {
+            adv_start();
+        }
+        break;
+    }
+
+    case ESP_GATTS_CONGEST_EVT:
+        app->on_congest(param->congest.congested);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void gatts_event_handler(esp_gatts_cb_event_t event,
+                                esp_gatt_if_t gatts_if,
+                                esp_ble_gatts_cb_param_t *param)
+{
+    if (event == ESP_GATTS_REG_EVT && param->reg.status != ESP_GATT_OK) {
+        ESP_LOGE(TAG, "Reg failed");
+        return;
+    }
+    gatts_profile_event_handler(event, gatts_if, param);
+}
+
+esp_err_t ble_transport_start(const ble_transport_cb_t *cb)
+{
+    esp_err_t ret;
+    app = cb;
+
+    const esp_timer_create_args_t args = {
+        .callback = adv_direct_timer_cb,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "adv_direct",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &adv_direct_timer));
+
+    ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
+    esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
+    ret = esp_bt_controller_init(&bt_cfg);
+    if (ret) { ESP_LOGE(TAG, "BT ctrl init fail: %s", esp_err_to_name(ret)); return ret; }
+    ret = esp_bt_controller_enable(ESP_BT_MODE_BLE);
+    if (ret) { ESP_LOGE(TAG, "BT ctrl enable fail: %s", esp_err_to_name(ret)); return ret; }
+    app->on_stage(BLE_STAGE_CONTROLLER);
+
+    ret = esp_bluedroid_init();
+    if (ret) { ESP_LOGE(TAG, "Bluedroid init fail: %s", esp_err_to_name(ret)); return ret; }
+    ret = esp_bluedroid_enable();
+    if (ret) { ESP_LOGE(TAG, "Bluedroid enable fail: %s", esp_err_to_name(ret)); return ret; }
+    ESP_ERROR_CHECK(esp_ble_gap_register_callback(gap_event_handler));
+    ESP_ERROR_CHECK(esp_ble_gatts_register_callback(gatts_event_handler));
+    ESP_ERROR_CHECK(esp_ble_gatts_app_register(APP_ID));
+    esp_ble_gatt_set_local_mtu(BLE_LOCAL_MTU);
+    app->on_stage(BLE_STAGE_HOST);
+    ESP_LOGI(TAG, "BLE stack OK (Bluedroid)");
+
+    // Reduce BLE TX power
+    esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_DEFAULT, ESP_PWR_LVL_N12);
+    esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_ADV, ESP_PWR_LVL_N12);
+    esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_CONN_HDL0, ESP_PWR_LVL_N12);
+    return ESP_OK;
+}
+
+esp_err_t ble_transport_notify(const uint8_t *data, uint16_t len)
+{
+    if (!gatt_connected || !gatt_telem_notify) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // Queued to the BTC task; the link itself is never waited on here
+    esp_err_t err = esp_ble_gatts_send_indicate(gatt_if, gatt_conn_id, gatt_telem_handle,
+                                                len, (uint8_t *)data, false);
+    return err == ESP_OK ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+uint16_t ble_transport_mtu(void)
+{
+    return gatt_mtu;
+}
+
+esp_err_t ble_transport_set_adv(ble_adv_mode_t mode)
+{
+    if (gatt_connected) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    adv_mode = mode;
+    if (adv_ready && !adv_bursting) {
+        // Queued in order to the BTC task, so the restart follows the stop
+        esp_ble_gap_stop_advertising();
+        adv_start();
+    }
+    return ESP_OK;
+}
+
+esp_err_t ble_transport_set_conn_params(const ble_conn_params_t *params)
+{
+    if (!gatt_connected) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_ble_conn_update_params_t upd = {
+        .min_int = params->min_interval,
+        .max_int = params->max_interval,
+        .latency = params->latency,
+        .timeout = params->timeout,
+    };
+    memcpy(upd.bda, gatt_peer_bda, sizeof(esp_bd_addr_t));
+    return esp_ble_gap_update_conn_params(&upd);
+}
+
+#endif // CONFIG_BT_BLUEDROID_ENABLED
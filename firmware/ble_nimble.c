@@ -0,0 +1,348 @@
+/**
+ * BLE transport on the NimBLE host (see ble_transport.h)
+ *
+ * Same service, characteristics and advertising as the Bluedroid build.
+ * NimBLE handles ATT long reads itself, so FF01 reads return the whole
+ * selected report and the stack slices it by offset.
+ */
+
+#include "sdkconfig.h"
+
+#if CONFIG_BT_NIMBLE_ENABLED
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_bt.h"
+#include "nimble/nimble_port.h"
+#include "nimble/nimble_port_freertos.h"
+#include "host/ble_hs.h"
+#include "host/ble_gap.h"
+#include "services/gap/ble_svc_gap.h"
+#include "services/gatt/ble_svc_gatt.h"
+#include "ble_transport.h"
+
+static const char *TAG = "SmartGlasses";
+
+static const ble_transport_cb_t *app;
+static uint8_t own_addr_type;
+static uint16_t conn_handle = BLE_HS_CONN_HANDLE_NONE;
+static volatile uint8_t telem_notify = 0;       // CCCD notification bit
+static uint16_t cmd_val_handle;
+static uint16_t telem_val_handle;
+static ble_addr_t peer_addr;                    // Last peer, for the directed burst
+static uint8_t peer_known = 0;
+static volatile uint8_t adv_bursting = 0;        // Directed burst running
+static volatile uint8_t adv_ready = 0;           // Host synced
+static volatile uint8_t adv_mode = BLE_ADV_FAST; // ble_adv_mode_t
+
+static int gap_event(struct ble_gap_event *event, void *arg);
+
+static int chr_access(uint16_t conn, uint16_t attr_handle,
+                      struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    static uint8_t buf[BLE_ATTR_MAX_LEN];
+    uint16_t len;
+
+    switch (ctxt->op) {
+    case BLE_GATT_ACCESS_OP_WRITE_CHR:
+        if (attr_handle != cmd_val_handle) {
+            return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+        }
+        if (ble_hs_mbuf_to_flat(ctxt->om, buf, sizeof(buf), &len) != 0) {
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+        if (len > 0) {
+            app->on_write(buf, len);
+        }
+        return 0;
+
+    case BLE_GATT_ACCESS_OP_READ_CHR:
+    {
+        int n;
+        if (attr_handle == telem_val_handle) {
+            n = app->on_telem_read(buf, sizeof(buf));
+        } else {
+            n = app->on_read(0, buf, sizeof(buf));
+        }
+        if (n < 0) {
+            n = 0;
+        }
+        return os_mbuf_append(ctxt->om, buf, n) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
+    default:
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+static const struct ble_gatt_svc_def gatt_svcs[] = {
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = BLE_UUID16_DECLARE(BLE_SERVICE_UUID),
+        .characteristics = (struct ble_gatt_chr_def[]) {
+            {
+                // WRITE_NO_RSP lets real-time streams skip the ATT write response
+                .uuid = BLE_UUID16_DECLARE(BLE_CHAR_UUID_CMD),
+                .access_cb = chr_access,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP,
+                .val_handle = &cmd_val_handle,
+            },
+            {
+                .uuid = BLE_UUID16_DECLARE(BLE_CHAR_UUID_TELEM),
+                .access_cb = chr_access,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
+                .val_handle = &telem_val_handle,
+            },
+            { 0 },
+        },
+    },
+    { 0 },
+};
+
+// Undirected advertising in adv_mode
+static void advertise(void)
+{
+    uint8_t mode = adv_mode;
+    if (mode == BLE_ADV_OFF) {
+        return;
+    }
+
+    // Name and service, so scans can filter on 0x00FF
+    static const ble_uuid16_t service_uuid = BLE_UUID16_INIT(BLE_SERVICE_UUID);
+    struct ble_hs_adv_fields fields;
+    memset(&fields, 0, sizeof(fields));
+    fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
+    const char *name = ble_svc_gap_device_name();
+    fields.name = (uint8_t *)name;
+    fields.name_len = strlen(name);
+    fields.name_is_complete = 1;
+    fields.uuids16 = &service_uuid;
+    fields.num_uuids16 = 1;
+    fields.uuids16_is_complete = 1;
+    int rc = ble_gap_adv_set_fields(&fields);
+    if (rc != 0) {
+        ESP_LOGE(TAG, "Adv fields fail: %d", rc);
+        return;
+    }
+
+    // Advertising parameters - match original for compatibility
+    struct ble_gap_adv_params adv_params;
+    memset(&adv_params, 0, sizeof(adv_params));
+    adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
+    adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
+    if (mode == BLE_ADV_SLOW) {
+        adv_params.itvl_min = 0x320;    // 500ms
+        adv_params.itvl_max = 0x640;    // 1s
+    } else {
+        adv_params.itvl_min = 0x20;     // 20ms (original)
+        adv_params.itvl_max = 0x40;     // 40ms (original)
+    }
+    rc = ble_gap_adv_start(own_addr_type, NULL, BLE_HS_FOREVER, &adv_params, gap_event, NULL);
+    if (rc != 0) {
+        ESP_LOGE(TAG, "Adv start fail: %d", rc);
+        return;
+    }
+    app->on_stage(BLE_STAGE_ADVERTISING);
+}
+
+// Reconnect burst after a dropout. BLE_GAP_EVENT_ADV_COMPLETE ends it, and
+// the normal advertising takes over from there.
+static void advertise_directed(void)
+{
+    struct ble_gap_adv_params adv_params;
+    memset(&adv_params, 0, sizeof(adv_params));
+    adv_params.conn_mode = BLE_GAP_CONN_MODE_DIR;
+    adv_params.disc_mode = BLE_GAP_DISC_MODE_NON;
+    adv_params.high_duty_cycle = 1;
+    int rc = ble_gap_adv_start(own_addr_type, &peer_addr, BLE_ADV_DIRECT_MS,
+                               &adv_params, gap_event, NULL);
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Directed adv fail: %d", rc);
+        advertise();
+        return;
+    }
+    adv_bursting = 1;
+    app->on_stage(BLE_STAGE_ADVERTISING);
+}
+
+static void report_conn_params(uint16_t handle)
+{
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(handle, &desc) == 0) {
+        app->on_conn_params(desc.conn_itvl, desc.conn_latency, desc.supervision_timeout);
+    }
+}
+
+static int gap_event(struct ble_gap_event *event, void *arg)
+{
+    switch (event->type) {
+    case BLE_GAP_EVENT_CONNECT:
+        adv_bursting = 0;
+        if (event->connect.status != 0) {
+            advertise();
+            break;
+        }
+        ESP_LOGI(TAG, "Client connected");
+        conn_handle = event->connect.conn_handle;
+        struct ble_gap_conn_desc desc;
+        if (ble_gap_conn_find(conn_handle, &desc) == 0) {
+            peer_addr = desc.peer_id_addr;
+            peer_known = 1;
+        }
+        app->on_connect();
+        report_conn_params(conn_handle);
+        break;
+
+    case BLE_GAP_EVENT_CONN_UPDATE:
+        if (event->conn_update.status == 0) {
+            report_conn_params(event->conn_update.conn_handle);
+        }
+        break;
+
+    case BLE_GAP_EVENT_DISCONNECT:
+    {
+        // A link that was closed on purpose is free for any central; one that
+        // dropped gets a directed burst so the same host is back at once
+        int reason = event->disconnect.reason;
+        bool dropout = peer_known &&
+                       reason != BLE_HS_HCI_ERR(BLE_ERR_REM_USER_CONN_TERM) &&
+                       reason != BLE_HS_HCI_ERR(BLE_ERR_CONN_TERM_LOCAL);
+        ESP_LOGI(TAG, "Client disconnected (0x%03x), restarting advertising%s",
+                 reason, dropout ? " (directed)" : "");
+        conn_handle = BLE_HS_CONN_HANDLE_NONE;
+        telem_notify = 0;
+        app->on_disconnect();
+        adv_mode = BLE_ADV_FAST;
+        if (dropout) {
+            advertise_directed();
+        } else {
+            advertise();
+        }
+        break;
+    }
+
+    case BLE_GAP_EVENT_SUBSCRIBE:
+        if (event->subscribe.attr_handle == telem_val_handle) {
+            telem_notify = event->subscribe.cur_notify;
+            app->on_subscribe(telem_notify);
+        }
+        break;
+
+    case BLE_GAP_EVENT_ADV_COMPLETE:
+        adv_bursting = 0;
+        advertise();
+        break;
+
+    default:
+        break;
+    }
+    return 0;
+}
+
+static void on_sync(void)
+{
+    int rc = ble_hs_id_infer_auto(0, &own_addr_type);
+    if (rc != 0) {
+        ESP_LOGE(TAG, "Addr infer fail: %d", rc);
+        return;
+    }
+    app->on_stage(BLE_STAGE_HOST);
+
+    // Reduce BLE TX power, as the Bluedroid backend does
+    esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_DEFAULT, ESP_PWR_LVL_N12);
+    esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_ADV, ESP_PWR_LVL_N12);
+    esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_CONN_HDL0, ESP_PWR_LVL_N12);
+    adv_ready = 1;
+    advertise();
+}
+
+static void on_reset(int reason)
+{
+    ESP_LOGW(TAG, "NimBLE reset: %d", reason);
+}
+
+static void host_task(void *param)
+{
+    nimble_port_run();              // Returns only on nimble_port_stop()
+    nimble_port_freertos_deinit();
+}
+
+esp_err_t ble_transport_start(const ble_transport_cb_t *cb)
+{
+    app = cb;
+
+    // Brings up the controller as well
+    esp_err_t ret = nimble_port_init();
+    if (ret) { ESP_LOGE(TAG, "NimBLE init fail: %s", esp_err_to_name(ret)); return ret; }
+    app->on_stage(BLE_STAGE_CONTROLLER);
+
+    ble_hs_cfg.sync_cb = on_sync;
+    ble_hs_cfg.reset_cb = on_reset;
+
+    ble_svc_gap_init();
+    ble_svc_gatt_init();
+    int rc = ble_gatts_count_cfg(gatt_svcs);
+    if (rc == 0) {
+        rc = ble_gatts_add_svcs(gatt_svcs);
+    }
+    if (rc != 0) {
+        ESP_LOGE(TAG, "GATT svc fail: %d", rc);
+        return ESP_FAIL;
+    }
+    ble_svc_gap_device_name_set(BLE_DEVICE_NAME);
+    ble_att_set_preferred_mtu(BLE_LOCAL_MTU);
+
+    nimble_port_freertos_init(host_task);
+    ESP_LOGI(TAG, "BLE stack OK (NimBLE)");
+    return ESP_OK;
+}
+
+esp_err_t ble_transport_notify(const uint8_t *data, uint16_t len)
+{
+    if (conn_handle == BLE_HS_CONN_HANDLE_NONE || !telem_notify) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(data, len);
+    if (om == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    // Consumes om, also on failure
+    return ble_gatts_notify_custom(conn_handle, telem_val_handle, om) == 0 ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+uint16_t ble_transport_mtu(void)
+{
+    uint16_t mtu = conn_handle == BLE_HS_CONN_HANDLE_NONE ? 0 : ble_att_mtu(conn_handle);
+    return mtu ? mtu : BLE_ATT_MTU_DFLT;
+}
+
+esp_err_t ble_transport_set_adv(ble_adv_mode_t mode)
+{
+    if (conn_handle != BLE_HS_CONN_HANDLE_NONE) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    adv_mode = mode;
+    if (adv_ready && !adv_bursting) {
+        if (ble_gap_adv_active()) {
+            ble_gap_adv_stop();
+        }
+        advertise();
+    }
+    return ESP_OK;
+}
+
+esp_err_t ble_transport_set_conn_params(const ble_conn_params_t *params)
+{
+    if (conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    struct ble_gap_upd_params upd = {
+        .itvl_min = params->min_interval,
+        .itvl_max = params->max_interval,
+        .latency = params->latency,
+        .supervision_timeout = params->timeout,
+    };
+    return ble_gap_update_params(conn_handle, &upd) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+#endif // CONFIG_BT_NIMBLE_ENABLED
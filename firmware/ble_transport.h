@@ -0,0 +1,101 @@
+/**
+ * BLE transport for the Smart Glasses GATT service
+ *
+ * One primary service (0x00FF) with:
+ *   FF01 - commands: read (selected report), write, write without response
+ *   FF02 - telemetry: read, notify (client config descriptor)
+ *
+ * Advertising carries the name and the 0x00FF service UUID. When a link
+ * drops (anything but a disconnect by either side's host), advertising
+ * resumes with a BLE_ADV_DIRECT_MS burst of high duty directed advertising
+ * to the last peer, which a central still trying to reconnect picks up
+ * within a few ms, then falls back to undirected advertising. That runs in
+ * the mode last set by ble_transport_set_adv(), except that a disconnect
+ * always goes back to BLE_ADV_FAST; stepping down is left to main.c.
+ *
+ * main.c only talks to this interface. The host stack behind it is picked
+ * at build time from sdkconfig, with no change to the wire protocol:
+ *   CONFIG_BT_BLUEDROID_ENABLED  - ble_bluedroid.c
+ *   CONFIG_BT_NIMBLE_ENABLED     - ble_nimble.c (smaller heap, faster bring-up)
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define BLE_DEVICE_NAME         "Smart_Glasses"
+#define BLE_SERVICE_UUID        0x00FF
+#define BLE_CHAR_UUID_CMD       0xFF01
+#define BLE_CHAR_UUID_TELEM     0xFF02
+#define BLE_LOCAL_MTU           185      // Room for batch frames and reports in one PDU
+#define BLE_ATTR_MAX_LEN        512      // ATT attribute value limit
+#define BLE_ADV_DIRECT_MS       1280     // Directed burst after a dropout (high duty limit)
+
+typedef enum {
+    BLE_STAGE_CONTROLLER = 0,   // Controller enabled
+    BLE_STAGE_HOST,             // Host running, service registered
+    BLE_STAGE_ADVERTISING,      // Advertising (re)started
+} ble_stage_t;
+
+// Undirected advertising while nobody is connected
+typedef enum {
+    BLE_ADV_FAST = 0,           // 20-40 ms
+    BLE_ADV_SLOW,               // 500 ms-1 s
+    BLE_ADV_OFF,                // None: not discoverable or connectable
+    BLE_ADV_MODE_COUNT,
+} ble_adv_mode_t;
+
+// Connection parameters, in Core spec units
+typedef struct {
+    uint16_t min_interval;      // 1.25 ms
+    uint16_t max_interval;      // 1.25 ms
+    uint16_t latency;           // Connection events the peripheral may skip
+    uint16_t timeout;           // Supervision timeout, 10 ms
+} ble_conn_params_t;
+
+// Application hooks, called from the BLE host task. They must not block.
+typedef struct {
+    // FF01 written (one ATT write, unparsed)
+    void (*on_write)(const uint8_t *data, uint16_t len);
+    // FF01 read: copy up to max bytes from offset, return the count or -1
+    // for an offset past the end
+    int (*on_read)(uint16_t offset, uint8_t *out, uint16_t max);
+    // FF02 read: fill out, return the length
+    uint16_t (*on_telem_read)(uint8_t *out, uint16_t max);
+    // FF02 notifications enabled/disabled by the client
+    void (*on_subscribe)(bool enabled);
+    void (*on_connect)(void);
+    // Also called for the implicit unsubscribe; advertising restarts itself
+    // (directed first after a dropout, see above)
+    void (*on_disconnect)(void);
+    // Link buffers full / drained (not every stack reports this)
+    void (*on_congest)(bool congested);
+    void (*on_stage)(ble_stage_t stage);
+    // Parameters in use, on connect and after every update (interval in
+    // 1.25 ms, timeout in 10 ms)
+    void (*on_conn_params)(uint16_t interval, uint16_t latency, uint16_t timeout);
+} ble_transport_cb_t;
+
+// Bring up controller and host, register the service and start
+// advertising. Blocks for the bring-up; call from a task of its own.
+esp_err_t ble_transport_start(const ble_transport_cb_t *cb);
+
+// Notify FF02 to the connected client. Does not wait for the link:
+// ESP_ERR_INVALID_STATE if nobody is connected or subscribed,
+// ESP_ERR_NO_MEM if the stack has no buffer for it.
+esp_err_t ble_transport_notify(const uint8_t *data, uint16_t len);
+
+// ATT MTU of the link (23 when nobody is connected). A notify carries up
+// to 3 bytes less.
+uint16_t ble_transport_mtu(void);
+
+// Switch undirected advertising to mode. Before the host is up, or during
+// the directed burst, it only sets the mode advertising starts in.
+// ESP_ERR_INVALID_STATE while a client is connected.
+esp_err_t ble_transport_set_adv(ble_adv_mode_t mode);
+
+// Ask the central for new connection parameters. Returns once the request
+// is queued; the outcome arrives through on_conn_params.
+// ESP_ERR_INVALID_STATE if nobody is connected.
+esp_err_t ble_transport_set_conn_params(const ble_conn_params_t *params);
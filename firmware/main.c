@@ -4,14 +4,37 @@
  * Features:
  *   - 10-minute timed session with auto-sleep at end
  *   - Linear progression of strobe frequency and breathing pattern
+ *   - Uploadable multi-segment session programs (NVS, RTC copy across sleep)
+ *   - Session parameters persisted in NVS (debounced writes)
  *   - Strobe: start_hz -> end_hz over session duration (default 12->8 Hz)
+ *   - Strobe edges generated by an esp_timer ISR (us resolution, full 1-50 Hz)
+ *   - Phase-continuous frequency sweep from a fixed-point phase accumulator
+ *   - Inhale/exhale ramps run as LEDC hardware fades, strobe gated on top
+ *   - Perceptual lens response table (built-in, or calibrated per device via
+ *     0xAE and kept in NVS), ramps split into sub-fades along it
  *   - Breathing: inhale/exhale fixed, hold_in/hold_out 0->end over session
  *     Default: 4s-0s-4s-0s -> 4s-4s-4s-4s
- *   - PWM1 only (GPIO27), PWM2 commented out (hardware tied together)
+ *   - Per-lens channels (PWM1 GPIO27, PWM2 GPIO26 with EDGE_LENS_COUNT=2):
+ *     own duty scale and strobe phase per eye, gated on the same timer edge
  *   - BLE commands for configuring start/end parameters
  *   - BLE static override (0xA5) to hold fixed duty
- *   - Hall sensor sleep/wake (close arms = sleep, open = wake)
- *   - Power optimized: 80MHz CPU, 1kHz PWM, -12dBm BLE TX, 20-40ms adv
+ *   - Hall sensor sleep/wake (close arms = sleep, open = wake), GPIO interrupt
+ *     awake, ULP coprocessor watching the pin in deep sleep
+ *   - Staged boot: lens engine starts before the BLE stack, stages timed
+ *   - BLE host selectable at build time: Bluedroid or NimBLE (ble_transport.h)
+ *   - Power optimized: 80MHz CPU, 1kHz PWM, -12dBm BLE TX
+ *   - Advertising policy: 20-40ms for a window after wake or disconnect,
+ *     then 500ms-1s, optionally none during an untethered session
+ *   - Power management (CONFIG_PM_ENABLE): CPU at 40MHz or light sleep
+ *     between strobe edges, full speed only while led_task computes
+ *   - led_task pinned to APP_CPU at a fixed priority, BLE and housekeeping
+ *     on PRO_CPU
+ *   - Clock sync ping (0xB0) and scheduled start (0xB1), so several devices
+ *     or a device and an external stimulus run phase-locked
+ *   - Biofeedback pacing: RR intervals (or a feedback value) streamed in,
+ *     resonance breathing rate and strobe worked out on the device (pacing.h)
+ *   - Energy accounting: time per radio, engine and sleep state and wake
+ *     counts in RTC memory, charge estimated from per-state currents (0xB4)
  * 
  * BLE Commands:
  *   Single byte (0x00-0xFF)                    - Legacy: direct duty (0=clear, 255=full dark)
@@ -22,6 +45,25 @@
  *   0xA5 [duty]                                 - Static override (0-100%), stops program
  *   0xA6                                        - Resume / restart session
  *   0xA7                                        - Enter sleep immediately
+ *   0xA8 [what] [args...]                       - Query/report (trace dump, trace mask)
+ *   0xA9 {[op] [len] [args...]}...              - Batch: several commands applied atomically
+ *   0xAA [period]                               - Telemetry notify period (x10 ms, 0 = off)
+ *   0xAB [op] [args...]                         - Session program upload / select
+ *   0xAC [profile]                              - Connection profile (0=auto, 1=low latency, 2=low power)
+ *   0xAD [lens] [mode] [phase] [scale]          - Per-lens strobe mode, phase offset and duty scale
+ *   0xAE [op] [args...]                         - Lens response table upload / raw hold
+ *   0xAF [seconds]                              - Strobe timing benchmark, 1-50 Hz (0 = abort)
+ *   0xB0 [seq]                                  - Clock sync ping, answered at once by a pong on FF02
+ *   0xB1 [t_us u64]                             - Restart the session (as 0xA6) at device time t_us
+ *   0xB2 [mask]                                 - Event markers on FF02 (strobe edges, breath phases, session)
+ *   0xB3 [policy] [window_s]                    - Advertising policy (0=fast, 1=adaptive, 2=quiet)
+ *   0xB4 [op] [args...]                         - Energy accounting: per-state currents, clear counters
+ *   0xB5 [mode] [rate_min] [rate_max] [inh %] [hz_low] [hz_high] - Biofeedback pacing (0=off, 1=RR, 2=value)
+ *   0xB6 [rr_ms u16]...                         - RR intervals for pacing, oldest first (up to 10)
+ *   0xB7 [value u16]                            - Feedback value for pacing, 0-65535
+ *
+ * Telemetry: FF02 notifies a packed status packet while notifications are on,
+ * the pong for each clock sync ping and batches of event markers
  */
 
 #include <stdio.h>
@@ -29,383 +71,3371 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_system.h"
+#include "esp_idf_version.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
-#include "esp_bt.h"
-#include "esp_gap_ble_api.h"
-#include "esp_gatts_api.h"
-#include "esp_bt_defs.h"
-#include "esp_bt_main.h"
-#include "esp_gatt_common_api.h"
 #include "driver/ledc.h"
 #include "driver/gpio.h"
 #include "driver/rtc_io.h"
 #include "esp_sleep.h"
+#include "esp_timer.h"
+#include "esp_crc.h"
+#include "esp_private/esp_clk.h"
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+#include "esp_rom_gpio.h"
+#include "soc/gpio_sig_map.h"
+#if CONFIG_ULP_COPROC_ENABLED
+#include "esp32/ulp.h"
+#include "soc/rtc_io_reg.h"
+#endif
+#include "ble_transport.h"
+#include "session_engine.h"
+#include "pacing.h"
 
-#define GATTS_SERVICE_UUID_TEST   0x00FF
-#define GATTS_CHAR_UUID_TEST      0xFF01
-#define GATTS_NUM_HANDLE_TEST     4
+// Hot-path logging (per-write byte dumps, per-command lines). Off by default:
+// the binary event trace below records the same information without
+// blocking on the UART. Build with -DEDGE_LOG_HOTPATH=1 to get it back.
+#ifndef EDGE_LOG_HOTPATH
+#define EDGE_LOG_HOTPATH 0
+#endif
+#if EDGE_LOG_HOTPATH
+#define HOT_LOGI(...) ESP_LOGI(__VA_ARGS__)
+#else
+#define HOT_LOGI(...) do { } while (0)
+#endif
 
-#define DEVICE_NAME            "Smart_Glasses"
-#define TEST_APP_ID            0
+// Binary event trace (cheap enough for production, -DEDGE_TRACE=0 removes it)
+#ifndef EDGE_TRACE
+#define EDGE_TRACE 1
+#endif
 
-static uint8_t adv_config_done = 0;
-#define ADV_CONFIG_FLAG      (1 << 0)
+// Strobe edges are switched from an ISR-dispatched esp_timer callback
+#ifndef CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+#error "Enable CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD (menuconfig > ESP Timer)"
+#endif
+
+// ...and on APP_CPU with led_task, away from the BT controller interrupts.
+// The ISR stays on PRO_CPU without the affinity option (ESP-IDF 5.1+).
+#if CONFIG_FREERTOS_UNICORE
+#warning "Unicore build: strobe edges share the core with the BT controller"
+#elif ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 1, 0)
+#warning "esp_timer ISR affinity needs ESP-IDF 5.1+: strobe edges run on PRO_CPU with the BT controller"
+#elif !CONFIG_ESP_TIMER_ISR_AFFINITY_CPU1
+#error "Enable CONFIG_ESP_TIMER_ISR_AFFINITY_CPU1 (menuconfig > ESP Timer)"
+#endif
 
 static const char *TAG = "SmartGlasses";
 
-// Advertising parameters - match original for compatibility
-static esp_ble_adv_params_t adv_params = {
-    .adv_int_min        = 0x20,   // 20ms (original)
-    .adv_int_max        = 0x40,   // 40ms (original)
-    .adv_type           = ADV_TYPE_IND,
-    .own_addr_type      = BLE_ADDR_TYPE_PUBLIC,
-    .channel_map        = ADV_CHNL_ALL,
-    .adv_filter_policy  = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
+//*********************************************************** */
+// Hardware Configuration
+//*********************************************************** */
+#define HALL_PIN GPIO_NUM_4
+#define SLEEP_HALL_WAIT_TIME 5
+
+// Lens drivers. Every lens has its own LEDC channel and pin, all on one LEDC
+// timer, so duty updates latch on the same PWM period for every eye. Early
+// boards tie GPIO26 to GPIO27 and must not drive it; build with
+// -DEDGE_LENS_COUNT=2 for boards with the lenses wired separately.
+#ifndef EDGE_LENS_COUNT
+#define EDGE_LENS_COUNT 1
+#endif
+#define LENS_COUNT              EDGE_LENS_COUNT
+
+#define PWM_TIMER               LEDC_TIMER_0
+#define PWM_MODE                LEDC_LOW_SPEED_MODE
+#define PWM_DUTY_RES            LEDC_TIMER_10_BIT
+#define PWM_FREQUENCY           (1000)
+
+#define PWM1_OUTPUT_IO          (27)
+#define PWM1_CHANNEL            LEDC_CHANNEL_0
+#define PWM2_OUTPUT_IO          (26)
+#define PWM2_CHANNEL            LEDC_CHANNEL_1
+
+//*********************************************************** */
+// Session Parameters
+//*********************************************************** */
+// Double-buffered: led_task applies BLE commands to the inactive copy and
+// publishes it by flipping params_active, so readers never see a
+// half-applied multi-field update.
+typedef struct {
+    uint8_t brightness;        // Brightness 0-100%
+
+    // Strobe progression
+    uint8_t start_hz;          // Starting strobe frequency
+    uint8_t end_hz;            // Ending strobe frequency
+
+    // Breathing progression (x0.1 seconds)
+    // Start: inhale-0-exhale-0, End: inhale-hold_in_end-exhale-hold_out_end
+    uint8_t inhale_time;       // Fixed throughout
+    uint8_t exhale_time;       // Fixed throughout
+    uint8_t hold_in_end;       // End hold_in (starts at 0)
+    uint8_t hold_out_end;      // End hold_out (starts at 0)
+
+    uint8_t session_minutes;   // Session duration in minutes
+} session_params_t;
+
+#define SESSION_PARAMS_DEFAULT {   \
+    .brightness      = 100,        \
+    .start_hz        = 12,         \
+    .end_hz          = 8,          \
+    .inhale_time     = 40,         \
+    .exhale_time     = 40,         \
+    .hold_in_end     = 40,         \
+    .hold_out_end    = 40,         \
+    .session_minutes = 10,         \
+}
+
+static session_params_t params_buf[2] = { SESSION_PARAMS_DEFAULT, SESSION_PARAMS_DEFAULT };
+static volatile uint8_t params_active = 0;
+
+static inline const session_params_t *params_get(void)
+{
+    return &params_buf[params_active];
+}
+
+// Session state - owned by led_task (app_main sets it before the task starts)
+static int64_t session_start_us = 0;     // When session started, esp_timer time
+static uint8_t session_active = 0;       // Is a timed session running?
+static volatile uint8_t session_ended = 0; // Has session completed (trigger sleep)?
+
+// Static override mode
+static uint8_t override_active = 0;
+static uint8_t override_duty = 0;
+
+// led_task blocks on a task notification between breathing phase
+// transitions; BLE commands wake it through engine_notify(). Envelope ramps
+// and strobe edges run in hardware/ISR while it sleeps.
+static TaskHandle_t led_task_handle = NULL;
+
+// Task layout on the two cores. PRO_CPU (0) takes the BT controller and
+// host tasks (pinned there by default on both stacks, prio 19-23), the
+// esp_timer task, app_main and the BLE bring-up. led_task has APP_CPU (1)
+// to itself at a priority above any application task and below the
+// system ones, so BLE traffic and logging never delay an envelope step.
+// Its stack is checked against LED_TASK_STACK_MARGIN in the benchmark.
+#if CONFIG_FREERTOS_UNICORE
+#define LED_TASK_CORE         0
+#else
+#define LED_TASK_CORE         1
+#endif
+#define HOUSEKEEPING_CORE     0
+#define LED_TASK_PRIO         18
+#define BLE_START_TASK_PRIO   1
+#define LED_TASK_STACK        4096     // Unmeasured guess: resize from the bench "led_task stack" log
+#define LED_TASK_STACK_MARGIN 768      // Bytes that should stay untouched
+#define BLE_START_TASK_STACK  4096
+
+//*********************************************************** */
+// Event Trace
+//*********************************************************** */
+// Fixed-size binary ring of timestamped engine events in RTC memory, so the
+// sleep decision that ended the last wake cycle is still there after boot.
+// Writers reserve a slot with an atomic increment and never block, so it is
+// safe from the strobe ISR. Dumped over UART or read back over BLE (0xA8).
+#define TRACE_SIZE          256          // Records, power of two
+#define TRACE_MAGIC         0x54524331   // "TRC1"
+
+typedef enum {
+    TRACE_CMD = 1,       // a = opcode, b = first two argument bytes
+    TRACE_PHASE,         // a = breath phase, b = phase length (10 ms units)
+    TRACE_EDGE,          // a = dark lens mask (bit per lens)
+    TRACE_SESSION,       // a = trace_session_t
+    TRACE_SLEEP,         // a = trace_sleep_t
+    TRACE_DROP,          // a = opcode of command dropped on a full queue
+    TRACE_PROG,          // a = prog_result_t of a program commit, b = size
+} trace_type_t;
+
+typedef enum {
+    TRACE_SESSION_RESTART = 0,
+    TRACE_SESSION_OVERRIDE,
+    TRACE_SESSION_COMPLETE,
+    TRACE_SESSION_RAW_HOLD,     // 0xAE raw hold, b = raw duty
+    TRACE_SESSION_BENCH,        // 0xAF benchmark start, b = dwell s
+    TRACE_SESSION_SCHEDULED,    // 0xB1 start armed, b = ms until it
+} trace_session_t;
+
+typedef enum {
+    TRACE_SLEEP_SESSION_END = 0,
+    TRACE_SLEEP_HALL,
+    TRACE_SLEEP_RESLEEP,        // Woke with arms still closed
+} trace_sleep_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t t_us;       // esp_timer time, low 32 bits
+    uint8_t type;
+    uint8_t a;
+    uint16_t b;
+} trace_rec_t;
+
+// Edges are off by default - at 50 Hz they flush the ring in ~2.5 s
+#define TRACE_MASK_DEFAULT  (0xFF & ~(1u << TRACE_EDGE))
+
+#if EDGE_TRACE
+static RTC_NOINIT_ATTR uint32_t trace_magic;
+static RTC_NOINIT_ATTR uint32_t trace_head;   // Total records ever written
+static RTC_NOINIT_ATTR trace_rec_t trace_buf[TRACE_SIZE];
+static uint8_t trace_mask = TRACE_MASK_DEFAULT;
+
+static void trace_init(void)
+{
+    if (trace_magic != TRACE_MAGIC) {
+        // Cold boot: RTC memory holds garbage
+        trace_head = 0;
+        trace_magic = TRACE_MAGIC;
+    }
+}
+
+static void IRAM_ATTR trace_write(uint8_t type, uint8_t a, uint16_t b)
+{
+    if (!(trace_mask & (1u << type))) {
+        return;
+    }
+    uint32_t seq = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    trace_rec_t *r = &trace_buf[seq % TRACE_SIZE];
+    r->t_us = (uint32_t)esp_timer_get_time();
+    r->type = type;
+    r->a = a;
+    r->b = b;
+}
+
+// Copy up to max_recs records starting at sequence number *seq (clamped to
+// the oldest still held). Updates *seq to the first copied record.
+static uint32_t trace_read(uint32_t *seq, trace_rec_t *out, uint32_t max_recs)
+{
+    uint32_t head = __atomic_load_n(&trace_head, __ATOMIC_RELAXED);
+    uint32_t oldest = head > TRACE_SIZE ? head - TRACE_SIZE : 0;
+    if (*seq < oldest || *seq > head) *seq = oldest;
+    uint32_t n = head - *seq;
+    if (n > max_recs) n = max_recs;
+    for (uint32_t i = 0; i < n; i++) {
+        out[i] = trace_buf[(*seq + i) % TRACE_SIZE];
+    }
+    return n;
+}
+
+static void trace_dump_uart(void)
+{
+    uint32_t seq = 0;
+    trace_rec_t rec;
+    printf("TRACE BEGIN head=%lu\n", (unsigned long)trace_head);
+    while (trace_read(&seq, &rec, 1) == 1) {
+        printf("TRACE %lu %lu %u %u %u\n", (unsigned long)seq, (unsigned long)rec.t_us,
+               rec.type, rec.a, rec.b);
+        seq++;
+    }
+    printf("TRACE END\n");
+}
+
+#define TRACE(type, a, b) trace_write((type), (a), (b))
+#else
+#define trace_init() do { } while (0)
+#define trace_dump_uart() do { } while (0)
+#define TRACE(type, a, b) do { } while (0)
+#endif
+
+//*********************************************************** */
+// Event Markers
+//*********************************************************** */
+// Ring of timestamped stimulus events for recording alongside EEG: every
+// strobe gate change (taken in the strobe ISR right after the lenses
+// switch), every breath phase start and session start/stop. 0xB2 selects
+// which kinds are kept. While a client is subscribed, a timer drains the
+// ring into marker packets on FF02 every MARKER_FLUSH_MS; the host maps the
+// device times onto its own clock with the 0xB0 clock sync. Markers are
+// only taken off the ring once a notify has been queued, and if the link
+// falls behind the oldest are overwritten; the sequence number in each
+// packet shows the gap.
+#define MARKER_SIZE         128          // Markers, power of two
+#define MARKER_FLUSH_MS     20
+#define MARKER_HDR_LEN      4
+#define MARKER_REC_LEN      6
+#define MARKER_FLUSH_PKTS   4            // Per flush, so a backlog cannot hog the timer task
+#define MARKER_MASK_ALL     0x07
+
+typedef enum {
+    MARKER_STROBE = 0,   // arg = dark lens mask after the edge (bit per lens)
+    MARKER_PHASE,        // arg = breath phase 0-3 starting
+    MARKER_SESSION,      // arg = trace_session_t (restart, override, complete...)
+} marker_kind_t;
+
+typedef struct {
+    uint32_t t_us;       // esp_timer time, low 32 bits
+    uint8_t kind;
+    uint8_t arg;
+} marker_t;
+
+static portMUX_TYPE marker_mux = portMUX_INITIALIZER_UNLOCKED;
+static DRAM_ATTR marker_t marker_buf[MARKER_SIZE];
+static uint32_t marker_head = 0;         // Total markers ever pushed
+static uint32_t marker_tail = 0;         // Next to send
+static volatile uint8_t marker_mask = 0; // Bit per marker_kind_t, set by 0xB2
+
+// Record an event at t_us. Safe from the strobe ISR.
+static void IRAM_ATTR marker_push(uint8_t kind, uint8_t arg, int64_t t_us)
+{
+    if (!(marker_mask & (1u << kind))) {
+        return;
+    }
+    portENTER_CRITICAL_SAFE(&marker_mux);
+    marker_t *m = &marker_buf[marker_head % MARKER_SIZE];
+    m->t_us = (uint32_t)t_us;
+    m->kind = kind;
+    m->arg = arg;
+    marker_head++;
+    if (marker_head - marker_tail > MARKER_SIZE) {
+        marker_tail = marker_head - MARKER_SIZE;   // Overwrote the oldest
+    }
+    portEXIT_CRITICAL_SAFE(&marker_mux);
+}
+
+// Select the kinds to record (0xB2); markers still pending from an
+// earlier selection are dropped
+static void marker_select(uint8_t mask)
+{
+    portENTER_CRITICAL(&marker_mux);
+    marker_tail = marker_head;
+    marker_mask = mask & MARKER_MASK_ALL;
+    portEXIT_CRITICAL(&marker_mux);
+}
+
+// Pack up to max_recs pending markers into a packet without taking them
+// off the ring; returns the packet length (0 when none are pending)
+//   [0] type  [1] count  [2..3] sequence number of the first (u16)
+//   then per marker [t_us u32] [kind] [arg]
+static uint16_t marker_pack(uint8_t *out, uint32_t max_recs, uint32_t *first)
+{
+    portENTER_CRITICAL(&marker_mux);
+    uint32_t seq = marker_tail;
+    uint32_t n = marker_head - seq;
+    if (n > max_recs) n = max_recs;
+    for (uint32_t i = 0; i < n; i++) {
+        const marker_t *m = &marker_buf[(seq + i) % MARKER_SIZE];
+        uint8_t *p = &out[MARKER_HDR_LEN + i * MARKER_REC_LEN];
+        memcpy(p, &m->t_us, 4);
+        p[4] = m->kind;
+        p[5] = m->arg;
+    }
+    portEXIT_CRITICAL(&marker_mux);
+    if (n == 0) {
+        return 0;
+    }
+    uint16_t seq16 = (uint16_t)seq;
+    out[1] = (uint8_t)n;
+    memcpy(&out[2], &seq16, 2);
+    *first = seq;
+    return MARKER_HDR_LEN + n * MARKER_REC_LEN;
+}
+
+// The n markers from first have been sent
+static void marker_commit(uint32_t first, uint32_t n)
+{
+    portENTER_CRITICAL(&marker_mux);
+    if ((int32_t)(first + n - marker_tail) > 0) {
+        marker_tail = first + n;
+    }
+    portEXIT_CRITICAL(&marker_mux);
+}
+
+//*********************************************************** */
+// Read Reports
+//*********************************************************** */
+// A read of the command characteristic returns the report last selected by
+// a 0xA8 query. led_task builds the report into report_buf; the GATTS read
+// handler serves it (long reads use the offset), so one snapshot is
+// consistent across all the blob reads that fetch it.
+#define REPORT_MAX_LEN      512          // ATT attribute value limit
+
+typedef enum {
+    REPORT_NONE = 0,
+    REPORT_TRACE = 1,
+    REPORT_PROGRAM = 2,
+    REPORT_BOOT = 3,
+    REPORT_CONN = 4,
+    REPORT_LENS = 5,
+    REPORT_CALIB = 6,
+    REPORT_BENCH = 7,
+    REPORT_SYNC = 8,
+    REPORT_ADV = 9,
+    REPORT_ENERGY = 10,
+    REPORT_PACE = 11,
+} report_kind_t;
+
+static portMUX_TYPE report_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t report_buf[REPORT_MAX_LEN];
+static uint16_t report_len = 0;
+
+// Publish a new report (called from led_task)
+static void report_set(const uint8_t *data, uint16_t len)
+{
+    if (len > REPORT_MAX_LEN) len = REPORT_MAX_LEN;
+    portENTER_CRITICAL(&report_mux);
+    memcpy(report_buf, data, len);
+    report_len = len;
+    portEXIT_CRITICAL(&report_mux);
+}
+
+// Copy report bytes from offset for a GATT read; returns -1 on bad offset
+static int report_copy(uint16_t offset, uint8_t *out, uint16_t max)
+{
+    int n;
+    portENTER_CRITICAL(&report_mux);
+    if (offset > report_len) {
+        n = -1;
+    } else {
+        n = report_len - offset;
+        if (n > max) n = max;
+        memcpy(out, &report_buf[offset], n);
+    }
+    portEXIT_CRITICAL(&report_mux);
+    return n;
+}
+
+#if EDGE_TRACE
+// Trace report: 16-byte header followed by records oldest first
+//   [0] kind  [1] record size  [2] count  [3] reserved
+//   [4..7] first seq  [8..11] head (total written)  [12..15] now (us, low 32)
+#define TRACE_REPORT_HDR    16
+#define TRACE_REPORT_RECS   ((REPORT_MAX_LEN - TRACE_REPORT_HDR) / sizeof(trace_rec_t))
+
+static void report_trace(uint32_t seq)
+{
+    static uint8_t buf[REPORT_MAX_LEN];
+    uint32_t n = trace_read(&seq, (trace_rec_t *)&buf[TRACE_REPORT_HDR], TRACE_REPORT_RECS);
+    uint32_t head = trace_head;
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    buf[0] = REPORT_TRACE;
+    buf[1] = sizeof(trace_rec_t);
+    buf[2] = (uint8_t)n;
+    buf[3] = 0;
+    memcpy(&buf[4], &seq, 4);
+    memcpy(&buf[8], &head, 4);
+    memcpy(&buf[12], &now, 4);
+    report_set(buf, TRACE_REPORT_HDR + n * sizeof(trace_rec_t));
+}
+#endif
+
+//*********************************************************** */
+// Boot Timing
+//*********************************************************** */
+// app_main starts the lens engine first and brings BLE up afterwards in a
+// lower-priority task, so a wake strobes without waiting for the BLE stack.
+// Each stage is stamped with esp_timer time (us since startup); the stamps
+// are logged once advertising starts and served as a 0xA8 report, so
+// time-to-first-strobe can be tracked across builds.
+typedef enum {
+    BOOT_APP_MAIN = 0,   // app_main entered
+    BOOT_NVS,            // NVS up, parameters and program loaded
+    BOOT_ENGINE,         // PWM, timers and session ready
+    BOOT_FIRST_STROBE,   // led_task started the envelope and strobe
+    BOOT_BLE_CTRL,       // BT controller enabled
+    BOOT_BLE_HOST,       // BLE host up, GATT service registered
+    BOOT_ADV,            // First advertising start
+    BOOT_STAGE_COUNT,
+} boot_stage_t;
+
+static uint32_t boot_us[BOOT_STAGE_COUNT];
+
+// Stamp a stage the first time it is reached
+static void boot_mark(boot_stage_t stage)
+{
+    if (boot_us[stage] == 0) {
+        boot_us[stage] = (uint32_t)esp_timer_get_time();
+    }
+}
+
+// Boot report: [0] kind  [1] stage count  [2..3] reserved
+//   then one u32 per boot_stage_t (us since startup, 0 = not reached)
+static void report_boot(void)
+{
+    uint8_t buf[4 + 4 * BOOT_STAGE_COUNT];
+    buf[0] = REPORT_BOOT;
+    buf[1] = BOOT_STAGE_COUNT;
+    buf[2] = 0;
+    buf[3] = 0;
+    memcpy(&buf[4], boot_us, sizeof(boot_us));
+    report_set(buf, sizeof(buf));
+}
+
+//*********************************************************** */
+// Power Management
+//*********************************************************** */
+// With CONFIG_PM_ENABLE the CPU runs at PM_CPU_MIN_MHZ whenever nothing
+// holds a lock, and with CONFIG_FREERTOS_USE_TICKLESS_IDLE it light-sleeps
+// between events. The lens needs no CPU in between: the LEDC is clocked
+// from RC_FAST, which frequency changes do not touch and which keeps
+// running in light sleep, and strobe edges are esp_timer alarms, which the
+// idle task wakes up in time for. led_task holds pm_cpu_lock only while it
+// computes (commands, phase set-up); the strobe ISR is short enough for the
+// low clock. The BT controller modem-sleeps between connection events; on
+// the ESP32 it allows light sleep only with a 32 kHz low-power clock, and
+// otherwise the CPU still drops to PM_CPU_MIN_MHZ.
+#define PM_CPU_MAX_MHZ      80
+#define PM_CPU_MIN_MHZ      40          // XTAL
+
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t pm_cpu_lock = NULL;
+#endif
+
+static void pm_init(void)
+{
+#if CONFIG_PM_ENABLE
+    esp_pm_config_t cfg = {
+        .max_freq_mhz = PM_CPU_MAX_MHZ,
+        .min_freq_mhz = PM_CPU_MIN_MHZ,
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        .light_sleep_enable = true,
+#endif
+    };
+    ESP_ERROR_CHECK(esp_pm_configure(&cfg));
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "engine", &pm_cpu_lock));
+    esp_pm_lock_acquire(pm_cpu_lock);       // Held through boot, led_task takes it over
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RC_FAST, ESP_PD_OPTION_ON);  // LEDC clock
+    esp_sleep_enable_gpio_wakeup();                                // Hall pin
+#endif
+#endif
+}
+
+// led_task is about to compute / about to block
+static inline void pm_busy(void)
+{
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_acquire(pm_cpu_lock);
+#endif
+}
+
+static inline void pm_idle(void)
+{
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_release(pm_cpu_lock);
+#endif
+}
+
+//*********************************************************** */
+// PWM Functions
+//*********************************************************** */
+// One row per lens; EDGE_LENS_COUNT picks how many are driven. Adding a
+// channel is a row here.
+typedef struct {
+    uint8_t gpio;
+    ledc_channel_t channel;
+} lens_hw_t;
+
+static const DRAM_ATTR lens_hw_t lens_hw[] = {    // Read by the strobe ISR
+    { PWM1_OUTPUT_IO, PWM1_CHANNEL },   // Left
+    { PWM2_OUTPUT_IO, PWM2_CHANNEL },   // Right
+};
+_Static_assert(LENS_COUNT >= 1 && LENS_COUNT <= sizeof(lens_hw) / sizeof(lens_hw[0]),
+               "EDGE_LENS_COUNT exceeds the lens pin table");
+
+// Per-lens layout, set by 0xAD. The strobe fields are read by the strobe
+// ISR and written under strobe_mux; scale is only used by led_task.
+typedef struct {
+    uint8_t strobe;             // 1 = gated by the strobe, 0 = envelope only
+    uint8_t scale;              // Duty scale, % of the envelope
+    uint32_t phase_offset;      // Strobe phase offset, 2^32 = one cycle
+} lens_cfg_t;
+
+static lens_cfg_t lens_cfg[LENS_COUNT];
+static uint8_t lens_changed = 0;    // Scales changed, envelope not reprogrammed yet
+
+static void PWM_Init(void)
+{
+    ledc_timer_config_t pwm_timer = {
+        .speed_mode       = PWM_MODE,
+        .duty_resolution  = PWM_DUTY_RES,
+        .timer_num        = PWM_TIMER,
+        .freq_hz          = PWM_FREQUENCY,
+#if CONFIG_PM_ENABLE
+        .clk_cfg          = LEDC_USE_RC_FAST_CLK    // Stable across DFS and light sleep
+#else
+        .clk_cfg          = LEDC_AUTO_CLK
+#endif
+    };
+    ESP_ERROR_CHECK(ledc_timer_config(&pwm_timer));
+
+    for (int i = 0; i < LENS_COUNT; i++) {
+        ledc_channel_config_t pwm_channel = {
+            .speed_mode     = PWM_MODE,
+            .channel        = lens_hw[i].channel,
+            .timer_sel      = PWM_TIMER,
+            .intr_type      = LEDC_INTR_DISABLE,
+            .gpio_num       = lens_hw[i].gpio,
+            .duty           = 0,
+            .hpoint         = 0         // Same hpoint: all lenses switch together
+        };
+        ESP_ERROR_CHECK(ledc_channel_config(&pwm_channel));
+        lens_cfg[i].strobe = 1;
+        lens_cfg[i].scale = 100;
+        lens_cfg[i].phase_offset = 0;
+    }
+
+    // Hardware fades for the breathing ramps
+    ESP_ERROR_CHECK(ledc_fade_func_install(0));
+}
+
+// LCD lens response. Below ~40% PWM (raw ~400) the lens doesn't visibly
+// change, and above it opacity follows the drive non-linearly. Envelope
+// duty 0-100 is perceptual (even steps of visible opacity) and goes
+// through a table to the 10-bit LEDC duty: 0 = raw 0 (fully clear), 1 = the
+// first visible level. The built-in table is a gamma 2 curve over raw
+// 400-1024, flattest near the threshold where the LCD reacts most; a table
+// measured on the device (0xAE) replaces it.
+#define PWM_MAX 1024
+#define LENS_LUT_SIZE 101
+
+static const uint16_t lens_lut_default[LENS_LUT_SIZE] = {
+       0,  400,  400,  401,  401,  402,  402,  403,  404,  405,   // 0
+     406,  408,  409,  411,  412,  414,  416,  418,  420,  423,   // 10
+     425,  428,  430,  433,  436,  439,  442,  445,  449,  452,   // 20
+     456,  460,  464,  468,  472,  476,  481,  485,  490,  495,   // 30
+     500,  505,  510,  515,  521,  526,  532,  538,  544,  550,   // 40
+     556,  562,  569,  575,  582,  589,  596,  603,  610,  617,   // 50
+     625,  632,  640,  648,  656,  664,  672,  680,  689,  697,   // 60
+     706,  715,  723,  733,  742,  751,  760,  770,  780,  789,   // 70
+     799,  809,  820,  830,  840,  851,  862,  872,  883,  894,   // 80
+     905,  917,  928,  940,  951,  963,  975,  987,  999, 1012,   // 90
+    1024,                                                         // 100
+};
+
+// Table in use, set up by lut_load() before the engine starts
+static uint16_t lens_lut[LENS_LUT_SIZE];
+
+static inline uint32_t lens_duty_to_raw(uint32_t duty) {
+    return lens_lut[duty < LENS_LUT_SIZE ? duty : LENS_LUT_SIZE - 1];
+}
+
+// Inverse of lens_duty_to_raw, for reporting the duty a fade has reached
+static uint32_t lens_raw_to_duty(uint32_t raw) {
+    if (raw == 0) {
+        return 0;
+    }
+    uint32_t lo = 1, hi = LENS_LUT_SIZE - 1;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi + 1) / 2;
+        if (lens_lut[mid] <= raw) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// Raw level of lens i for an envelope duty, after its scale. A scaled lens
+// keeps the first visible level, so fades start from the same floor.
+static uint32_t lens_raw(int i, uint32_t duty) {
+    uint32_t scale = lens_cfg[i].scale;
+    if (duty == 0 || scale == 0) {
+        return 0;
+    }
+    if (scale != 100) {
+        duty = duty * scale / 100;
+        if (duty == 0) duty = 1;
+    }
+    return lens_duty_to_raw(duty);
+}
+
+// Write every lens, at once or as a hardware fade over fade_ms. All new
+// duties are written before any is latched (fades are set up first and
+// started back to back), so the channels change on the same PWM period and
+// fades step in lockstep on the shared timer.
+static void lens_write(uint32_t duty, uint32_t fade_ms) {
+    for (int i = 0; i < LENS_COUNT; i++) {
+        ledc_fade_stop(PWM_MODE, lens_hw[i].channel);
+        if (fade_ms == 0) {
+            ledc_set_duty(PWM_MODE, lens_hw[i].channel, lens_raw(i, duty));
+        } else {
+            ledc_set_fade_with_time(PWM_MODE, lens_hw[i].channel, lens_raw(i, duty), fade_ms);
+        }
+    }
+    for (int i = 0; i < LENS_COUNT; i++) {
+        if (fade_ms == 0) {
+            ledc_update_duty(PWM_MODE, lens_hw[i].channel);
+        } else {
+            ledc_fade_start(PWM_MODE, lens_hw[i].channel, LEDC_FADE_NO_WAIT);
+        }
+    }
+}
+
+// Breath ramps. The LEDC fades linearly in raw duty, which on a curved
+// table is not linear in opacity, so a ramp runs as LENS_RAMP_STEPS
+// hardware fades between table points. led_task programs each one as the
+// one before ends (lens_ramp_poll); the LEDC does the stepping in between.
+#define LENS_RAMP_STEPS 8
+
+typedef struct {
+    uint8_t from, to;           // Envelope duty
+    uint8_t step;               // Next sub-fade to program
+    uint32_t start;             // Tick the ramp began
+    uint32_t len;               // Ramp length in ticks, 0 = no ramp
+} lens_ramp_t;
+
+// Envelope state - owned by led_task
+static lens_ramp_t lens_ramp;
+static uint8_t lens_env = 0;    // Envelope duty set, or a running ramp's target
+
+// Envelope duty at tick now, following a running ramp
+static uint32_t lens_env_now(uint32_t now) {
+    const lens_ramp_t *r = &lens_ramp;
+    uint32_t t = now - r->start;
+    if (r->len == 0 || t >= r->len) {
+        return lens_env;
+    }
+    return r->from + ((int32_t)r->to - r->from) * (int32_t)t / (int32_t)r->len;
+}
+
+// Set every lens to the envelope duty, ending any ramp
+static void lens_setduty(uint32_t duty) {
+    lens_ramp.len = 0;
+    lens_env = duty;
+    lens_write(duty, 0);
+}
+
+// Hold a raw duty on every lens, bypassing the table and scales (0xAE
+// calibration measurements)
+static void lens_setraw(uint32_t raw) {
+    lens_ramp.len = 0;
+    lens_env = lens_raw_to_duty(raw);
+    for (int i = 0; i < LENS_COUNT; i++) {
+        ledc_fade_stop(PWM_MODE, lens_hw[i].channel);
+        ledc_set_duty(PWM_MODE, lens_hw[i].channel, raw);
+    }
+    for (int i = 0; i < LENS_COUNT; i++) {
+        ledc_update_duty(PWM_MODE, lens_hw[i].channel);
+    }
+}
+
+// Program the sub-fade due at tick now, if not done yet. Returns the ticks
+// until the next one is due, portMAX_DELAY once the last is running.
+static uint32_t lens_ramp_poll(uint32_t now) {
+    lens_ramp_t *r = &lens_ramp;
+    if (r->len == 0 || r->step >= LENS_RAMP_STEPS) {
+        return portMAX_DELAY;
+    }
+    uint32_t t = now - r->start;
+    uint32_t k = t >= r->len ? LENS_RAMP_STEPS - 1 : t * LENS_RAMP_STEPS / r->len;
+    if (k >= r->step) {
+        // Late wakes skip ahead: fade from wherever the lenses are
+        uint32_t end = r->len * (k + 1) / LENS_RAMP_STEPS;
+        uint32_t target = r->from + ((int32_t)r->to - r->from) * (int32_t)(k + 1) / LENS_RAMP_STEPS;
+        lens_write(target, end > t ? (end - t) * portTICK_PERIOD_MS : 0);
+        r->step = k + 1;
+    }
+    if (r->step >= LENS_RAMP_STEPS) {
+        return portMAX_DELAY;
+    }
+    return r->len * r->step / LENS_RAMP_STEPS - t;
+}
+
+// Ramp the envelope from where it is now to duty over len_ticks
+static void lens_ramp_start(uint32_t duty, uint32_t len_ticks, uint32_t now) {
+    lens_ramp_t *r = &lens_ramp;
+    r->from = lens_env_now(now);
+    r->to = duty;
+    r->step = 0;
+    r->start = now;
+    r->len = len_ticks;
+    lens_env = duty;
+    if (len_ticks == 0) {
+        lens_setduty(duty);
+        return;
+    }
+    lens_ramp_poll(now);
+}
+
+//*********************************************************** */
+// Strobe Engine
+//*********************************************************** */
+// The LEDC channels always carry the envelope duty (breathing x brightness).
+// Strobe gating happens in the GPIO matrix: a dark edge routes a lens's LEDC
+// signal to its pin, a clear edge routes the plain GPIO output (held low =
+// raw 0). Edges are scheduled against absolute deadlines from an
+// ISR-dispatched esp_timer, so timing has us resolution and no task switch
+// per edge.
+//
+// Frequency comes from a 32-bit phase accumulator: one strobe cycle is 2^32
+// phase units, dark for the first 75%. The per-us phase increment follows the
+// session ramp and is evaluated in the ISR from a precomputed Q32 slope, so
+// the sweep is continuous and the phase never jumps when the rate changes.
+// The ISR only needs integer multiply/divide; no float math per edge.
+//
+// All lenses share the accumulator; each sees it shifted by its own phase
+// offset (half a cycle = alternating eyes). Every edge gates all lenses in
+// the same ISR pass, so in-phase lenses switch together and offsets stay
+// exact across the frequency sweep.
+#define STROBE_MIN_DELAY_US   50            // Re-sync floor if an edge deadline was missed
+#define STROBE_PHASE_DARK_END 0xC0000000u   // Dark 3/4, clear 1/4 of each cycle
+
+static esp_timer_handle_t strobe_timer = NULL;
+static portMUX_TYPE strobe_mux = portMUX_INITIALIZER_UNLOCKED;
+static volatile uint8_t strobe_running = 0;
+static uint32_t strobe_phase = 0;           // Phase at the next scheduled edge
+static uint8_t strobe_dark_mask = 0xFF;     // Lenses gated dark at the last edge, 0xFF = none yet
+static int64_t strobe_next_edge_us = 0;     // Absolute deadline of next edge
+
+// Frequency ramp: inc(t) = inc_start + slope * (t - ramp_start)
+static uint32_t strobe_inc_start = 0;       // Phase units per us at ramp start
+static uint32_t strobe_inc_end = 0;         // Phase units per us at ramp end
+static int64_t strobe_ramp_slope_q32 = 0;   // d(inc)/dt in Q32 per us
+static int64_t strobe_ramp_start_us = 0;
+static uint32_t strobe_ramp_len_us = 0;
+
+// Hz (Q8) to phase units per microsecond: hz * 2^32 / 1e6
+static uint32_t strobe_inc_from_hz_q8(uint32_t hz_q8)
+{
+    return (uint32_t)(((uint64_t)hz_q8 << 24) / 1000000ULL);
+}
+
+static inline void IRAM_ATTR lens_gate(int i, uint8_t dark)
+{
+    if (dark) {
+        esp_rom_gpio_connect_out_signal(lens_hw[i].gpio, LEDC_LS_SIG_OUT0_IDX + lens_hw[i].channel, false, false);
+    } else {
+        esp_rom_gpio_connect_out_signal(lens_hw[i].gpio, SIG_GPIO_OUT_IDX, false, false);
+    }
+}
+
+static inline uint32_t IRAM_ATTR strobe_inc_at(int64_t t_us)
+{
+    int64_t dt = t_us - strobe_ramp_start_us;
+    if (dt <= 0) return strobe_inc_start;
+    if (dt >= strobe_ramp_len_us) return strobe_inc_end;
+    return strobe_inc_start + (int32_t)((strobe_ramp_slope_q32 * dt) >> 32);
+}
+
+// Benchmark capture (see Strobe Benchmark): while bench_acc.on is set the
+// ISR times lens 0 transitions and accumulates their error against the
+// requested period and dark time, and keeps the worst lateness of any edge
+// against its deadline
+#define BENCH_BUCKETS 10
+
+typedef struct {
+    uint16_t count;
+    int16_t min, max;               // Error, us
+    int32_t sum;
+    uint16_t hist[BENCH_BUCKETS];   // |error| up to bench_bucket_us[i], last = above
+} bench_stat_t;
+
+typedef struct {
+    volatile uint8_t on;
+    uint8_t dark;                   // Lens 0 at the last edge, 0xFF = none yet
+    int32_t period_us;              // Requested cycle
+    int32_t dark_us;                // Requested dark time
+    int64_t last_dark_us;           // Last dark edge, 0 = none yet
+    uint16_t late_max_us;           // Edge entry after its deadline, worst
+    bench_stat_t period, duty;
+} bench_acc_t;
+
+static bench_acc_t bench_acc;
+static const DRAM_ATTR uint16_t bench_bucket_us[BENCH_BUCKETS - 1] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500
 };
 
-// Advertising data
-static esp_ble_adv_data_t adv_data = {
-    .set_scan_rsp = false,
-    .include_name = true,
-    .include_txpower = false,
-    .flag = (ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT),
-};
+static void IRAM_ATTR bench_add(bench_stat_t *s, int32_t err)
+{
+    if (err > INT16_MAX) err = INT16_MAX;
+    if (err < INT16_MIN) err = INT16_MIN;
+    if (s->count == 0 || err < s->min) s->min = err;
+    if (s->count == 0 || err > s->max) s->max = err;
+    if (s->count < UINT16_MAX) s->count++;
+    s->sum += err;
+
+    uint32_t mag = err < 0 ? -err : err;
+    int i = 0;
+    while (i < BENCH_BUCKETS - 1 && mag > bench_bucket_us[i]) i++;
+    if (s->hist[i] < UINT16_MAX) s->hist[i]++;
+}
+
+// Lens 0 is dark (or not) from time t, for an edge due at deadline. Must
+// be called with strobe_mux held.
+static void IRAM_ATTR bench_edge(uint8_t dark, int64_t t, int64_t deadline)
+{
+    bench_acc_t *b = &bench_acc;
+    int64_t late = t - deadline;
+    if (late > b->late_max_us) {
+        b->late_max_us = late > UINT16_MAX ? UINT16_MAX : (uint16_t)late;
+    }
+    if (dark == b->dark) {
+        return;
+    }
+    b->dark = dark;
+    if (dark) {
+        if (b->last_dark_us) {
+            bench_add(&b->period, (int32_t)(t - b->last_dark_us) - b->period_us);
+        }
+        b->last_dark_us = t;
+    } else if (b->last_dark_us) {
+        bench_add(&b->duty, (int32_t)(t - b->last_dark_us) - b->dark_us);
+    }
+}
+
+// Gate every lens for the current phase and arm the timer for the nearest
+// boundary of any of them. Must be called with strobe_mux held.
+static void IRAM_ATTR strobe_edge(void)
+{
+    uint32_t span = STROBE_PHASE_DARK_END;  // No strobing lens: keep the phase running
+    uint8_t dark_mask = 0;
+    for (int i = 0; i < LENS_COUNT; i++) {
+        if (!lens_cfg[i].strobe) {
+            continue;
+        }
+        uint32_t phase = strobe_phase - lens_cfg[i].phase_offset;
+        uint8_t dark = phase < STROBE_PHASE_DARK_END;
+        lens_gate(i, dark);
+        dark_mask |= dark << i;
+        uint32_t s = dark ? (STROBE_PHASE_DARK_END - phase) : (0u - phase);
+        if (s < span) span = s;
+    }
+    TRACE(TRACE_EDGE, dark_mask, 0);
+    if (dark_mask != strobe_dark_mask) {
+        strobe_dark_mask = dark_mask;
+        if (marker_mask & (1u << MARKER_STROBE)) {
+            marker_push(MARKER_STROBE, dark_mask, esp_timer_get_time());
+        }
+    }
+    if (bench_acc.on) {
+        bench_edge(dark_mask & 1, esp_timer_get_time(), strobe_next_edge_us);
+    }
+
+    uint32_t inc = strobe_inc_at(strobe_next_edge_us);
+    uint32_t delay = (span + inc - 1) / inc;
+    strobe_phase += inc * delay;    // Overshoot past the boundary carries into the next cycle
+    strobe_next_edge_us += delay;
+
+    int64_t wait = strobe_next_edge_us - esp_timer_get_time();
+    if (wait < STROBE_MIN_DELAY_US) {
+        // Deadline already passed (e.g. ISR held off) - re-sync rather than burst
+        wait = STROBE_MIN_DELAY_US;
+        strobe_next_edge_us = esp_timer_get_time() + wait;
+    }
+    esp_timer_start_once(strobe_timer, (uint64_t)wait);
+}
+
+static void IRAM_ATTR strobe_timer_cb(void *arg)
+{
+    portENTER_CRITICAL_ISR(&strobe_mux);
+    if (strobe_running) {
+        strobe_edge();
+    }
+    portEXIT_CRITICAL_ISR(&strobe_mux);
+}
+
+static void strobe_init(void)
+{
+    // Clear gate drives the pins from the GPIO output register, keep them low
+    for (int i = 0; i < LENS_COUNT; i++) {
+        gpio_set_level(lens_hw[i].gpio, 0);
+    }
+
+    const esp_timer_create_args_t args = {
+        .callback = strobe_timer_cb,
+        .dispatch_method = ESP_TIMER_ISR,
+        .name = "strobe",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &strobe_timer));
+}
+
+// Set a linear frequency ramp from start to end Hz (Q8) over duration_us,
+// beginning at start_us (esp_timer time). A running strobe picks it up at the
+// next edge without a phase jump.
+static void strobe_set_ramp(uint32_t start_hz_q8, uint32_t end_hz_q8,
+                            int64_t start_us, uint32_t duration_us)
+{
+    uint32_t inc_start = strobe_inc_from_hz_q8(start_hz_q8);
+    uint32_t inc_end = strobe_inc_from_hz_q8(end_hz_q8);
+    int64_t slope = 0;
+    if (duration_us > 0) {
+        slope = (((int64_t)inc_end - (int64_t)inc_start) << 32) / (int64_t)duration_us;
+    }
+
+    portENTER_CRITICAL(&strobe_mux);
+    strobe_inc_start = inc_start;
+    strobe_inc_end = inc_end;
+    strobe_ramp_slope_q32 = slope;
+    strobe_ramp_start_us = start_us;
+    strobe_ramp_len_us = duration_us;
+    portEXIT_CRITICAL(&strobe_mux);
+}
+
+// Start strobing with a dark edge at t_us (esp_timer time), armed on the
+// strobe timer while it is still ahead. If it has passed, the phase is
+// advanced at the current rate to where a strobe started then would be, so
+// devices given the same t_us stay in phase. No-op if already running.
+static void strobe_start_at(int64_t t_us)
+{
+    portENTER_CRITICAL(&strobe_mux);
+    if (!strobe_running) {
+        int64_t now = esp_timer_get_time();
+        strobe_running = 1;
+        strobe_phase = 0;
+        strobe_dark_mask = 0xFF;
+        if (t_us - now >= STROBE_MIN_DELAY_US) {
+            strobe_next_edge_us = t_us;
+            esp_timer_start_once(strobe_timer, (uint64_t)(t_us - now));
+        } else {
+            if (now > t_us) {
+                strobe_phase = strobe_inc_at(now) * (uint32_t)(now - t_us);
+            }
+            strobe_next_edge_us = now;
+            strobe_edge();
+        }
+    }
+    portEXIT_CRITICAL(&strobe_mux);
+}
+
+// Start strobing with a dark edge now. No-op if already running.
+static void strobe_start(void)
+{
+    strobe_start_at(esp_timer_get_time());
+}
+
+// Stop strobing and leave the LEDC signals connected, so lens_setduty()
+// controls the lenses directly again. Safe to call when already stopped.
+static void strobe_stop(void)
+{
+    portENTER_CRITICAL(&strobe_mux);
+    strobe_running = 0;
+    esp_timer_stop(strobe_timer);
+    for (int i = 0; i < LENS_COUNT; i++) {
+        lens_gate(i, 1);
+    }
+    portEXIT_CRITICAL(&strobe_mux);
+}
+
+// Apply a lens layout (0xAD) to one lens, or all for 0xFF: strobe gating
+// on/off, phase offset in 1/256 cycle and duty scale in %. A running strobe
+// re-gates every lens for the new offsets at once. Returns 1 if a lens
+// changed; the envelope then needs reprogramming for the new scale.
+static uint8_t lens_layout(uint8_t lens, uint8_t strobe, uint8_t phase, uint8_t scale)
+{
+    uint8_t changed = 0;
+    portENTER_CRITICAL(&strobe_mux);
+    for (int i = 0; i < LENS_COUNT; i++) {
+        if (lens != 0xFF && lens != i) {
+            continue;
+        }
+        lens_cfg[i].strobe = strobe;
+        lens_cfg[i].phase_offset = (uint32_t)phase << 24;
+        lens_cfg[i].scale = scale > 100 ? 100 : scale;
+        if (!strobe) {
+            lens_gate(i, 1);
+        }
+        changed = 1;
+    }
+    if (changed && strobe_running) {
+        // Rewind the phase from the pending edge to now and take an edge here
+        int64_t now = esp_timer_get_time();
+        int64_t ahead = strobe_next_edge_us - now;
+        if (ahead > 0) {
+            strobe_phase -= strobe_inc_at(now) * (uint32_t)ahead;
+        }
+        esp_timer_stop(strobe_timer);
+        strobe_next_edge_us = now;
+        strobe_edge();
+    }
+    portEXIT_CRITICAL(&strobe_mux);
+    return changed;
+}
+
+// Lens report: [0] kind  [1] lens count  then per lens
+//   [mode] [phase 1/256 cycle] [scale %]
+static void report_lens(void)
+{
+    uint8_t buf[2 + 3 * LENS_COUNT];
+    buf[0] = REPORT_LENS;
+    buf[1] = LENS_COUNT;
+    portENTER_CRITICAL(&strobe_mux);
+    for (int i = 0; i < LENS_COUNT; i++) {
+        buf[2 + 3 * i] = lens_cfg[i].strobe;
+        buf[3 + 3 * i] = (uint8_t)(lens_cfg[i].phase_offset >> 24);
+        buf[4 + 3 * i] = lens_cfg[i].scale;
+    }
+    portEXIT_CRITICAL(&strobe_mux);
+    report_set(buf, sizeof(buf));
+}
+
+//*********************************************************** */
+// Parameter Storage
+//*********************************************************** */
+// Session parameters persist in NVS so a wake resumes the last
+// configuration. Changes are not written straight away: each published
+// snapshot re-arms a one-shot timer, and the write happens once the
+// parameters have been quiet for PARAMS_SAVE_DELAY_MS. A stream of 0xA2
+// brightness updates costs one flash write, and neither the GATTS callback
+// nor led_task ever waits on flash. Pending changes are flushed before
+// deep sleep.
+#define NVS_NAMESPACE         "edge"
+#define PARAMS_NVS_KEY        "params"
+#define PARAMS_NVS_VERSION    1
+#define PARAMS_SAVE_DELAY_MS  2000
+
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    session_params_t params;
+} params_blob_t;
+
+static esp_timer_handle_t params_save_timer = NULL;
+static portMUX_TYPE params_save_mux = portMUX_INITIALIZER_UNLOCKED;
+static session_params_t params_to_save;         // Latest snapshot to write
+static session_params_t params_saved;           // What NVS holds
+static volatile uint8_t params_save_pending = 0;
+
+static void params_write(void)
+{
+    params_blob_t blob = { .version = PARAMS_NVS_VERSION };
+    portENTER_CRITICAL(&params_save_mux);
+    blob.params = params_to_save;
+    params_save_pending = 0;
+    portEXIT_CRITICAL(&params_save_mux);
+
+    if (memcmp(&blob.params, &params_saved, sizeof(params_saved)) == 0) {
+        return;
+    }
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, PARAMS_NVS_KEY, &blob, sizeof(blob));
+        if (err == ESP_OK) err = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    if (err == ESP_OK) {
+        params_saved = blob.params;
+    } else {
+        ESP_LOGW(TAG, "Params save failed: %s", esp_err_to_name(err));
+    }
+}
+
+static void params_save_timer_cb(void *arg)
+{
+    params_write();
+}
+
+// Queue a snapshot for writing, restarting the quiet period (led_task)
+static void params_save_later(const session_params_t *p)
+{
+    portENTER_CRITICAL(&params_save_mux);
+    params_to_save = *p;
+    params_save_pending = 1;
+    portEXIT_CRITICAL(&params_save_mux);
+    esp_timer_stop(params_save_timer);
+    esp_timer_start_once(params_save_timer, PARAMS_SAVE_DELAY_MS * 1000);
+}
+
+// Write a pending change now (before deep sleep)
+static void params_flush(void)
+{
+    if (params_save_timer) {
+        esp_timer_stop(params_save_timer);
+    }
+    if (params_save_pending) {
+        params_write();
+    }
+}
+
+// Load the stored parameters into the active snapshot and create the save
+// timer. Called once at boot after NVS init, before led_task exists.
+static void params_load(void)
+{
+    const esp_timer_create_args_t args = {
+        .callback = params_save_timer_cb,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "params_save",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &params_save_timer));
+
+    params_saved = params_buf[params_active];
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    params_blob_t blob;
+    size_t len = sizeof(blob);
+    if (nvs_get_blob(nvs, PARAMS_NVS_KEY, &blob, &len) == ESP_OK &&
+        len == sizeof(blob) && blob.version == PARAMS_NVS_VERSION) {
+        session_params_t *p = &blob.params;
+        if (p->brightness > 100) p->brightness = 100;
+        if (p->start_hz < 1 || p->start_hz > 50) p->start_hz = 12;
+        if (p->end_hz < 1 || p->end_hz > 50) p->end_hz = 8;
+        if (p->session_minutes < 1 || p->session_minutes > 60) p->session_minutes = 10;
+        params_buf[params_active] = *p;
+        params_saved = *p;
+        ESP_LOGI(TAG, "Params loaded from NVS");
+    }
+    nvs_close(nvs);
+}
+
+//*********************************************************** */
+// Session Programs
+//*********************************************************** */
+// A program is a list of segments, each with its own duration, strobe sweep,
+// breathing timings, brightness and easing. It is uploaded over BLE in
+// chunks (0xAB), checked against its CRC, stored in NVS and mirrored in RTC
+// memory, so a deep sleep wake does not need the flash read. Without an
+// uploaded program the 0xA1-0xA4 parameters run as a one-segment program.
+//
+// The wire format, and how a program is compiled and run, are in
+// session_engine.h; this section keeps upload, validation and storage.
+#define PROG_RTC_MAGIC      0x50524731   // "PRG1"
+#define PROG_NVS_KEY        "prog"
+
+// Upload status (program report, TRACE_PROG)
+typedef enum {
+    PROG_OK = 0,
+    PROG_ERR_LENGTH,             // Bad size, or a chunk outside it
+    PROG_ERR_HEADER,
+    PROG_ERR_CRC,
+    PROG_ERR_SEGMENT,            // Segment field out of range
+    PROG_ERR_STORE,              // NVS write failed (the program still runs)
+    PROG_ERR_NONE_STORED,
+} prog_result_t;
+
+// Uploaded program: NVS copy mirrored in RTC memory
+static RTC_NOINIT_ATTR uint32_t prog_rtc_magic;
+static RTC_NOINIT_ATTR prog_t prog_stored;
+static uint8_t prog_stored_valid = 0;
+static uint8_t prog_use_stored = 0;       // Run prog_stored, not the parameters
+
+// Session engine running the program - owned by led_task
+static session_engine_t session;
+static uint32_t session_tick_now;         // Tick the engine is being stepped at
+
+// Upload staging - owned by led_task
+static uint8_t prog_rx[PROG_MAX_LEN];
+static uint16_t prog_rx_len = 0;          // Size announced by 0xAB 0x01
+static uint8_t prog_result = PROG_OK;     // prog_result_t of the last upload step
+
+static inline uint16_t prog_len(const prog_t *p)
+{
+    return PROG_HDR_LEN + p->count * PROG_SEG_LEN;
+}
+
+static uint32_t prog_crc(const prog_t *p)
+{
+    return esp_crc32_le(0, (const uint8_t *)p->seg, p->count * PROG_SEG_LEN);
+}
+
+static prog_result_t prog_validate(const uint8_t *buf, uint16_t len)
+{
+    const prog_t *p = (const prog_t *)buf;
+    if (len < PROG_HDR_LEN) {
+        return PROG_ERR_LENGTH;
+    }
+    if (p->version != PROG_VERSION || p->seg_len != PROG_SEG_LEN ||
+        p->count < 1 || p->count > PROG_MAX_SEGS) {
+        return PROG_ERR_HEADER;
+    }
+    if (len != prog_len(p)) {
+        return PROG_ERR_LENGTH;
+    }
+    if (prog_crc(p) != p->crc) {
+        return PROG_ERR_CRC;
+    }
+    for (uint8_t i = 0; i < p->count; i++) {
+        const prog_seg_t *s = &p->seg[i];
+        if (s->duration_s < 1 || s->duration_s > PROG_MAX_SEG_S ||
+            s->start_hz_q8 < (1 << 8) || s->start_hz_q8 > (50 << 8) ||
+            s->end_hz_q8 < (1 << 8) || s->end_hz_q8 > (50 << 8) ||
+            s->brightness > 100 || s->easing > PROG_EASE_IN_OUT) {
+            return PROG_ERR_SEGMENT;
+        }
+    }
+    return PROG_OK;
+}
+
+// The 0xA1-0xA4 parameters as a program: one linear segment, holds from 0
+static void prog_from_params(const session_params_t *p, prog_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->version = PROG_VERSION;
+    out->count = 1;
+    out->seg_len = PROG_SEG_LEN;
+    prog_seg_t *s = &out->seg[0];
+    s->duration_s = p->session_minutes * 60;
+    s->start_hz_q8 = p->start_hz << 8;
+    s->end_hz_q8 = p->end_hz << 8;
+    s->inhale = p->inhale_time;
+    s->exhale = p->exhale_time;
+    s->hold_in_end = p->hold_in_end;
+    s->hold_out_end = p->hold_out_end;
+    s->brightness = 100;
+    s->easing = PROG_EASE_LINEAR;
+    out->crc = prog_crc(out);
+}
+
+// Keep an uploaded program: RTC copy for wakes, NVS copy for power cycles
+static esp_err_t prog_store(const prog_t *p)
+{
+    prog_stored = *p;
+    prog_rtc_magic = PROG_RTC_MAGIC;
+    prog_stored_valid = 1;
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, PROG_NVS_KEY, p, prog_len(p));
+        if (err == ESP_OK) err = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    return err;
+}
+
+static void prog_erase(void)
+{
+    prog_stored_valid = 0;
+    prog_rtc_magic = 0;
+
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+        nvs_erase_key(nvs, PROG_NVS_KEY);
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+}
+
+// Find the stored program at boot (NVS must be initialised): the RTC copy
+// after a deep sleep wake, otherwise NVS
+static void prog_load(void)
+{
+    if (prog_rtc_magic == PROG_RTC_MAGIC &&
+        prog_validate((const uint8_t *)&prog_stored, prog_len(&prog_stored)) == PROG_OK) {
+        prog_stored_valid = 1;
+    } else {
+        prog_rtc_magic = 0;
+        nvs_handle_t nvs;
+        size_t len = sizeof(prog_stored);
+        if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+            if (nvs_get_blob(nvs, PROG_NVS_KEY, &prog_stored, &len) == ESP_OK &&
+                prog_validate((const uint8_t *)&prog_stored, len) == PROG_OK) {
+                prog_stored_valid = 1;
+                prog_rtc_magic = PROG_RTC_MAGIC;
+            }
+            nvs_close(nvs);
+        }
+    }
+    prog_use_stored = prog_stored_valid;
+}
+
+// Program report: [0] kind  [1] upload status (prog_result_t)
+//   [2] 1 = running the uploaded program  [3] segment count
+//   [4..7] program CRC  [8..11] total length (s)
+static void report_program(void)
+{
+    uint8_t buf[12];
+    uint32_t total_s = session.total_ms / 1000;
+    buf[0] = REPORT_PROGRAM;
+    buf[1] = prog_result;
+    buf[2] = prog_use_stored && prog_stored_valid;
+    buf[3] = session.prog.count;
+    memcpy(&buf[4], &session.prog.crc, 4);
+    memcpy(&buf[8], &total_s, 4);
+    report_set(buf, sizeof(buf));
+}
+
+//*********************************************************** */
+// Lens Calibration
+//*********************************************************** */
+// A per-device response table (lens_lut) measured with raw holds and
+// uploaded in pieces over BLE (0xAE), stored in NVS and mirrored in RTC
+// memory like the session program. Without one the built-in table is used.
+#define LUT_RTC_MAGIC       0x4C555431   // "LUT1"
+#define LUT_NVS_KEY         "lut"
+
+typedef enum {
+    LUT_OK = 0,
+    LUT_ERR_RANGE,           // Chunk outside the table
+    LUT_ERR_SHAPE,           // Entry 0 not 0, decreasing, or above PWM_MAX
+    LUT_ERR_STORE,           // Flash write failed (table still in use until sleep)
+} lut_result_t;
+
+static RTC_NOINIT_ATTR uint32_t lut_rtc_magic;
+static RTC_NOINIT_ATTR uint16_t lut_stored[LENS_LUT_SIZE];
+
+// Upload staging, starts as a copy of the table in use - owned by led_task
+static uint16_t lut_rx[LENS_LUT_SIZE];
+static uint8_t lut_rx_bad = 0;              // A chunk failed since the last commit
+static uint8_t lut_result = LUT_OK;         // lut_result_t of the last upload step
+
+static lut_result_t lut_validate(const uint16_t *lut)
+{
+    if (lut[0] != 0) {
+        return LUT_ERR_SHAPE;
+    }
+    for (int i = 1; i < LENS_LUT_SIZE; i++) {
+        if (lut[i] < lut[i - 1] || lut[i] > PWM_MAX) {
+            return LUT_ERR_SHAPE;
+        }
+    }
+    return LUT_OK;
+}
+
+static void lut_use(const uint16_t *lut)
+{
+    memcpy(lens_lut, lut, sizeof(lens_lut));
+    memcpy(lut_rx, lut, sizeof(lut_rx));
+}
+
+static esp_err_t lut_store(const uint16_t *lut)
+{
+    memcpy(lut_stored, lut, sizeof(lut_stored));
+    lut_rtc_magic = LUT_RTC_MAGIC;
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, LUT_NVS_KEY, lut, sizeof(lut_stored));
+        if (err == ESP_OK) err = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    return err;
+}
+
+static void lut_erase(void)
+{
+    lut_rtc_magic = 0;
+
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+        nvs_erase_key(nvs, LUT_NVS_KEY);
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+}
+
+// Pick the stored table (RTC copy first, then NVS) or the built-in one.
+// Called once at boot after NVS init, before the engine starts.
+static void lut_load(void)
+{
+    if (lut_rtc_magic == LUT_RTC_MAGIC && lut_validate(lut_stored) == LUT_OK) {
+        lut_use(lut_stored);
+        return;
+    }
+    lut_rtc_magic = 0;
+    lut_use(lens_lut_default);
+
+    nvs_handle_t nvs;
+    size_t len = sizeof(lut_stored);
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_get_blob(nvs, LUT_NVS_KEY, lut_stored, &len) == ESP_OK &&
+        len == sizeof(lut_stored) && lut_validate(lut_stored) == LUT_OK) {
+        lut_use(lut_stored);
+        lut_rtc_magic = LUT_RTC_MAGIC;
+        ESP_LOGI(TAG, "Lens table loaded from NVS");
+    }
+    nvs_close(nvs);
+}
+
+// Calibration report: [0] kind  [1] 1 = stored table in use  [2] lut_result_t
+//   [3..] table in use, LENS_LUT_SIZE x raw u16 LE
+static void report_calib(void)
+{
+    uint8_t buf[3 + sizeof(lens_lut)];
+    buf[0] = REPORT_CALIB;
+    buf[1] = lut_rtc_magic == LUT_RTC_MAGIC;
+    buf[2] = lut_result;
+    memcpy(&buf[3], lens_lut, sizeof(lens_lut));
+    report_set(buf, sizeof(buf));
+}
+
+//*********************************************************** */
+// Command Queue
+//*********************************************************** */
+// BLE writes are parsed into fixed-size records and passed to led_task
+// through a single-producer (BLE host task) / single-consumer (led_task)
+// lock-free ring. led_task applies everything pending in one step at the top
+// of its loop, so the GATTS callback never touches engine state or the PWM.
+#define CMD_LEGACY          0x00   // Single-byte write: arg[0] = raw 0-255
+#define CMD_MAX_ARGS        20     // Fits a program upload chunk
+#define CMD_RING_SIZE       16     // Power of two
+
+typedef struct {
+    uint8_t op;                    // Opcode (0xA1..) or CMD_LEGACY
+    uint8_t len;                   // Valid bytes in arg
+    uint8_t arg[CMD_MAX_ARGS];
+} engine_cmd_t;
+
+static engine_cmd_t cmd_ring[CMD_RING_SIZE];
+static uint32_t cmd_head = 0;      // Written by producer only
+static uint32_t cmd_tail = 0;      // Written by consumer only
+static uint32_t cmd_dropped = 0;
+
+// Push n records as one unit: all or nothing, and published by a single
+// head update so led_task can never drain half of a batch
+static bool cmd_push(const engine_cmd_t *cmds, uint32_t n)
+{
+    uint32_t head = cmd_head;
+    if (head + n - __atomic_load_n(&cmd_tail, __ATOMIC_ACQUIRE) > CMD_RING_SIZE) {
+        cmd_dropped += n;
+        return false;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        cmd_ring[(head + i) % CMD_RING_SIZE] = cmds[i];
+    }
+    __atomic_store_n(&cmd_head, head + n, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool cmd_pop(engine_cmd_t *cmd)
+{
+    uint32_t tail = cmd_tail;
+    if (__atomic_load_n(&cmd_head, __ATOMIC_ACQUIRE) == tail) {
+        return false;
+    }
+    *cmd = cmd_ring[tail % CMD_RING_SIZE];
+    __atomic_store_n(&cmd_tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+#define CMD_BATCH           0xA9
+#define CMD_BATCH_MAX       8      // Records per batch frame
+#define CMD_PING            0xB0   // Answered by the BLE host task, never queued
+
+// Parse a raw characteristic write into command records. A batch frame
+// [0xA9] {[op] [len] [args...]}... yields one record per entry. Returns the
+// record count, 0 if the write is malformed (nothing is applied then).
+static uint32_t cmd_parse(const uint8_t *data, uint16_t len, engine_cmd_t *cmds, uint32_t max)
+{
+    if (len == 1) {
+        // LEGACY: Single byte write = direct duty (0-255 mapped to 0-100%)
+        // Full 0x00-0xFF range reserved for legacy app compatibility
+        memset(&cmds[0], 0, sizeof(cmds[0]));
+        cmds[0].op = CMD_LEGACY;
+        cmds[0].len = 1;
+        cmds[0].arg[0] = data[0];
+        return 1;
+    }
+    // NEW COMMANDS: Multi-byte, first byte 0xA0+ to avoid legacy collision
+    if (len < 1 || data[0] == CMD_LEGACY) {
+        return 0;
+    }
+    if (data[0] != CMD_BATCH) {
+        // Too long to hold without cutting arguments off: reject, as in a batch
+        if (len - 1 > CMD_MAX_ARGS) return 0;
+        memset(&cmds[0], 0, sizeof(cmds[0]));
+        cmds[0].op = data[0];
+        cmds[0].len = (uint8_t)(len - 1);
+        memcpy(cmds[0].arg, &data[1], cmds[0].len);
+        return 1;
+    }
+
+    uint32_t n = 0;
+    uint16_t pos = 1;
+    while (pos < len) {
+        if (n >= max || pos + 2 > len) return 0;
+        uint8_t op = data[pos];
+        uint8_t arg_len = data[pos + 1];
+        pos += 2;
+        if (op == CMD_LEGACY || op == CMD_BATCH || op == CMD_PING ||
+            arg_len > CMD_MAX_ARGS || pos + arg_len > len) {
+            return 0;
+        }
+        memset(&cmds[n], 0, sizeof(cmds[n]));
+        cmds[n].op = op;
+        cmds[n].len = arg_len;
+        memcpy(cmds[n].arg, &data[pos], arg_len);
+        pos += arg_len;
+        n++;
+    }
+    return n;
+}
+
+//*********************************************************** */
+// Telemetry
+//*********************************************************** */
+// While a client has notifications enabled on FF02, a periodic esp_timer
+// (task dispatch) builds a packed status packet and notifies it. led_task
+// only publishes its own state into a seqlock'd snapshot at each loop pass;
+// progress is worked out from it and frequency from the strobe ramp at send
+// time. Sending happens in the esp_timer task, so a slow or congested link
+// never holds up the engine, and packets are skipped while the stack reports
+// congestion.
+#define TELEM_TYPE_STATUS     0x01
+#define TELEM_TYPE_PONG       0x02       // Clock sync, see Clock Sync
+#define TELEM_TYPE_MARKERS    0x03       // See Event Markers
+#define TELEM_PERIOD_DEFAULT  10         // x10 ms
+
+#define TELEM_FLAG_SESSION    (1 << 0)   // Timed session running
+#define TELEM_FLAG_OVERRIDE   (1 << 1)   // Static override holding
+#define TELEM_FLAG_RUNNING    (1 << 2)   // Envelope and strobe active
+#define TELEM_FLAG_SCHEDULED  (1 << 3)   // Waiting for a 0xB1 start
+#define TELEM_ADV_SHIFT       4          // Bits 4-5: adv_policy_t (0xB3)
+#define TELEM_FLAG_PACING     (1 << 6)   // Biofeedback pacing on (0xB5)
+
+// led_task state, written by led_task only
+typedef struct {
+    uint8_t flags;
+    uint8_t breath_phase;
+    uint8_t brightness;
+    int64_t session_start_us;
+    uint32_t session_len_ms;
+} engine_status_t;
+
+// Status packet, little-endian, 15 bytes
+typedef struct __attribute__((packed)) {
+    uint8_t type;              // TELEM_TYPE_STATUS
+    uint8_t flags;             // TELEM_FLAG_*
+    uint16_t progress_q8;      // Session progress, 256 = complete
+    uint16_t hz_q8;            // Current strobe frequency (Hz x256)
+    uint8_t breath_phase;      // 0=inhale, 1=hold_in, 2=exhale, 3=hold_out
+    uint8_t duty;              // Envelope duty now, 0-100%
+    uint16_t remaining_s;      // Session time left
+    uint8_t brightness;        // 0-100%
+    uint32_t t_us;             // Device time (us, low 32 bits)
+} telem_status_t;
+
+static engine_status_t status_buf;
+static uint32_t status_seq = 0;     // Odd while led_task is writing status_buf
+
+static esp_timer_handle_t telem_timer = NULL;
+static esp_timer_handle_t marker_timer = NULL;
+static portMUX_TYPE telem_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t telem_period = TELEM_PERIOD_DEFAULT;   // x10 ms, 0 = off
+static uint8_t telem_subscribed = 0;                  // CCCD notification bit
+static volatile uint8_t telem_congested = 0;
+static uint32_t telem_skipped = 0;
+
+// Publish led_task state for the telemetry timer (called from led_task)
+static void status_publish(uint8_t flags, uint8_t breath_phase, uint8_t brightness)
+{
+    uint32_t seq = status_seq;
+    __atomic_store_n(&status_seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    status_buf.flags = flags;
+    status_buf.breath_phase = breath_phase;
+    status_buf.brightness = brightness;
+    status_buf.session_start_us = session_start_us;
+    status_buf.session_len_ms = session.total_ms;
+    __atomic_store_n(&status_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void status_read(engine_status_t *out)
+{
+    uint32_t seq;
+    do {
+        seq = __atomic_load_n(&status_seq, __ATOMIC_ACQUIRE);
+        *out = status_buf;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&status_seq, __ATOMIC_RELAXED));
+}
+
+static void telem_build(telem_status_t *t)
+{
+    engine_status_t s;
+    status_read(&s);
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&strobe_mux);
+    uint32_t inc = strobe_running ? strobe_inc_at(now) : 0;
+    portEXIT_CRITICAL(&strobe_mux);
+
+    int64_t elapsed = (now - s.session_start_us) / 1000;
+    uint32_t len = s.session_len_ms;
+    if (!(s.flags & TELEM_FLAG_SESSION) || len == 0) {
+        elapsed = 0;
+        len = 0;
+    } else if (elapsed < 0) {
+        elapsed = 0;
+    } else if (elapsed > len) {
+        elapsed = len;
+    }
+
+    t->type = TELEM_TYPE_STATUS;
+    t->flags = s.flags;
+    t->progress_q8 = len ? (uint16_t)((elapsed << 8) / len) : 0;
+    t->hz_q8 = (uint16_t)(((uint64_t)inc * 1000000 + (1u << 23)) >> 24);
+    t->breath_phase = s.breath_phase;
+    t->duty = (uint8_t)lens_raw_to_duty(ledc_get_duty(PWM_MODE, lens_hw[0].channel));
+    t->remaining_s = (uint16_t)((len - elapsed) / 1000);
+    t->brightness = s.brightness;
+    t->t_us = (uint32_t)now;
+}
+
+static void telem_timer_cb(void *arg)
+{
+    telem_status_t t;
+    telem_build(&t);
+    if (telem_congested || ble_transport_notify((const uint8_t *)&t, sizeof(t)) != ESP_OK) {
+        telem_skipped++;
+    }
+}
+
+// Drain the marker ring into as many packets as the MTU needs
+static void marker_timer_cb(void *arg)
+{
+    uint8_t pkt[BLE_LOCAL_MTU - 3];
+    uint16_t room = ble_transport_mtu() - 3;
+    if (room > sizeof(pkt)) room = sizeof(pkt);
+    uint32_t max_recs = (room - MARKER_HDR_LEN) / MARKER_REC_LEN;
+
+    pkt[0] = TELEM_TYPE_MARKERS;
+    for (int i = 0; i < MARKER_FLUSH_PKTS && !telem_congested; i++) {
+        uint32_t first;
+        uint16_t len = marker_pack(pkt, max_recs, &first);
+        if (len == 0 || ble_transport_notify(pkt, len) != ESP_OK) {
+            break;
+        }
+        marker_commit(first, pkt[1]);
+    }
+}
+
+static void telem_init(void)
+{
+    const esp_timer_create_args_t args = {
+        .callback = telem_timer_cb,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "telem",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &telem_timer));
+
+    const esp_timer_create_args_t marker_args = {
+        .callback = marker_timer_cb,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "markers",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&marker_args, &marker_timer));
+}
+
+// Start, stop or re-period the timers to match the subscription, rate and
+// marker selection. Called from the BLE host task (CCCD writes,
+// disconnect) and led_task (0xAA, 0xB2).
+static void telem_update(void)
+{
+    if (!telem_timer) {
+        return;
+    }
+    portENTER_CRITICAL(&telem_mux);
+    esp_timer_stop(telem_timer);
+    esp_timer_stop(marker_timer);
+    if (telem_subscribed && telem_period) {
+        esp_timer_start_periodic(telem_timer, (uint64_t)telem_period * 10000);
+    }
+    if (telem_subscribed && marker_mask) {
+        esp_timer_start_periodic(marker_timer, MARKER_FLUSH_MS * 1000);
+    }
+    portEXIT_CRITICAL(&telem_mux);
+}
+
+//*********************************************************** */
+// Connection Parameters
+//*********************************************************** */
+// The central chooses the connection parameters, so the firmware asks for
+// a profile that fits what the link is doing. Real-time control (legacy
+// duty writes, 0xA5 streams from biofeedback loops) wants a 7.5-15 ms
+// interval; a plain timed session only sees the odd command and telemetry,
+// so it asks for long intervals with slave latency. 0xAC pins a profile or
+// leaves it to the automatic policy, which led_task re-runs on connect and
+// on every engine mode change. The central may refuse or adjust a request;
+// the parameters actually in use are kept for the 0xA8 report.
+typedef enum {
+    CONN_PROFILE_AUTO = 0,          // Low latency unless a timed session runs
+    CONN_PROFILE_LOW_LATENCY = 1,
+    CONN_PROFILE_LOW_POWER = 2,
+    CONN_PROFILE_COUNT,
+} conn_profile_t;
+
+static const ble_conn_params_t conn_profiles[CONN_PROFILE_COUNT] = {
+    // 7.5-15 ms, no latency, 4 s timeout
+    [CONN_PROFILE_LOW_LATENCY] = { .min_interval = 6,  .max_interval = 12,  .latency = 0, .timeout = 400 },
+    // 100-200 ms, skip up to 4 events (~1 s worst case), 5 s timeout
+    [CONN_PROFILE_LOW_POWER]   = { .min_interval = 80, .max_interval = 160, .latency = 4, .timeout = 500 },
+};
+
+static portMUX_TYPE conn_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t conn_profile = CONN_PROFILE_AUTO;     // Set by 0xAC
+static uint8_t conn_requested = CONN_PROFILE_AUTO;   // Last profile asked for, AUTO = none
+static volatile uint8_t conn_up = 0;
+static volatile uint8_t conn_fresh = 0;              // New link, policy not run yet
+static uint16_t conn_interval = 0;                   // In use: 1.25 ms units
+static uint16_t conn_latency = 0;
+static uint16_t conn_timeout = 0;                    // 10 ms units
+
+// Request the profile the policy wants, if it changed (called from led_task)
+static void conn_policy(void)
+{
+    if (conn_fresh) {
+        conn_fresh = 0;
+        conn_requested = CONN_PROFILE_AUTO;
+    }
+    if (!conn_up) {
+        conn_requested = CONN_PROFILE_AUTO;
+        return;
+    }
+    uint8_t want = conn_profile;
+    if (want == CONN_PROFILE_AUTO) {
+        want = session_active ? CONN_PROFILE_LOW_POWER : CONN_PROFILE_LOW_LATENCY;
+    }
+    if (want == conn_requested) {
+        return;
+    }
+    // On failure the request is retried on the next pass
+    if (ble_transport_set_conn_params(&conn_profiles[want]) == ESP_OK) {
+        conn_requested = want;
+        HOT_LOGI(TAG, "Conn profile: %d", want);
+    }
+}
+
+// Connection report: [0] kind  [1] profile set by 0xAC  [2] profile requested
+//   [3] connected  [4..5] interval (1.25 ms)  [6..7] latency  [8..9] timeout (10 ms)
+static void report_conn(void)
+{
+    uint8_t buf[10];
+    buf[0] = REPORT_CONN;
+    buf[1] = conn_profile;
+    buf[2] = conn_requested;
+    buf[3] = conn_up;
+    portENTER_CRITICAL(&conn_mux);
+    memcpy(&buf[4], &conn_interval, 2);
+    memcpy(&buf[6], &conn_latency, 2);
+    memcpy(&buf[8], &conn_timeout, 2);
+    portEXIT_CRITICAL(&conn_mux);
+    report_set(buf, sizeof(buf));
+}
+
+//*********************************************************** */
+// Energy Accounting
+//*********************************************************** */
+// Time in each power state, kept in RTC memory so it adds up across deep
+// sleep and wake cycles until power is lost or 0xB4 clears it. Two groups
+// run side by side while awake: the radio (advertising fast/slow/off or
+// connected, stepped by the advertising policy) and the engine (session,
+// override or idle, stepped by led_task). Deep sleep is measured on the
+// RTC clock, from the stamp taken going into it to esp_timer start on the
+// next boot, so bootloader time counts as sleep. A wake that finds the
+// arms still closed and goes straight back is counted on its own.
+//
+// Charge is estimated at report time from a current per state. The
+// built-in figures are rough ones for this board (radio states are what
+// the radio adds on top of the engine states, which include the chip);
+// measure a unit and set real ones with 0xB4, they are kept in NVS.
+#define ENERGY_MAGIC          0x454E5231   // "ENR1"
+#define ENERGY_NVS_KEY        "energy"
+#define ENERGY_NVS_VERSION    1
+
+typedef enum {
+    // Radio group, in ble_adv_mode_t order then connected (as ADV_STATE_*)
+    ENERGY_ADV_FAST = 0,
+    ENERGY_ADV_SLOW,
+    ENERGY_ADV_OFF,
+    ENERGY_CONNECTED,
+    // Engine group
+    ENERGY_SESSION,             // Timed session or strobe benchmark
+    ENERGY_OVERRIDE,            // 0xA5 / legacy / raw hold
+    ENERGY_IDLE,                // Clear, waiting for a command or scheduled start
+    // Asleep
+    ENERGY_RESLEEP,             // Awake only to find the arms still closed
+    ENERGY_DEEP_SLEEP,
+    ENERGY_STATE_COUNT,
+} energy_state_t;
+
+typedef enum {
+    ENERGY_GROUP_RADIO = 0,
+    ENERGY_GROUP_ENGINE,
+    ENERGY_GROUP_COUNT,
+} energy_group_t;
+
+// Built-in currents, uA
+static const uint32_t energy_ua_default[ENERGY_STATE_COUNT] = {
+    [ENERGY_ADV_FAST]   = 1500,
+    [ENERGY_ADV_SLOW]   = 100,
+    [ENERGY_ADV_OFF]    = 0,
+    [ENERGY_CONNECTED]  = 800,
+    [ENERGY_SESSION]    = 14000,
+    [ENERGY_OVERRIDE]   = 12000,
+    [ENERGY_IDLE]       = 9000,
+    [ENERGY_RESLEEP]    = 30000,
+#if CONFIG_ULP_COPROC_ENABLED
+    [ENERGY_DEEP_SLEEP] = 150,
+#else
+    [ENERGY_DEEP_SLEEP] = 10,
+#endif
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t wakes;             // Full boots
+    uint32_t resleeps;
+    uint64_t sleep_rtc_us;      // RTC time at deep sleep entry, 0 = awake
+    uint64_t us[ENERGY_STATE_COUNT];
+} energy_rtc_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint32_t ua[ENERGY_STATE_COUNT];
+} energy_blob_t;
+
+static RTC_NOINIT_ATTR energy_rtc_t energy;
+static portMUX_TYPE energy_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t energy_ua[ENERGY_STATE_COUNT];        // Set by 0xB4
+static uint8_t energy_cur[ENERGY_GROUP_COUNT] = { ENERGY_ADV_OFF, ENERGY_IDLE };
+static int64_t energy_since[ENERGY_GROUP_COUNT];     // esp_timer time, 0 = boot
+
+// Close the deep sleep that ended in this boot (call first in app_main)
+static void energy_init(void)
+{
+    if (energy.magic != ENERGY_MAGIC) {
+        // Cold boot: RTC memory holds garbage
+        memset(&energy, 0, sizeof(energy));
+        energy.magic = ENERGY_MAGIC;
+    } else if (energy.sleep_rtc_us) {
+        int64_t slept = (int64_t)(esp_clk_rtc_time() - energy.sleep_rtc_us) - esp_timer_get_time();
+        if (slept > 0) energy.us[ENERGY_DEEP_SLEEP] += slept;
+    }
+    energy.sleep_rtc_us = 0;
+    memcpy(energy_ua, energy_ua_default, sizeof(energy_ua));
+}
+
+// Going back to sleep from the closed-arms check at boot
+static void energy_resleep(void)
+{
+    energy.us[ENERGY_RESLEEP] += esp_timer_get_time();
+    energy.resleeps++;
+    energy.sleep_rtc_us = esp_clk_rtc_time();
+}
+
+// Count a full boot and load the stored currents (NVS must be initialised)
+static void energy_load(void)
+{
+    energy.wakes++;
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    energy_blob_t blob;
+    size_t len = sizeof(blob);
+    if (nvs_get_blob(nvs, ENERGY_NVS_KEY, &blob, &len) == ESP_OK && len == sizeof(blob) &&
+        blob.version == ENERGY_NVS_VERSION) {
+        memcpy(energy_ua, blob.ua, sizeof(energy_ua));
+    }
+    nvs_close(nvs);
+}
+
+// Add the time since the last call to the group's state, then switch it
+static void energy_enter(energy_group_t group, uint8_t state, int64_t now)
+{
+    portENTER_CRITICAL(&energy_mux);
+    if (!energy.sleep_rtc_us) {     // Not once going to sleep
+        energy.us[energy_cur[group]] += now - energy_since[group];
+        energy_since[group] = now;
+        energy_cur[group] = state;
+    }
+    portEXIT_CRITICAL(&energy_mux);
+}
+
+// Close both groups for deep sleep (from the app_main task, led_task still runs)
+static void energy_sleep(void)
+{
+    int64_t now = esp_timer_get_time();
+    uint64_t rtc = esp_clk_rtc_time();
+    portENTER_CRITICAL(&energy_mux);
+    for (int g = 0; g < ENERGY_GROUP_COUNT; g++) {
+        energy.us[energy_cur[g]] += now - energy_since[g];
+        energy_since[g] = now;
+    }
+    energy.sleep_rtc_us = rtc;
+    portEXIT_CRITICAL(&energy_mux);
+}
+
+static void energy_clear(void)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&energy_mux);
+    energy.wakes = 0;
+    energy.resleeps = 0;
+    memset(energy.us, 0, sizeof(energy.us));
+    for (int g = 0; g < ENERGY_GROUP_COUNT; g++) {
+        energy_since[g] = now;
+    }
+    portEXIT_CRITICAL(&energy_mux);
+}
+
+// Set currents from state first (0xB4 0x01), storing them
+static esp_err_t energy_store(uint8_t first, const uint32_t *ua, uint32_t n)
+{
+    memcpy(&energy_ua[first], ua, n * sizeof(uint32_t));
+    energy_blob_t blob = { .version = ENERGY_NVS_VERSION };
+    memcpy(blob.ua, energy_ua, sizeof(blob.ua));
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, ENERGY_NVS_KEY, &blob, sizeof(blob));
+        if (err == ESP_OK) err = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    return err;
+}
+
+static void energy_erase(void)
+{
+    memcpy(energy_ua, energy_ua_default, sizeof(energy_ua));
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+        nvs_erase_key(nvs, ENERGY_NVS_KEY);
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+}
+
+// Energy report: [0] kind  [1] state count  [2] bytes per state  [3] reserved
+//   [4..7] wakes  [8..11] resleeps  [12..15] total charge (uAh)
+//   then per energy_state_t: [time ms u64] [current uA u32] [charge uAh u32]
+#define ENERGY_REPORT_HDR     16
+#define ENERGY_REPORT_STATE   16
+
+static void report_energy(void)
+{
+    uint8_t buf[ENERGY_REPORT_HDR + ENERGY_STATE_COUNT * ENERGY_REPORT_STATE];
+    uint64_t us[ENERGY_STATE_COUNT];
+    int64_t now = esp_timer_get_time();
+    // Bring the open states up to now
+    energy_enter(ENERGY_GROUP_RADIO, energy_cur[ENERGY_GROUP_RADIO], now);
+    energy_enter(ENERGY_GROUP_ENGINE, energy_cur[ENERGY_GROUP_ENGINE], now);
+    portENTER_CRITICAL(&energy_mux);
+    memcpy(us, energy.us, sizeof(us));
+    uint32_t wakes = energy.wakes;
+    uint32_t resleeps = energy.resleeps;
+    portEXIT_CRITICAL(&energy_mux);
+
+    uint32_t total = 0;
+    uint8_t *p = &buf[ENERGY_REPORT_HDR];
+    for (int i = 0; i < ENERGY_STATE_COUNT; i++) {
+        uint64_t ms = us[i] / 1000;
+        uint32_t uah = (uint32_t)(ms * energy_ua[i] / 3600000);
+        memcpy(p, &ms, 8);
+        memcpy(p + 8, &energy_ua[i], 4);
+        memcpy(p + 12, &uah, 4);
+        p += ENERGY_REPORT_STATE;
+        total += uah;
+    }
+    buf[0] = REPORT_ENERGY;
+    buf[1] = ENERGY_STATE_COUNT;
+    buf[2] = ENERGY_REPORT_STATE;
+    buf[3] = 0;
+    memcpy(&buf[4], &wakes, 4);
+    memcpy(&buf[8], &resleeps, 4);
+    memcpy(&buf[12], &total, 4);
+    report_set(buf, sizeof(buf));
+}
+
+//*********************************************************** */
+// Advertising Policy
+//*********************************************************** */
+// 20-40 ms advertising is most of the idle current while nobody is
+// connected, and a long interval only costs discovery time. The transport
+// advertises fast after boot and after every disconnect; led_task keeps it
+// that way for a window (default ADV_WINDOW_DEFAULT_S), then steps down to
+// 500 ms-1 s. ADV_POLICY_QUIET also stops advertising while a session runs
+// untethered, so the device cannot be found again until the session ends
+// or the arms are closed. 0xB3 sets the policy and window, kept in NVS;
+// the policy rides in the telemetry flags, and 0xA8 0x0A reports the state
+// and the time spent in each one this wake.
+#define ADV_NVS_KEY           "adv"
+#define ADV_NVS_VERSION       1
+#define ADV_WINDOW_DEFAULT_S  30
+
+typedef enum {
+    ADV_POLICY_FAST = 0,            // Always 20-40 ms, as before
+    ADV_POLICY_ADAPTIVE = 1,        // Fast window, then 500 ms-1 s
+    ADV_POLICY_QUIET = 2,           // Adaptive, and none during an untethered session
+    ADV_POLICY_COUNT,
+} adv_policy_t;
+
+// Report states: ble_adv_mode_t, plus connected
+#define ADV_STATE_CONNECTED   BLE_ADV_MODE_COUNT
+#define ADV_STATE_COUNT       (BLE_ADV_MODE_COUNT + 1)
+_Static_assert((int)ADV_STATE_CONNECTED == (int)ENERGY_CONNECTED, "advertising states must match energy states");
+
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t policy;
+    uint8_t window_s;
+} adv_blob_t;
+
+static const char *const adv_mode_names[BLE_ADV_MODE_COUNT] = { "fast", "slow", "off" };
+
+static uint8_t adv_policy = ADV_POLICY_ADAPTIVE;     // Set by 0xB3
+static uint8_t adv_window_s = ADV_WINDOW_DEFAULT_S;
+static volatile uint8_t adv_reset = 1;               // Transport back to fast (boot, disconnect)
+// led_task only from here
+static uint8_t adv_mode = BLE_ADV_FAST;              // What the transport was told
+static int64_t adv_window_us = 0;                    // Fast window start
+static uint8_t adv_state = BLE_ADV_FAST;
+static int64_t adv_state_us = 0;                     // adv_state entered
+static uint32_t adv_ms[ADV_STATE_COUNT];             // Time per state this wake
+
+static void adv_load(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    adv_blob_t blob;
+    size_t len = sizeof(blob);
+    if (nvs_get_blob(nvs, ADV_NVS_KEY, &blob, &len) == ESP_OK && len == sizeof(blob) &&
+        blob.version == ADV_NVS_VERSION && blob.policy < ADV_POLICY_COUNT) {
+        adv_policy = blob.policy;
+        adv_window_s = blob.window_s;
+    }
+    nvs_close(nvs);
+}
+
+// Change policy and window (0xB3), storing them if they changed
+static void adv_configure(uint8_t policy, uint8_t window_s)
+{
+    if (policy == adv_policy && window_s == adv_window_s) {
+        return;
+    }
+    adv_policy = policy;
+    adv_window_s = window_s;
+    adv_blob_t blob = { .version = ADV_NVS_VERSION, .policy = policy, .window_s = window_s };
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, ADV_NVS_KEY, &blob, sizeof(blob));
+        if (err == ESP_OK) err = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Adv policy save failed: %s", esp_err_to_name(err));
+    }
+}
+
+static inline uint8_t adv_telem_flags(void)
+{
+    return (uint8_t)(adv_policy << TELEM_ADV_SHIFT);
+}
+
+static bool adv_window_open(int64_t now)
+{
+    return now - adv_window_us < (int64_t)adv_window_s * 1000000;
+}
+
+// Close the time spent in the current state
+static void adv_account(uint8_t state, int64_t now)
+{
+    uint32_t ms = (uint32_t)((now - adv_state_us) / 1000);
+    adv_ms[adv_state] += ms;
+    adv_state_us += (int64_t)ms * 1000;     // Keep the remainder
+    adv_state = state;
+    energy_enter(ENERGY_GROUP_RADIO, state, now);
+}
+
+// Step advertising to what the policy wants now (called from led_task)
+static void adv_policy_run(void)
+{
+    int64_t now = esp_timer_get_time();
+    if (__atomic_exchange_n(&adv_reset, 0, __ATOMIC_ACQ_REL)) {
+        adv_mode = BLE_ADV_FAST;
+        adv_window_us = now;
+    }
+    if (!conn_up) {
+        uint8_t want = BLE_ADV_FAST;
+        if (adv_policy != ADV_POLICY_FAST && !adv_window_open(now)) {
+            want = (adv_policy == ADV_POLICY_QUIET && session_active) ? BLE_ADV_OFF : BLE_ADV_SLOW;
+        }
+        // On failure this is retried on the next pass
+        if (want != adv_mode && ble_transport_set_adv(want) == ESP_OK) {
+            adv_mode = want;
+            ESP_LOGI(TAG, "Advertising: %s", adv_mode_names[want]);
+        }
+    }
+    adv_account(conn_up ? ADV_STATE_CONNECTED : adv_mode, now);
+}
+
+// Ticks led_task may wait before the fast window closes
+static TickType_t adv_wait(void)
+{
+    if (adv_policy == ADV_POLICY_FAST || conn_up || adv_mode != BLE_ADV_FAST) {
+        return portMAX_DELAY;
+    }
+    // Closed already: the step down failed and waits for the next pass
+    int64_t left = adv_window_us + (int64_t)adv_window_s * 1000000 - esp_timer_get_time();
+    if (left <= 0) {
+        return portMAX_DELAY;
+    }
+    return (TickType_t)(left / (portTICK_PERIOD_MS * 1000)) + 1;
+}
+
+// Advertising report: [0] kind  [1] policy  [2] fast window (s)
+//   [3] state now (ble_adv_mode_t, 3 = connected)
+//   [4..19] ms in fast, slow, off and connected this wake (u32 each)
+static void report_adv(void)
+{
+    uint8_t buf[4 + ADV_STATE_COUNT * 4];
+    adv_account(adv_state, esp_timer_get_time());
+    buf[0] = REPORT_ADV;
+    buf[1] = adv_policy;
+    buf[2] = adv_window_s;
+    buf[3] = adv_state;
+    memcpy(&buf[4], adv_ms, sizeof(adv_ms));
+    report_set(buf, sizeof(buf));
+}
+
+//*********************************************************** */
+// Strobe Benchmark
+//*********************************************************** */
+// Acceptance check for the strobe engine. 0xAF stops the session and runs
+// the strobe at fixed rates across 1-50 Hz for a dwell time each, lenses at
+// full duty. The strobe ISR times every lens 0 edge with esp_timer_get_time()
+// right after gating; the period error is the time between dark edges minus
+// the requested period, the duty error the dark time minus 3/4 of it. FF01
+// writes received during each rate are counted, so a run made while the
+// client floods the link can be told from an idle one, along with the worst
+// ISR entry after its deadline. The report also carries led_task's stack
+// high-water mark, which LED_TASK_STACK is sized from. Results go out as a
+// report (0xA8 0x08) and a UART summary.
+#define BENCH_ROWS 8
+#define BENCH_MAX_DWELL_S 60
+
+static const uint8_t bench_hz[BENCH_ROWS] = { 1, 2, 5, 10, 20, 30, 40, 50 };
+
+typedef struct {
+    uint8_t hz;
+    uint16_t writes;                // FF01 writes during the row
+    uint16_t late_max_us;           // Worst edge ISR lateness
+    bench_stat_t period, duty;
+} bench_row_t;
+
+typedef enum {
+    BENCH_IDLE = 0,
+    BENCH_RUNNING,
+    BENCH_DONE,
+    BENCH_ABORTED,
+} bench_state_t;
+
+// Benchmark state - owned by led_task
+static uint8_t bench_state = BENCH_IDLE;
+static uint8_t bench_dwell_s = 0;
+static uint8_t bench_row = 0;               // Row running, or rows done
+static uint32_t bench_row_end = 0;          // Tick the running row ends
+static uint32_t bench_row_writes = 0;       // ble_writes at row start
+static bench_row_t bench_rows[BENCH_ROWS];
+
+static volatile uint32_t ble_writes = 0;    // FF01 writes (BLE host task)
+
+static void bench_row_begin(uint32_t now)
+{
+    uint32_t hz = bench_hz[bench_row];
+    strobe_set_ramp(hz << 8, hz << 8, esp_timer_get_time(), 0);
+
+    portENTER_CRITICAL(&strobe_mux);
+    memset(&bench_acc, 0, sizeof(bench_acc));
+    bench_acc.dark = 0xFF;
+    bench_acc.period_us = (1000000 + hz / 2) / hz;
+    bench_acc.dark_us = (bench_acc.period_us * 3 + 2) / 4;
+    bench_acc.on = 1;
+    portEXIT_CRITICAL(&strobe_mux);
+
+    bench_row_writes = ble_writes;
+    bench_row_end = now + bench_dwell_s * 1000 / portTICK_PERIOD_MS;
+    strobe_start();
+}
+
+static void bench_row_finish(void)
+{
+    strobe_stop();
+    bench_row_t *r = &bench_rows[bench_row];
+    portENTER_CRITICAL(&strobe_mux);
+    bench_acc.on = 0;
+    r->period = bench_acc.period;
+    r->duty = bench_acc.duty;
+    r->late_max_us = bench_acc.late_max_us;
+    portEXIT_CRITICAL(&strobe_mux);
+    uint32_t writes = ble_writes - bench_row_writes;
+    r->hz = bench_hz[bench_row];
+    r->writes = writes > UINT16_MAX ? UINT16_MAX : writes;
+    bench_row++;
+}
+
+// Mean error in 0.1 us
+static int16_t bench_mean(const bench_stat_t *s)
+{
+    return s->count ? (int16_t)((int64_t)s->sum * 10 / s->count) : 0;
+}
+
+// Bytes of led_task's stack never used since boot
+static uint32_t bench_stack_free(void)
+{
+    return led_task_handle ? uxTaskGetStackHighWaterMark(led_task_handle) : 0;
+}
+
+static void bench_log(void)
+{
+    for (int i = 0; i < bench_row; i++) {
+        const bench_row_t *r = &bench_rows[i];
+        ESP_LOGI(TAG, "Bench %2u Hz: %u cycles, period %d..%d us (mean %.1f), "
+                 "duty %d..%d us (mean %.1f), late <= %u us, %u writes",
+                 r->hz, r->period.count, r->period.min, r->period.max,
+                 bench_mean(&r->period) / 10.0f, r->duty.min, r->duty.max,
+                 bench_mean(&r->duty) / 10.0f, r->late_max_us, r->writes);
+    }
+    uint32_t stack_free = bench_stack_free();
+    if (stack_free < LED_TASK_STACK_MARGIN) {
+        ESP_LOGW(TAG, "led_task stack: %lu of %d bytes unused", (unsigned long)stack_free,
+                 LED_TASK_STACK);
+    } else {
+        ESP_LOGI(TAG, "led_task stack: %lu of %d bytes unused", (unsigned long)stack_free,
+                 LED_TASK_STACK);
+    }
+}
+
+// Start a run with dwell_s seconds per rate, replacing any earlier results
+static void bench_start(uint8_t dwell_s)
+{
+    TRACE(TRACE_SESSION, TRACE_SESSION_BENCH, dwell_s);
+    marker_push(MARKER_SESSION, TRACE_SESSION_BENCH, esp_timer_get_time());
+    session_active = 0;
+    override_active = 0;
+    strobe_stop();
+    lens_setduty(100);
+    memset(bench_rows, 0, sizeof(bench_rows));
+    bench_dwell_s = dwell_s > BENCH_MAX_DWELL_S ? BENCH_MAX_DWELL_S : dwell_s;
+    bench_row = 0;
+    bench_state = BENCH_RUNNING;
+    bench_row_begin(xTaskGetTickCount());
+}
+
+// Stop a running benchmark early, keeping the rows done so far
+static void bench_abort(void)
+{
+    if (bench_state != BENCH_RUNNING) {
+        return;
+    }
+    strobe_stop();
+    portENTER_CRITICAL(&strobe_mux);
+    bench_acc.on = 0;
+    portEXIT_CRITICAL(&strobe_mux);
+    bench_state = BENCH_ABORTED;
+    lens_setduty(0);
+    bench_log();
+}
+
+// Advance a running benchmark. Returns the ticks until the next row
+// change, 0 once the run has finished.
+static uint32_t bench_poll(uint32_t now)
+{
+    if ((int32_t)(now - bench_row_end) >= 0) {
+        bench_row_finish();
+        if (bench_row >= BENCH_ROWS) {
+            bench_state = BENCH_DONE;
+            lens_setduty(0);
+            bench_log();
+            return 0;
+        }
+        bench_row_begin(now);
+    }
+    return bench_row_end - now;
+}
+
+static uint8_t *bench_pack(uint8_t *p, const bench_stat_t *s)
+{
+    int16_t mean = bench_mean(s);
+    memcpy(p, &s->count, 2);
+    memcpy(p + 2, &s->min, 2);
+    memcpy(p + 4, &s->max, 2);
+    memcpy(p + 6, &mean, 2);
+    memcpy(p + 8, s->hist, sizeof(s->hist));
+    return p + 8 + sizeof(s->hist);
+}
+
+// Benchmark report: [0] kind  [1] bench_state_t  [2] rows done  [3] dwell s
+//   [4..5] led_task stack never used (bytes)
+//   then per row: [hz] [writes u16] [late max u16, us] [period stat]
+//   [duty stat], where a stat
+//   is [count u16] [min s16] [max s16] [mean s16, 0.1 us] [hist 10 x u16]
+//   over |error| <= 1, 2, 5, 10, 20, 50, 100, 200, 500 us and above
+#define BENCH_STAT_LEN  (8 + 2 * BENCH_BUCKETS)
+#define BENCH_ROW_LEN   (5 + 2 * BENCH_STAT_LEN)
+_Static_assert(6 + BENCH_ROWS * BENCH_ROW_LEN <= REPORT_MAX_LEN, "benchmark report too long");
 
-static uint16_t gatt_service_handle = 0;
-static esp_gatt_char_prop_t gatt_property = 0;
-static esp_attr_value_t gatt_char_val = {
-    .attr_max_len = 100,
-    .attr_len = 0,
-    .attr_value = NULL,
-};
+static void report_bench(void)
+{
+    static uint8_t buf[6 + BENCH_ROWS * BENCH_ROW_LEN];
+    uint8_t *p = &buf[6];
+    uint32_t stack_free = bench_stack_free();
+    uint16_t stack16 = stack_free > UINT16_MAX ? UINT16_MAX : stack_free;
+    buf[0] = REPORT_BENCH;
+    buf[1] = bench_state;
+    buf[2] = bench_row;
+    buf[3] = bench_dwell_s;
+    memcpy(&buf[4], &stack16, 2);
+    for (int i = 0; i < bench_row; i++) {
+        const bench_row_t *r = &bench_rows[i];
+        p[0] = r->hz;
+        memcpy(&p[1], &r->writes, 2);
+        memcpy(&p[3], &r->late_max_us, 2);
+        p = bench_pack(&p[5], &r->period);
+        p = bench_pack(p, &r->duty);
+    }
+    report_set(buf, p - buf);
+}
 
 //*********************************************************** */
-// Hardware Configuration
+// Clock Sync
 //*********************************************************** */
-#define HALL_PIN GPIO_NUM_4
-#define SLEEP_HALL_WAIT_TIME 5
+// Hosts put several devices (or a device and an external stimulus) on one
+// timeline by estimating each device's esp_timer clock. A 0xB0 ping is
+// answered straight from the BLE host task rather than through the command
+// queue, so led_task stays out of the round trip: the pong carries the
+// device times the ping arrived and the pong left, and the host brackets
+// it with its own send and receive times. Offset comes from the shortest
+// round trips, drift from how the offset moves between sync bursts; both
+// are worked out on the host.
+//
+// 0xB1 then runs 0xA6 at a device time the host picked. The lenses clear
+// and led_task idles until just before it; the strobe timer arms the first
+// dark edge for exactly that time, so devices given the same instant run
+// in phase whatever the delivery jitter of the command itself. A start
+// that arrives late joins the strobe phase it would have had.
+#define SYNC_PING_LEN       2                   // [0xB0] [seq]
+#define SCHED_LEAD_US       2000                // led_task starts the session this early
+#define SCHED_DUE_US        (SCHED_LEAD_US + portTICK_PERIOD_MS * 1000)  // A tick wait may end a tick late
+#define SCHED_MAX_AHEAD_US  (60 * 1000000LL)    // Further ahead is refused
+#define SCHED_MAX_LATE_US   1000000             // Later than this, start from now instead
 
-#define PWM1_TIMER              LEDC_TIMER_0
-#define PWM1_MODE               LEDC_LOW_SPEED_MODE
-#define PWM1_OUTPUT_IO          (27)
-#define PWM1_CHANNEL            LEDC_CHANNEL_0
-#define PWM1_DUTY_RES           LEDC_TIMER_10_BIT
-#define PWM1_FREQUENCY          (1000)
+// Pong, little-endian, 18 bytes (fits a notify at the default MTU)
+typedef struct __attribute__((packed)) {
+    uint8_t type;              // TELEM_TYPE_PONG
+    uint8_t seq;               // From the ping
+    int64_t rx_us;             // Ping arrived (esp_timer time)
+    int64_t tx_us;             // Pong handed to the stack
+} sync_pong_t;
+
+static portMUX_TYPE sync_mux = portMUX_INITIALIZER_UNLOCKED;
+static sync_pong_t sync_last;             // Also kept for the 0xA8 report
+static uint32_t sync_pings = 0;
+
+// Scheduled start - owned by led_task
+static uint8_t sched_pending = 0;
+static int64_t sched_start_us = 0;        // esp_timer time
+
+// Answer a ping that came in at rx_us (BLE host task). Notified even while
+// congested: a lost pong only costs the host one sample.
+static void sync_ping(uint8_t seq, int64_t rx_us)
+{
+    sync_pong_t p = { .type = TELEM_TYPE_PONG, .seq = seq, .rx_us = rx_us };
+    p.tx_us = esp_timer_get_time();
+    ble_transport_notify((const uint8_t *)&p, sizeof(p));
+    portENTER_CRITICAL(&sync_mux);
+    sync_last = p;
+    sync_pings++;
+    portEXIT_CRITICAL(&sync_mux);
+}
+
+// Ticks led_task may wait before the scheduled start falls due
+static TickType_t sched_wait(void)
+{
+    if (!sched_pending) {
+        return portMAX_DELAY;
+    }
+    int64_t ahead = sched_start_us - esp_timer_get_time() - SCHED_DUE_US;
+    if (ahead <= 0) {
+        return 0;
+    }
+    TickType_t ticks = (TickType_t)(ahead / (portTICK_PERIOD_MS * 1000));
+    return ticks ? ticks : 1;
+}
 
-// PWM2 commented out - hardware appears tied to PWM1
-// #define PWM2_TIMER              LEDC_TIMER_0
-// #define PWM2_MODE               LEDC_LOW_SPEED_MODE
-// #define PWM2_OUTPUT_IO          (26)
-// #define PWM2_CHANNEL            LEDC_CHANNEL_1
-// #define PWM2_DUTY_RES           LEDC_TIMER_10_BIT
-// #define PWM2_FREQUENCY          (1000)
+// Sync report: [0] kind  [1] seq of the last ping  [2..9] its rx_us
+//   [10..17] its tx_us  [18..25] device time now  [26..29] pings answered
+static void report_sync(void)
+{
+    uint8_t buf[30];
+    buf[0] = REPORT_SYNC;
+    portENTER_CRITICAL(&sync_mux);
+    buf[1] = sync_last.seq;
+    memcpy(&buf[2], &sync_last.rx_us, 8);
+    memcpy(&buf[10], &sync_last.tx_us, 8);
+    uint32_t pings = sync_pings;
+    portEXIT_CRITICAL(&sync_mux);
+    int64_t now = esp_timer_get_time();
+    memcpy(&buf[18], &now, 8);
+    memcpy(&buf[26], &pings, 4);
+    report_set(buf, sizeof(buf));
+}
 
 //*********************************************************** */
-// Session Parameters
+// Biofeedback Pacing
 //*********************************************************** */
-static uint8_t brightness = 100;         // Brightness 0-100%
+// A host with a heart rate strap streams RR intervals (0xB6), or a feedback
+// value of its own (0xB7), and the pacer in pacing.h sets breathing and
+// strobe inside the running session, with no round trip through the host
+// per adjustment. 0xB5 picks the mode and bounds; they last until changed
+// or the next deep sleep. Beats are only used while the session envelope
+// runs, since their breath cycle position is what the estimator works on.
+// RR intervals carry no timestamps: the last one in a write is taken as
+// the beat just reported, and the ones before it are placed back from it
+// by the intervals in between.
+#define PACE_RR_PER_CMD     (CMD_MAX_ARGS / 2)
 
-// Strobe progression
-static uint8_t start_hz = 12;           // Starting strobe frequency
-static uint8_t end_hz = 8;              // Ending strobe frequency
+static pace_t pace;                       // led_task only
 
-// Breathing progression (x0.1 seconds)
-// Start: inhale-0-exhale-0, End: inhale-hold_in_end-exhale-hold_out_end
-static uint8_t inhale_time = 40;         // 4.0s (fixed throughout)
-static uint8_t exhale_time = 40;         // 4.0s (fixed throughout)
-static uint8_t hold_in_end = 40;         // End hold_in: 4.0s (starts at 0)
-static uint8_t hold_out_end = 40;        // End hold_out: 4.0s (starts at 0)
+static inline uint8_t pace_telem_flags(void)
+{
+    return pace.cfg.mode != PACE_OFF ? TELEM_FLAG_PACING : 0;
+}
 
-// Session timing
-static uint8_t session_minutes = 10;     // Session duration in minutes
-static uint32_t session_start_tick = 0;  // When session started
-static uint8_t session_active = 0;       // Is a timed session running?
-static uint8_t session_ended = 0;        // Has session completed (trigger sleep)?
+// Hand the pacer's breathing and strobe to the session engine
+static void pace_apply(void)
+{
+    session_pace_t out;
+    pace_output(&pace, &out);
+    session_engine_pace(&session, &out);
+}
 
-// Static override mode
-static uint8_t override_active = 0;
-static uint8_t override_duty = 0;
+// 0xB5 [mode] [rate_min] [rate_max] [inhale %] [hz_low] [hz_high], all but
+// the mode optional (defaults from PACE_CFG_DEFAULT)
+static void pace_set(const engine_cmd_t *cmd)
+{
+    pace_cfg_t cfg = PACE_CFG_DEFAULT;
+    uint8_t *f[] = { &cfg.mode, &cfg.rate_min, &cfg.rate_max, &cfg.inhale_pct,
+                     &cfg.hz_low, &cfg.hz_high };
+    for (uint32_t i = 0; i < cmd->len && i < sizeof(f) / sizeof(f[0]); i++) {
+        *f[i] = cmd->arg[i];
+    }
+    pace_configure(&pace, &cfg);
+    pace_apply();
+    HOT_LOGI(TAG, "Pacing: mode %d, %d-%d x0.1/min, inhale %d%%, strobe %d->%d Hz",
+             pace.cfg.mode, pace.cfg.rate_min, pace.cfg.rate_max, pace.cfg.inhale_pct,
+             pace.cfg.hz_low, pace.cfg.hz_high);
+}
+
+// 0xB6 [rr ms u16 LE]..., oldest first
+static void pace_rr(const engine_cmd_t *cmd)
+{
+    uint32_t n = cmd->len / 2;
+    uint16_t rr[PACE_RR_PER_CMD];
+    memcpy(rr, cmd->arg, n * 2);
+
+    uint32_t t = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    for (uint32_t i = n; i > 1; i--) {
+        t -= rr[i - 1];                   // Back to the oldest beat
+    }
+    bool changed = false;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t pos;
+        if (i > 0) t += rr[i];
+        if (session_engine_cycle_pos(&session, t, &pos) && pace_beat(&pace, rr[i], pos)) {
+            changed = true;
+        }
+    }
+    if (changed) {
+        pace_apply();
+        uint8_t r = pace_rate(&pace, pace.k);
+        ESP_LOGI(TAG, "Pacing: %d.%d breaths/min, coherence %lu%%", r / 10, r % 10,
+                 (unsigned long)(pace.coherence_q16 * 100 / PACE_Q16));
+    }
+}
+
+// 0xB7 [value u16 LE], 0-65535 for 0-1
+static void pace_value(const engine_cmd_t *cmd)
+{
+    uint16_t v;
+    if (cmd->len < 2) {
+        return;
+    }
+    memcpy(&v, cmd->arg, 2);
+    if (pace_scalar(&pace, v)) {
+        pace_apply();
+    }
+}
+
+// Pacing report: [0] kind  [1] mode  [2] search (pace_search_t)  [3] rate count
+//   [4] rate index now  [5] best index  [6] inhale  [7] exhale (x0.1 s)
+//   [8] rate paced now (0 = off)  [9] best rate (breaths/min x0.1)  [10..11] heart rate (bpm Q8)
+//   [12..13] swing last dwell (bpm Q8)  [14..15] coherence  [16..17] feedback
+//   (0-65535)  [18..19] strobe target (Hz Q8, 0 = program)  [20..23] beats used
+//   [24..27] beats rejected  then per rate, fastest first: [rate (breaths/min
+//   x0.1)] [swing (bpm Q8 u16, 0 = not yet)]
+static void report_pace(void)
+{
+    uint8_t buf[28 + PACE_RATES_MAX * 3];
+    session_pace_t out;
+    uint8_t rate = pace_output(&pace, &out);
+    uint16_t coh = pace.coherence_q16 >= PACE_Q16 ? UINT16_MAX : (uint16_t)pace.coherence_q16;
+    uint16_t fb = pace.feedback_q16 >= PACE_Q16 ? UINT16_MAX : (uint16_t)pace.feedback_q16;
+    uint16_t hz = (uint16_t)out.hz_q8;
+    buf[0] = REPORT_PACE;
+    buf[1] = pace.cfg.mode;
+    buf[2] = pace.search;
+    buf[3] = pace.rate_count;
+    buf[4] = pace.k;
+    buf[5] = pace.best;
+    buf[6] = out.inhale;
+    buf[7] = out.exhale;
+    buf[8] = rate;
+    buf[9] = pace_rate(&pace, pace.best);
+    memcpy(&buf[10], &pace.hr_q8, 2);
+    memcpy(&buf[12], &pace.amp_last_q8, 2);
+    memcpy(&buf[14], &coh, 2);
+    memcpy(&buf[16], &fb, 2);
+    memcpy(&buf[18], &hz, 2);
+    memcpy(&buf[20], &pace.accepted, 4);
+    memcpy(&buf[24], &pace.rejected, 4);
+    uint8_t *p = &buf[28];
+    for (uint8_t i = 0; i < pace.rate_count; i++) {
+        p[0] = pace_rate(&pace, i);
+        memcpy(&p[1], &pace.amp_q8[i], 2);
+        p += 3;
+    }
+    report_set(buf, p - buf);
+}
 
 //*********************************************************** */
-// PWM Functions
+// Session Control
 //*********************************************************** */
-static void PWM_Init(void)
+// Wake led_task to apply a parameter/state change now
+static void engine_notify(void)
 {
-    ledc_timer_config_t pwm1_timer = {
-        .speed_mode       = PWM1_MODE,
-        .duty_resolution  = PWM1_DUTY_RES,
-        .timer_num        = PWM1_TIMER,
-        .freq_hz          = PWM1_FREQUENCY,
-        .clk_cfg          = LEDC_AUTO_CLK
-    };
-    ESP_ERROR_CHECK(ledc_timer_config(&pwm1_timer));
-
-    ledc_channel_config_t pwm1_channel = {
-        .speed_mode     = PWM1_MODE,
-        .channel        = PWM1_CHANNEL,
-        .timer_sel      = PWM1_TIMER,
-        .intr_type      = LEDC_INTR_DISABLE,
-        .gpio_num       = PWM1_OUTPUT_IO,
-        .duty           = 0,
-        .hpoint         = 0
-    };
-    ESP_ERROR_CHECK(ledc_channel_config(&pwm1_channel));
-
-    // PWM2 commented out
-    // ledc_channel_config_t pwm2_channel = { ... };
+    if (led_task_handle) {
+        xTaskNotifyGive(led_task_handle);
+    }
 }
 
-// LCD lens deadzone: below ~40% PWM (raw ~400) the lens doesn't visibly change.
-// Remap: duty 0 = raw 0 (fully clear), duty 1-100 = raw 400-1024 (visible range)
-#define PWM_MIN_VISIBLE 400
-#define PWM_MAX 1024
+// Events for the app_main task, which otherwise stays blocked
+#define MAIN_EVT_HALL           (1 << 0)   // Hall pin edge (GPIO ISR)
+#define MAIN_EVT_SESSION_END    (1 << 1)   // session_ended set
+#define MAIN_EVT_TRACE_DUMP     (1 << 2)   // 0xA8 0x00
+
+static TaskHandle_t main_task_handle = NULL;
+
+static void main_notify(uint32_t evt)
+{
+    if (main_task_handle) {
+        xTaskNotify(main_task_handle, evt, eSetBits);
+    }
+}
 
-static void pwm1_setduty(uint32_t duty) {
-    uint32_t raw;
-    if (duty == 0) {
-        raw = 0;
+// (Re)start the timed session from the beginning as of start_us, running
+// the uploaded program if one is selected, otherwise the current
+// parameters. A start_us in the past puts the program that far in.
+static void session_restart_at(int64_t start_us)
+{
+    TRACE(TRACE_SESSION, TRACE_SESSION_RESTART, 0);
+    override_active = 0;
+    if (prog_use_stored && prog_stored_valid) {
+        session.prog = prog_stored;
     } else {
-        raw = PWM_MIN_VISIBLE + (PWM_MAX - PWM_MIN_VISIBLE) * duty / 100;
+        prog_from_params(params_get(), &session.prog);
     }
-    ledc_set_duty(PWM1_MODE, PWM1_CHANNEL, raw);
-    ledc_update_duty(PWM1_MODE, PWM1_CHANNEL);
+    int64_t late_ms = (esp_timer_get_time() - start_us) / 1000;
+    session_start_us = start_us;
+    marker_push(MARKER_SESSION, TRACE_SESSION_RESTART, start_us);
+    session_engine_start(&session, xTaskGetTickCount() * portTICK_PERIOD_MS -
+                                   (late_ms > 0 ? (uint32_t)late_ms : 0));
+    session_active = 1;
+    session_ended = 0;
+}
+
+static void session_restart(void)
+{
+    session_restart_at(esp_timer_get_time());
 }
 
-// static void pwm2_setduty(uint32_t duty) {
-//     duty = 1024 * duty / 100;
-//     ledc_set_duty(PWM2_MODE, PWM2_CHANNEL, duty);
-//     ledc_update_duty(PWM2_MODE, PWM2_CHANNEL);
-// }
+// Run the 0xB1 start, SCHED_LEAD_US ahead of its time (or late). The
+// strobe is restarted from the scheduled time, not from now.
+static void session_start_scheduled(void)
+{
+    int64_t t = sched_start_us;
+    int64_t now = esp_timer_get_time();
+    sched_pending = 0;
+    if (now - t > SCHED_MAX_LATE_US) {
+        t = now;    // Too late to line up with anything: start as 0xA6 would
+    }
+    bench_abort();
+    session_restart_at(t);
+    strobe_stop();
+    strobe_start_at(t);
+}
 
-//*********************************************************** */
-// BLE Handlers
-//*********************************************************** */
-static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+// 0xA8 queries: select what the next characteristic read returns, or dump
+//   [0xA8] [0x00]               - dump trace to UART
+//   [0xA8] [0x01] [seq u32 LE]  - trace records from seq (0 = oldest held)
+//   [0xA8] [0x02] [mask]        - set trace event mask (bit per trace_type_t)
+//   [0xA8] [0x03]               - program report (upload status, active program)
+//   [0xA8] [0x04]               - boot stage timestamps
+//   [0xA8] [0x05]               - connection profile and parameters in use
+//   [0xA8] [0x06]               - lens count and per-lens layout
+//   [0xA8] [0x07]               - lens response table in use
+//   [0xA8] [0x08]               - strobe benchmark results
+//   [0xA8] [0x09]               - last clock sync pong and device time now
+//   [0xA8] [0x0A]               - advertising policy, state and time per state
+//   [0xA8] [0x0B]               - energy accounting per state
+//   [0xA8] [0x0C]               - pacing state and heart rate estimates
+static void engine_query(const engine_cmd_t *cmd)
 {
-    switch (event) {
-    case ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT:
-        adv_config_done &= (~ADV_CONFIG_FLAG);
-        if (adv_config_done == 0) {
-            esp_ble_gap_start_advertising(&adv_params);
+    if (cmd->len < 1) {
+        return;
+    }
+    switch (cmd->arg[0]) {
+#if EDGE_TRACE
+        case 0x00:
+            // Slow, so done from the app_main task
+            main_notify(MAIN_EVT_TRACE_DUMP);
+            break;
+        case 0x01: {
+            uint32_t seq = 0;
+            if (cmd->len >= 5) memcpy(&seq, &cmd->arg[1], 4);
+            report_trace(seq);
+            break;
         }
-        break;
-    default:
-        break;
+        case 0x02:
+            if (cmd->len >= 2) trace_mask = cmd->arg[1];
+            break;
+#endif
+        case 0x03:
+            report_program();
+            break;
+        case 0x04:
+            report_boot();
+            break;
+        case 0x05:
+            report_conn();
+            break;
+        case 0x06:
+            report_lens();
+            break;
+        case 0x07:
+            report_calib();
+            break;
+        case 0x08:
+            report_bench();
+            break;
+        case 0x09:
+            report_sync();
+            break;
+        case 0x0A:
+            report_adv();
+            break;
+        case 0x0B:
+            report_energy();
+            break;
+        case 0x0C:
+            report_pace();
+            break;
+        default:
+            ESP_LOGW(TAG, "Unknown query: 0x%02X", cmd->arg[0]);
+            break;
     }
 }
 
-static void gatts_profile_event_handler(esp_gatts_cb_event_t event,
-                                         esp_gatt_if_t gatts_if,
-                                         esp_ble_gatts_cb_param_t *param)
+// 0xAB program upload and selection:
+//   [0xAB] [0x01] [size u16 LE]          - begin an upload of size bytes
+//   [0xAB] [0x02] [offset u16 LE] [data] - write a chunk (up to 17 bytes)
+//   [0xAB] [0x03]                        - check and store the upload, run it
+//   [0xAB] [0x04]                        - erase the stored program, run the parameters
+//   [0xAB] [0x05]                        - run the stored program
+// Returns true if the session must restart.
+static bool engine_program(const engine_cmd_t *cmd)
 {
-    switch (event) {
-    case ESP_GATTS_REG_EVT:
-    {
-        esp_ble_gap_set_device_name(DEVICE_NAME);
-        adv_config_done |= ADV_CONFIG_FLAG;
-        esp_ble_gap_config_adv_data(&adv_data);
+    if (cmd->len < 1) {
+        return false;
+    }
+    uint16_t v = 0;
+    if (cmd->len >= 3) memcpy(&v, &cmd->arg[1], 2);
 
-        esp_gatt_srvc_id_t service_id = {
-            .is_primary = true,
-            .id = {
-                .inst_id = 0,
-                .uuid = {
-                    .len = ESP_UUID_LEN_16,
-                    .uuid = { .uuid16 = GATTS_SERVICE_UUID_TEST },
-                },
-            },
-        };
-        esp_ble_gatts_create_service(gatts_if, &service_id, GATTS_NUM_HANDLE_TEST);
-        break;
+    switch (cmd->arg[0]) {
+        case 0x01:
+            memset(prog_rx, 0, sizeof(prog_rx));
+            prog_rx_len = (cmd->len >= 3 && v <= PROG_MAX_LEN) ? v : 0;
+            prog_result = prog_rx_len ? PROG_OK : PROG_ERR_LENGTH;
+            return false;
+        case 0x02:
+            if (cmd->len < 3 || v + (cmd->len - 3) > prog_rx_len) {
+                prog_result = PROG_ERR_LENGTH;
+            } else {
+                memcpy(&prog_rx[v], &cmd->arg[3], cmd->len - 3);
+            }
+            return false;
+        case 0x03:
+            // A failed chunk fails the commit
+            if (prog_result == PROG_OK) {
+                prog_result = prog_validate(prog_rx, prog_rx_len);
+            }
+            if (prog_result == PROG_OK && prog_store((const prog_t *)prog_rx) != ESP_OK) {
+                prog_result = PROG_ERR_STORE;
+            }
+            TRACE(TRACE_PROG, prog_result, prog_rx_len);
+            if (prog_result != PROG_OK && prog_result != PROG_ERR_STORE) {
+                ESP_LOGW(TAG, "Program rejected: %d", prog_result);
+                return false;
+            }
+            prog_use_stored = 1;
+            ESP_LOGI(TAG, "Program stored: %d segments", ((const prog_t *)prog_rx)->count);
+            return true;
+        case 0x04:
+            prog_erase();
+            prog_use_stored = 0;
+            return true;
+        case 0x05:
+            if (!prog_stored_valid) {
+                prog_result = PROG_ERR_NONE_STORED;
+                return false;
+            }
+            prog_use_stored = 1;
+            return true;
+        default:
+            ESP_LOGW(TAG, "Unknown program op: 0x%02X", cmd->arg[0]);
+            return false;
     }
+}
 
-    case ESP_GATTS_CREATE_EVT:
-        gatt_service_handle = param->create.service_handle;
-        esp_ble_gatts_start_service(gatt_service_handle);
-        gatt_property = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE;
-        esp_bt_uuid_t char_uuid = {
-            .len = ESP_UUID_LEN_16,
-            .uuid = { .uuid16 = GATTS_CHAR_UUID_TEST },
-        };
-        esp_ble_gatts_add_char(gatt_service_handle, &char_uuid,
-                               ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
-                               gatt_property, &gatt_char_val, NULL);
-        break;
+// 0xAE lens calibration (table of perceptual duty 0-100 to raw 0-1024):
+//   [0xAE] [0x01] [index] [raw u16 LE]... - stage entries from index (up to 9)
+//   [0xAE] [0x02]                         - check and store the staged table, use it
+//   [0xAE] [0x03]                         - erase the stored table, use the built-in one
+//   [0xAE] [0x04] [raw u16 LE]            - hold a raw duty on every lens, for measuring
+// A new table applies at once; a raw hold stops the session like 0xA5.
+static void engine_calib(const engine_cmd_t *cmd)
+{
+    if (cmd->len < 1) {
+        return;
+    }
+    uint16_t v = 0;
+    if (cmd->len >= 3) memcpy(&v, &cmd->arg[1], 2);
 
-    case ESP_GATTS_WRITE_EVT:
-        // ALWAYS send response first to prevent GATT stack from blocking
-        if (param->write.need_rsp) {
-            esp_ble_gatts_send_response(gatts_if, param->write.conn_id,
-                                        param->write.trans_id, ESP_GATT_OK, NULL);
+    switch (cmd->arg[0]) {
+        case 0x01: {
+            uint32_t n = cmd->len >= 2 ? (cmd->len - 2) / 2 : 0;
+            if (n == 0 || cmd->arg[1] + n > LENS_LUT_SIZE) {
+                lut_result = LUT_ERR_RANGE;
+                lut_rx_bad = 1;
+                break;
+            }
+            memcpy(&lut_rx[cmd->arg[1]], &cmd->arg[2], n * 2);
+            break;
         }
-        
-        if (param->write.len > 0) {
-            ESP_LOGI(TAG, "BLE Write: %d bytes", param->write.len);
-            for (int i = 0; i < param->write.len; i++) {
-                ESP_LOGI(TAG, "Byte[%d]: 0x%02X", i, param->write.value[i]);
+        case 0x02:
+            // A failed chunk fails the commit; staging restarts from the table in use
+            lut_result = lut_rx_bad ? LUT_ERR_RANGE : lut_validate(lut_rx);
+            lut_rx_bad = 0;
+            if (lut_result != LUT_OK) {
+                ESP_LOGW(TAG, "Lens table rejected: %d", lut_result);
+                memcpy(lut_rx, lens_lut, sizeof(lut_rx));
+                break;
             }
-            
-            // LEGACY: Single byte write = direct duty (0-255 mapped to 0-100%)
-            // 0x00 = clear (0% duty), 0xFF = full dark (100% duty)
-            // Full 0x00-0xFF range reserved for legacy app compatibility
-            if (param->write.len == 1) {
-                uint8_t raw = param->write.value[0];
-                override_duty = (uint8_t)((uint16_t)raw * 100 / 255);
-                override_active = 1;
-                session_active = 0;
-                pwm1_setduty(override_duty);
-                ESP_LOGI(TAG, "Legacy cmd: 0x%02X -> %d%% duty", raw, override_duty);
-            } else {
-            
-            // NEW COMMANDS: Multi-byte, first byte 0xA0+ to avoid legacy collision
-            uint8_t cmd = param->write.value[0];
-            switch (cmd) {
-                case 0xA1:  // Set strobe range: [0xA1] [start_hz] [end_hz]
-                    if (param->write.len >= 3) {
-                        start_hz = param->write.value[1];
-                        end_hz = param->write.value[2];
-                        if (start_hz < 1) start_hz = 1;
-                        if (start_hz > 50) start_hz = 50;
-                        if (end_hz < 1) end_hz = 1;
-                        if (end_hz > 50) end_hz = 50;
-                        override_active = 0;
-                        session_start_tick = xTaskGetTickCount();
-                        session_active = 1;
-                        session_ended = 0;
-                        ESP_LOGI(TAG, "Strobe: %d->%d Hz", start_hz, end_hz);
-                    }
-                    break;
-                case 0xA2:  // Set brightness: [0xA2] [brightness 0-100]
-                    if (param->write.len >= 2) {
-                        brightness = param->write.value[1];
-                        if (brightness > 100) brightness = 100;
-                        ESP_LOGI(TAG, "Brightness: %d%%", brightness);
-                    }
-                    break;
-                case 0xA3:  // Set breathing: [0xA3] [inh] [hold_in_end] [exh] [hold_out_end]
-                    if (param->write.len >= 5) {
-                        inhale_time = param->write.value[1];
-                        hold_in_end = param->write.value[2];
-                        exhale_time = param->write.value[3];
-                        hold_out_end = param->write.value[4];
-                        override_active = 0;
-                        session_start_tick = xTaskGetTickCount();
-                        session_active = 1;
-                        session_ended = 0;
-                        ESP_LOGI(TAG, "Breathing: %.1f/0->%.1f/%.1f/0->%.1f",
-                                 inhale_time/10.0f, hold_in_end/10.0f,
-                                 exhale_time/10.0f, hold_out_end/10.0f);
-                    }
-                    break;
-                case 0xA4:  // Set session duration: [0xA4] [minutes]
-                    if (param->write.len >= 2) {
-                        session_minutes = param->write.value[1];
-                        if (session_minutes < 1) session_minutes = 1;
-                        if (session_minutes > 60) session_minutes = 60;
-                        override_active = 0;
-                        session_start_tick = xTaskGetTickCount();
-                        session_active = 1;
-                        session_ended = 0;
-                        ESP_LOGI(TAG, "Session: %d minutes", session_minutes);
-                    }
-                    break;
-                case 0xA5:  // Static override: [0xA5] [duty 0-100]
-                    if (param->write.len >= 2) {
-                        override_duty = param->write.value[1];
-                        if (override_duty > 100) override_duty = 100;
-                        override_active = 1;
-                        session_active = 0;
-                        pwm1_setduty(override_duty);
-                        ESP_LOGI(TAG, "Override: static %d%%", override_duty);
+            memcpy(lens_lut, lut_rx, sizeof(lens_lut));
+            if (lut_store(lut_rx) != ESP_OK) {
+                lut_result = LUT_ERR_STORE;
+            }
+            lens_changed = 1;
+            ESP_LOGI(TAG, "Lens table stored");
+            break;
+        case 0x03:
+            lut_erase();
+            lut_use(lens_lut_default);
+            lut_rx_bad = 0;
+            lut_result = LUT_OK;
+            lens_changed = 1;
+            break;
+        case 0x04:
+            if (cmd->len < 3) {
+                break;
+            }
+            if (v > PWM_MAX) v = PWM_MAX;
+            TRACE(TRACE_SESSION, TRACE_SESSION_RAW_HOLD, v);
+            marker_push(MARKER_SESSION, TRACE_SESSION_RAW_HOLD, esp_timer_get_time());
+            bench_abort();
+            sched_pending = 0;
+            override_active = 1;
+            session_active = 0;
+            strobe_stop();
+            lens_setraw(v);
+            break;
+        default:
+            ESP_LOGW(TAG, "Unknown calibration op: 0x%02X", cmd->arg[0]);
+            break;
+    }
+}
+
+// 0xB4 energy accounting:
+//   [0xB4] [0x01] [state] [uA u32 LE]... - set currents from state on (up to 4), stored
+//   [0xB4] [0x02]                        - clear the time and wake counters
+//   [0xB4] [0x03]                        - erase the stored currents, use the built-in ones
+static void engine_energy(const engine_cmd_t *cmd)
+{
+    if (cmd->len < 1) {
+        return;
+    }
+    switch (cmd->arg[0]) {
+        case 0x01: {
+            uint32_t n = cmd->len >= 2 ? (cmd->len - 2) / 4 : 0;
+            uint32_t ua[4];
+            if (n == 0 || cmd->arg[1] + n > ENERGY_STATE_COUNT) {
+                ESP_LOGW(TAG, "Energy currents out of range");
+                break;
+            }
+            memcpy(ua, &cmd->arg[2], n * 4);
+            esp_err_t err = energy_store(cmd->arg[1], ua, n);
+            if (err != ESP_OK) {
+                ESP_LOGW(TAG, "Energy currents save failed: %s", esp_err_to_name(err));
+            }
+            break;
+        }
+        case 0x02:
+            energy_clear();
+            ESP_LOGI(TAG, "Energy counters cleared");
+            break;
+        case 0x03:
+            energy_erase();
+            break;
+        default:
+            ESP_LOGW(TAG, "Unknown energy op: 0x%02X", cmd->arg[0]);
+            break;
+    }
+}
+
+// Apply every queued BLE command. Parameter changes go into the inactive
+// snapshot, which is published in one step; session actions (restart,
+// override) then act on the new parameters. Called from led_task only.
+static void engine_apply_pending(void)
+{
+    enum { ACTION_NONE, ACTION_RESTART, ACTION_OVERRIDE, ACTION_SCHEDULE } action = ACTION_NONE;
+    session_params_t next = *params_get();
+    engine_cmd_t cmd;
+    uint8_t changed = 0;
+
+    while (cmd_pop(&cmd)) {
+        changed = 1;
+        TRACE(TRACE_CMD, cmd.op, cmd.arg[0] | (cmd.arg[1] << 8));
+        switch (cmd.op) {
+            case CMD_LEGACY:  // 0x00 = clear (0% duty), 0xFF = full dark (100% duty)
+                override_duty = (uint8_t)((uint16_t)cmd.arg[0] * 100 / 255);
+                action = ACTION_OVERRIDE;
+                HOT_LOGI(TAG, "Legacy cmd: 0x%02X -> %d%% duty", cmd.arg[0], override_duty);
+                break;
+            case 0xA1:  // Set strobe range: [0xA1] [start_hz] [end_hz]
+                if (cmd.len >= 2) {
+                    next.start_hz = cmd.arg[0];
+                    next.end_hz = cmd.arg[1];
+                    if (next.start_hz < 1) next.start_hz = 1;
+                    if (next.start_hz > 50) next.start_hz = 50;
+                    if (next.end_hz < 1) next.end_hz = 1;
+                    if (next.end_hz > 50) next.end_hz = 50;
+                    prog_use_stored = 0;
+                    action = ACTION_RESTART;
+                    HOT_LOGI(TAG, "Strobe: %d->%d Hz", next.start_hz, next.end_hz);
+                }
+                break;
+            case 0xA2:  // Set brightness: [0xA2] [brightness 0-100]
+                if (cmd.len >= 1) {
+                    next.brightness = cmd.arg[0];
+                    if (next.brightness > 100) next.brightness = 100;
+                    HOT_LOGI(TAG, "Brightness: %d%%", next.brightness);
+                }
+                break;
+            case 0xA3:  // Set breathing: [0xA3] [inh] [hold_in_end] [exh] [hold_out_end]
+                if (cmd.len >= 4) {
+                    next.inhale_time = cmd.arg[0];
+                    next.hold_in_end = cmd.arg[1];
+                    next.exhale_time = cmd.arg[2];
+                    next.hold_out_end = cmd.arg[3];
+                    prog_use_stored = 0;
+                    action = ACTION_RESTART;
+                    HOT_LOGI(TAG, "Breathing: %.1f/0->%.1f/%.1f/0->%.1f",
+                             next.inhale_time/10.0f, next.hold_in_end/10.0f,
+                             next.exhale_time/10.0f, next.hold_out_end/10.0f);
+                }
+                break;
+            case 0xA4:  // Set session duration: [0xA4] [minutes]
+                if (cmd.len >= 1) {
+                    next.session_minutes = cmd.arg[0];
+                    if (next.session_minutes < 1) next.session_minutes = 1;
+                    if (next.session_minutes > 60) next.session_minutes = 60;
+                    prog_use_stored = 0;
+                    action = ACTION_RESTART;
+                    HOT_LOGI(TAG, "Session: %d minutes", next.session_minutes);
+                }
+                break;
+            case 0xA5:  // Static override: [0xA5] [duty 0-100]
+                if (cmd.len >= 1) {
+                    override_duty = cmd.arg[0];
+                    if (override_duty > 100) override_duty = 100;
+                    action = ACTION_OVERRIDE;
+                    HOT_LOGI(TAG, "Override: static %d%%", override_duty);
+                }
+                break;
+            case 0xA6:  // Resume / restart session: [0xA6]
+                action = ACTION_RESTART;
+                HOT_LOGI(TAG, "Session restarted");
+                break;
+            case 0xA7:  // Sleep immediately: [0xA7]
+                HOT_LOGI(TAG, "BLE sleep command received");
+                session_ended = 1;
+                main_notify(MAIN_EVT_SESSION_END);
+                break;
+            case 0xA8:  // Query: [0xA8] [what] [args...]
+                engine_query(&cmd);
+                break;
+            case 0xAA:  // Telemetry rate: [0xAA] [period x10 ms, 0 = off]
+                if (cmd.len >= 1) {
+                    telem_period = cmd.arg[0];
+                    telem_update();
+                    HOT_LOGI(TAG, "Telemetry: %d ms", telem_period * 10);
+                }
+                break;
+            case 0xAB:  // Program: [0xAB] [op] [args...]
+                if (engine_program(&cmd)) {
+                    action = ACTION_RESTART;
+                }
+                break;
+            case 0xAC:  // Connection profile: [0xAC] [0=auto, 1=low latency, 2=low power]
+                if (cmd.len >= 1 && cmd.arg[0] < CONN_PROFILE_COUNT) {
+                    conn_profile = cmd.arg[0];
+                    HOT_LOGI(TAG, "Conn profile set: %d", conn_profile);
+                }
+                break;
+            case 0xAD:  // Lens layout: [0xAD] [lens] [mode] [phase] [scale]
+                if (cmd.len >= 4 && cmd.arg[1] <= 1 &&
+                    lens_layout(cmd.arg[0], cmd.arg[1], cmd.arg[2], cmd.arg[3])) {
+                    lens_changed = 1;
+                    HOT_LOGI(TAG, "Lens %d: mode %d phase %d scale %d%%",
+                             cmd.arg[0], cmd.arg[1], cmd.arg[2], cmd.arg[3]);
+                }
+                break;
+            case 0xAE:  // Lens calibration: [0xAE] [op] [args...]
+                engine_calib(&cmd);
+                break;
+            case 0xAF:  // Strobe benchmark: [0xAF] [seconds per rate, 0 = abort]
+                if (cmd.len >= 1) {
+                    if (cmd.arg[0] == 0) {
+                        bench_abort();
+                    } else {
+                        sched_pending = 0;
+                        bench_start(cmd.arg[0]);
                     }
+                }
+                break;
+            case 0xB1: {  // Scheduled start: [0xB1] [t_us u64 LE], device time
+                int64_t t;
+                if (cmd.len < 8) {
                     break;
-                case 0xA6:  // Resume / restart session: [0xA6]
-                    override_active = 0;
-                    session_start_tick = xTaskGetTickCount();
-                    session_active = 1;
-                    session_ended = 0;
-                    ESP_LOGI(TAG, "Session restarted");
-                    break;
-                case 0xA7:  // Sleep immediately: [0xA7]
-                    ESP_LOGI(TAG, "BLE sleep command received");
-                    session_ended = 1;
-                    break;
-                default:
-                    ESP_LOGW(TAG, "Unknown command: 0x%02X", cmd);
+                }
+                memcpy(&t, cmd.arg, 8);
+                if (t - esp_timer_get_time() > SCHED_MAX_AHEAD_US) {
+                    ESP_LOGW(TAG, "Scheduled start too far ahead, ignored");
                     break;
+                }
+                sched_start_us = t;
+                action = ACTION_SCHEDULE;
+                break;
             }
-            } // end else (non-legacy)
+            case 0xB2:  // Event markers: [0xB2] [mask], bit per marker_kind_t
+                if (cmd.len >= 1) {
+                    marker_select(cmd.arg[0]);
+                    telem_update();
+                    HOT_LOGI(TAG, "Markers: mask 0x%02X", marker_mask);
+                }
+                break;
+            case 0xB3:  // Advertising: [0xB3] [policy] [fast window s, optional]
+                if (cmd.len >= 1 && cmd.arg[0] < ADV_POLICY_COUNT) {
+                    adv_configure(cmd.arg[0], cmd.len >= 2 ? cmd.arg[1] : adv_window_s);
+                    HOT_LOGI(TAG, "Adv policy %d, window %d s", adv_policy, adv_window_s);
+                }
+                break;
+            case 0xB4:  // Energy accounting: [0xB4] [op] [args...]
+                engine_energy(&cmd);
+                break;
+            case 0xB5:  // Pacing: [0xB5] [mode] [rate_min] [rate_max] [inhale %] [hz_low] [hz_high]
+                if (cmd.len >= 1 && cmd.arg[0] < PACE_MODE_COUNT) {
+                    pace_set(&cmd);
+                }
+                break;
+            case 0xB6:  // RR intervals: [0xB6] [rr ms u16 LE]...
+                pace_rr(&cmd);
+                break;
+            case 0xB7:  // Pacing feedback: [0xB7] [value u16 LE]
+                pace_value(&cmd);
+                break;
+            default:
+                ESP_LOGW(TAG, "Unknown command: 0x%02X", cmd.op);
+                break;
         }
-        break;
+    }
+    if (!changed) {
+        return;
+    }
 
-    case ESP_GATTS_CONNECT_EVT:
-        ESP_LOGI(TAG, "Client connected");
-        break;
+    // Publish the new snapshot in one step
+    if (memcmp(&next, params_get(), sizeof(next)) != 0) {
+        params_save_later(&next);
+    }
+    uint8_t inactive = params_active ^ 1;
+    params_buf[inactive] = next;
+    params_active = inactive;
 
-    case ESP_GATTS_DISCONNECT_EVT:
-        ESP_LOGI(TAG, "Client disconnected, restarting advertising");
-        esp_ble_gap_start_advertising(&adv_params);
-        break;
+    if (action != ACTION_NONE) {
+        bench_abort();
+        sched_pending = action == ACTION_SCHEDULE;
+    }
+    if (action == ACTION_OVERRIDE) {
+        TRACE(TRACE_SESSION, TRACE_SESSION_OVERRIDE, override_duty);
+        marker_push(MARKER_SESSION, TRACE_SESSION_OVERRIDE, esp_timer_get_time());
+        override_active = 1;
+        session_active = 0;
+        strobe_stop();
+        lens_setduty(override_duty);
+    } else if (action == ACTION_RESTART) {
+        session_restart();
+    } else if (action == ACTION_SCHEDULE) {
+        // Clear and idle; led_task starts the session when it falls due
+        int64_t ahead_ms = (sched_start_us - esp_timer_get_time()) / 1000;
+        if (ahead_ms < 0) ahead_ms = 0;
+        TRACE(TRACE_SESSION, TRACE_SESSION_SCHEDULED, ahead_ms > UINT16_MAX ? UINT16_MAX : ahead_ms);
+        ESP_LOGI(TAG, "Session starts in %lld ms", (long long)ahead_ms);
+        override_active = 0;
+        session_active = 0;
+        strobe_stop();
+        lens_setduty(0);
+    } else if (lens_changed && override_active) {
+        lens_setduty(override_duty);
+        lens_changed = 0;
+    }
+}
 
-    default:
-        break;
+//*********************************************************** */
+// BLE Handlers
+//*********************************************************** */
+// Transport hooks, called from the BLE host task
+static void ble_on_write(const uint8_t *data, uint16_t len)
+{
+    int64_t rx_us = esp_timer_get_time();
+
+#if EDGE_LOG_HOTPATH
+    ESP_LOGI(TAG, "BLE Write: %d bytes", len);
+    for (int i = 0; i < len; i++) {
+        ESP_LOGI(TAG, "Byte[%d]: 0x%02X", i, data[i]);
+    }
+#endif
+
+    __atomic_fetch_add(&ble_writes, 1, __ATOMIC_RELAXED);
+
+    // Clock sync pings are answered here, so the queue adds no delay
+    if (len == SYNC_PING_LEN && data[0] == CMD_PING) {
+        sync_ping(data[1], rx_us);
+        return;
+    }
+
+    // Hand the command(s) to led_task; they are applied there, not here
+    engine_cmd_t cmds[CMD_BATCH_MAX];
+    uint32_t n = cmd_parse(data, len, cmds, CMD_BATCH_MAX);
+    if (n == 0) {
+        ESP_LOGW(TAG, "Malformed command: 0x%02X", data[0]);
+    } else if (!cmd_push(cmds, n)) {
+        TRACE(TRACE_DROP, cmds[0].op, n);
+    } else {
+        engine_notify();
     }
 }
 
-static void gatts_event_handler(esp_gatts_cb_event_t event,
-                                esp_gatt_if_t gatts_if,
-                                esp_ble_gatts_cb_param_t *param)
+// Serve the report selected by the last 0xA8 query
+static int ble_on_read(uint16_t offset, uint8_t *out, uint16_t max)
 {
-    if (event == ESP_GATTS_REG_EVT) {
-        if (param->reg.status == ESP_GATT_OK) {
-            gatts_if = gatts_if;
-        } else {
-            ESP_LOGE(TAG, "Reg failed");
-            return;
+    return report_copy(offset, out, max);
+}
+
+static uint16_t ble_on_telem_read(uint8_t *out, uint16_t max)
+{
+    telem_status_t t;
+    telem_build(&t);
+    uint16_t n = sizeof(t) < max ? sizeof(t) : max;
+    memcpy(out, &t, n);
+    return n;
+}
+
+static void ble_on_subscribe(bool enabled)
+{
+    telem_subscribed = enabled;
+    telem_update();
+}
+
+static void ble_on_connect(void)
+{
+    telem_congested = 0;
+    conn_fresh = 1;
+    conn_up = 1;
+    engine_notify();
+}
+
+static void ble_on_disconnect(void)
+{
+    // The transport restarts advertising fast; the window starts over
+    adv_reset = 1;
+    conn_up = 0;
+    telem_subscribed = 0;
+    telem_update();
+    engine_notify();
+}
+
+static void ble_on_conn_params(uint16_t interval, uint16_t latency, uint16_t timeout)
+{
+    portENTER_CRITICAL(&conn_mux);
+    conn_interval = interval;
+    conn_latency = latency;
+    conn_timeout = timeout;
+    portEXIT_CRITICAL(&conn_mux);
+    ESP_LOGI(TAG, "Conn params: %u.%02u ms, latency %u, timeout %u ms",
+             interval * 125 / 100, interval * 125 % 100, latency, timeout * 10);
+}
+
+static void ble_on_congest(bool congested)
+{
+    telem_congested = congested;
+}
+
+static void ble_on_stage(ble_stage_t stage)
+{
+    switch (stage) {
+    case BLE_STAGE_CONTROLLER:
+        boot_mark(BOOT_BLE_CTRL);
+        break;
+    case BLE_STAGE_HOST:
+        boot_mark(BOOT_BLE_HOST);
+        break;
+    case BLE_STAGE_ADVERTISING:
+        if (boot_us[BOOT_ADV] == 0) {
+            boot_mark(BOOT_ADV);
+            ESP_LOGI(TAG, "Boot: first strobe %lu us, advertising %lu us",
+                     (unsigned long)boot_us[BOOT_FIRST_STROBE], (unsigned long)boot_us[BOOT_ADV]);
         }
+        break;
     }
-    gatts_profile_event_handler(event, gatts_if, param);
 }
 
+static const ble_transport_cb_t ble_cb = {
+    .on_write = ble_on_write,
+    .on_read = ble_on_read,
+    .on_telem_read = ble_on_telem_read,
+    .on_subscribe = ble_on_subscribe,
+    .on_connect = ble_on_connect,
+    .on_disconnect = ble_on_disconnect,
+    .on_congest = ble_on_congest,
+    .on_stage = ble_on_stage,
+    .on_conn_params = ble_on_conn_params,
+};
+
 //*********************************************************** */
 // LED Effect Task
 //*********************************************************** */
+// Program the envelope for a breathing phase lasting len_ticks from tick now
+// at the given brightness. Inhale/exhale are ramps between the first visible
+// level and full brightness, even in perceived opacity; holds are static
+// levels. Also used to retarget a phase in flight when the brightness
+// changes, with len_ticks being the time left.
+static void breath_envelope(uint8_t phase, uint32_t len_ticks, uint8_t level, uint32_t now)
+{
+    uint32_t floor = level ? 1 : 0;
+
+    switch (phase) {
+        case 0:  // Inhale: clear -> dark
+            if (lens_env_now(now) < floor) {
+                lens_setduty(floor);
+            }
+            lens_ramp_start(level, len_ticks, now);
+            break;
+        case 1:  // Hold in: dark
+            lens_setduty(level);
+            break;
+        case 2:  // Exhale: dark -> clear
+            lens_ramp_start(floor, len_ticks, now);
+            break;
+        case 3:  // Hold out: clear
+            lens_setduty(0);
+            break;
+    }
+}
+
+// Session engine outputs, called from led_task while it steps the engine
+static void session_ramp(void *ctx, uint32_t start_hz_q8, uint32_t end_hz_q8,
+                         uint32_t start_ms, uint32_t len_ms)
+{
+    strobe_set_ramp(start_hz_q8, end_hz_q8, session_start_us + (int64_t)start_ms * 1000,
+                    len_ms * 1000);
+}
+
+static void session_envelope(void *ctx, uint8_t phase, uint32_t len_ms, uint8_t level, bool start)
+{
+    lens_changed = 0;
+    breath_envelope(phase, len_ms / portTICK_PERIOD_MS, level, session_tick_now);
+    if (start) {
+        marker_push(MARKER_PHASE, phase, esp_timer_get_time());
+        TRACE(TRACE_PHASE, phase, len_ms / 10);
+        strobe_start();
+        boot_mark(BOOT_FIRST_STROBE);
+    }
+}
+
+static const session_sink_t session_sink = {
+    .ramp = session_ramp,
+    .envelope = session_envelope,
+};
+
 static void led_task(void *param)
 {
-    // Breathing state
-    uint8_t breath_phase = 0;  // 0=inhale, 1=hold_in, 2=exhale, 3=hold_out
-    uint32_t phase_start = xTaskGetTickCount();
-    float breath_brightness = 0.0f;
-    uint8_t strobe_state = 0;
-    
     while (1) {
-        // If BLE override is active, skip all logic
-        if (override_active) {
-            vTaskDelay(100 / portTICK_PERIOD_MS);
+        engine_apply_pending();
+        conn_policy();
+        adv_policy_run();
+        if (sched_pending && sched_start_us - esp_timer_get_time() <= SCHED_DUE_US) {
+            session_start_scheduled();
+        }
+        energy_enter(ENERGY_GROUP_ENGINE,
+                     (bench_state == BENCH_RUNNING || (session_active && !override_active)) ?
+                     ENERGY_SESSION : override_active ? ENERGY_OVERRIDE : ENERGY_IDLE,
+                     esp_timer_get_time());
+        const session_params_t *p = params_get();
+
+        // Benchmark runs instead of the session, and ends in the idle state
+        if (bench_state == BENCH_RUNNING) {
+            session_engine_stop(&session);
+            uint32_t wait = bench_poll(xTaskGetTickCount());
+            status_publish(TELEM_FLAG_RUNNING | adv_telem_flags(), session.phase, 100);
+            if (wait > 0) {
+                pm_idle();
+                ulTaskNotifyTake(pdTRUE, wait);
+                pm_busy();
+            }
             continue;
         }
         
-        // If session not active, idle
-        if (!session_active) {
-            vTaskDelay(100 / portTICK_PERIOD_MS);
+        // If BLE override is active or no session runs, sleep until a command,
+        // a scheduled start or the end of the fast advertising window
+        if (override_active || !session_active) {
+            strobe_stop();
+            session_engine_stop(&session);
+            status_publish((override_active ? TELEM_FLAG_OVERRIDE :
+                            sched_pending ? TELEM_FLAG_SCHEDULED : 0) | adv_telem_flags(),
+                           session.phase, p->brightness);
+            TickType_t idle_wait = sched_wait();
+            TickType_t adv_left = adv_wait();
+            if (idle_wait > adv_left) idle_wait = adv_left;
+            pm_idle();
+            ulTaskNotifyTake(pdTRUE, idle_wait);
+            pm_busy();
             continue;
         }
         
         uint32_t now = xTaskGetTickCount();
-        
-        // Calculate session progress (0.0 to 1.0)
-        uint32_t session_duration_ticks = session_minutes * 60 * 1000 / portTICK_PERIOD_MS;
-        uint32_t elapsed_ticks = now - session_start_tick;
-        float progress = (float)elapsed_ticks / (float)session_duration_ticks;
-        if (progress > 1.0f) progress = 1.0f;
-        
-        // Check if session is complete
-        if (elapsed_ticks >= session_duration_ticks) {
+        session_tick_now = now;
+        if (lens_changed) {
+            // Lens scales or response changed: retarget the rest of the ramp
+            session_engine_retarget(&session);
+        }
+
+        // Step the engine: new breath phase, retarget or strobe ramp
+        session_tick_t t;
+        if (!session_engine_tick(&session, now * portTICK_PERIOD_MS, p->brightness, &t)) {
             ESP_LOGI(TAG, "Session complete - entering sleep");
-            pwm1_setduty(0);
+            TRACE(TRACE_SESSION, TRACE_SESSION_COMPLETE, 0);
+            marker_push(MARKER_SESSION, TRACE_SESSION_COMPLETE, esp_timer_get_time());
+            strobe_stop();
+            lens_setduty(0);
             session_active = 0;
             session_ended = 1;
+            main_notify(MAIN_EVT_SESSION_END);
             continue;
         }
         
@@ -413,124 +3443,201 @@ static void led_task(void *param)
         static uint32_t last_log = 0;
         if (now - last_log >= (30000 / portTICK_PERIOD_MS)) {
             last_log = now;
-            float current_hz = start_hz + (end_hz - start_hz) * progress;
-            float current_hold_in = hold_in_end * progress / 10.0f;
-            float current_hold_out = hold_out_end * progress / 10.0f;
-            uint32_t remaining_s = (session_duration_ticks - elapsed_ticks) * portTICK_PERIOD_MS / 1000;
-            ESP_LOGI(TAG, "Progress: %.0f%% | Hz: %.1f | Breath: %.1f/%.1f/%.1f/%.1f | Remaining: %lus",
-                     progress * 100, current_hz,
-                     inhale_time/10.0f, current_hold_in,
-                     exhale_time/10.0f, current_hold_out,
+            uint32_t remaining_s = (session.total_ms - t.elapsed_ms) / 1000;
+            ESP_LOGI(TAG, "Progress: %lu%% | Hz: %.1f | Breath: %.1f/%.1f/%.1f/%.1f | Remaining: %lus",
+                     (unsigned long)((uint64_t)t.elapsed_ms * 100 / session.total_ms), t.st.hz_q8 / 256.0f,
+                     t.st.inhale/10.0f, t.st.hold_in/10.0f,
+                     t.st.exhale/10.0f, t.st.hold_out/10.0f,
                      (unsigned long)remaining_s);
         }
         
-        // Calculate current strobe frequency (linear interpolation)
-        float current_hz = start_hz + (end_hz - start_hz) * progress;
-        if (current_hz < 1.0f) current_hz = 1.0f;
-        uint32_t strobe_delay_ms = (uint32_t)(500.0f / current_hz);
-        
-        // Calculate current breathing hold times (linear from 0 to end)
-        uint8_t current_hold_in = (uint8_t)(hold_in_end * progress);
-        uint8_t current_hold_out = (uint8_t)(hold_out_end * progress);
-        
-        // Calculate breathing brightness
-        uint32_t phase_durations[4] = {
-            inhale_time * 100 / portTICK_PERIOD_MS,
-            current_hold_in * 100 / portTICK_PERIOD_MS,
-            exhale_time * 100 / portTICK_PERIOD_MS,
-            current_hold_out * 100 / portTICK_PERIOD_MS
-        };
-        
-        // Advance phase if current one is complete (or zero duration)
-        uint32_t breath_elapsed = now - phase_start;
-        uint8_t phase_checks = 0;
-        while (phase_checks < 4 && (phase_durations[breath_phase] == 0 || breath_elapsed >= phase_durations[breath_phase])) {
-            breath_phase = (breath_phase + 1) % 4;
-            phase_start = now;
-            breath_elapsed = 0;
-            phase_checks++;
-        }
-        
-        float bp = (float)breath_elapsed / (float)phase_durations[breath_phase];
-        if (bp > 1.0f) bp = 1.0f;
-        
-        switch (breath_phase) {
-            case 0: breath_brightness = bp * 100.0f; break;          // Inhale: 0->100
-            case 1: breath_brightness = 100.0f; break;               // Hold in: 100
-            case 2: breath_brightness = (1.0f - bp) * 100.0f; break; // Exhale: 100->0
-            case 3: breath_brightness = 0.0f; break;                 // Hold out: 0
-        }
-        
-        // Calculate final duty
-        uint8_t duty = (uint8_t)(breath_brightness * brightness / 100);
-        
-        // Apply strobe (75% duty: dark 3/4, clear 1/4)
-        uint32_t strobe_on_ms = strobe_delay_ms * 3 / 2;   // dark time (75% of full cycle)
-        uint32_t strobe_off_ms = strobe_delay_ms / 2;       // clear time (25% of full cycle)
-        
-        // Dark phase
-        pwm1_setduty(duty);
-        vTaskDelay(strobe_on_ms / portTICK_PERIOD_MS);
-        
-        // Clear phase
-        pwm1_setduty(0);
-        vTaskDelay(strobe_off_ms / portTICK_PERIOD_MS);
+        status_publish(TELEM_FLAG_SESSION | TELEM_FLAG_RUNNING | adv_telem_flags() |
+                       pace_telem_flags(), session.phase, t.level);
+
+        // Sleep until the phase, program piece or session ends, the next
+        // sub-fade, the next progress log, the end of the fast advertising
+        // window or a BLE command; the LEDC fade and strobe ISR run meanwhile
+        uint32_t wait = t.wait_ms / portTICK_PERIOD_MS;
+        uint32_t ramp_left = lens_ramp_poll(now);
+        uint32_t log_left = (30000 / portTICK_PERIOD_MS) - (now - last_log);
+        uint32_t adv_left = adv_wait();
+        if (wait > ramp_left) wait = ramp_left;
+        if (wait > log_left) wait = log_left;
+        if (wait > adv_left) wait = adv_left;
+        if (wait == 0) wait = 1;
+        pm_idle();
+        ulTaskNotifyTake(pdTRUE, wait);
+        pm_busy();
     }
 }
 
 //*********************************************************** */
 // Sleep Functions
 //*********************************************************** */
+// Awake, the Hall pin raises a GPIO interrupt when it changes and the
+// app_main task waits for events instead of polling. The interrupt is
+// level-triggered on the opposite of the last level read, since edges are
+// not seen in light sleep; the same level wakes light sleep, and the ISR
+// masks it until the task has read the pin and re-armed it. While the arms are closed it
+// waits with a SLEEP_HALL_WAIT_TIME timeout, a debounce that only runs while
+// closed: opening them in that time cancels it, so the task is idle and
+// never wakes while the arms are open.
+//
+// In deep sleep the pin is watched by the ULP coprocessor, when enabled: it
+// samples the pin every HALL_ULP_PERIOD_US and wakes the chip only after
+// HALL_ULP_OPEN_SAMPLES "open" reads in a row, so closed arms and short
+// bounces never boot the main cores. Without the ULP, an EXT0 wake on the
+// pin and a check at boot (app_main) do the same job.
+#if CONFIG_ULP_COPROC_ENABLED
+#define HALL_ULP_PERIOD_US      50000
+#define HALL_ULP_OPEN_SAMPLES   2
+#define HALL_ULP_COUNT_WORD     (CONFIG_ULP_COPROC_RESERVE_MEM / 4 - 1)   // Last reserved word
+
+// Load the Hall watch program and make it the deep sleep wake source
+static void hall_ulp_start(void)
+{
+    const uint32_t bit = RTC_GPIO_IN_NEXT_S + rtc_io_number_get(HALL_PIN);
+    const ulp_insn_t program[] = {
+        I_MOVI(R3, HALL_ULP_COUNT_WORD),
+        I_LD(R1, R3, 0),                        // R1 = open samples so far
+        I_RD_REG(RTC_GPIO_IN_REG, bit, bit),    // R0 = Hall level, 1 = closed
+        M_BGE(1, 1),
+        I_ADDI(R1, R1, 1),                      // Open: count it
+        I_ST(R1, R3, 0),
+        I_MOVR(R0, R1),
+        M_BL(2, HALL_ULP_OPEN_SAMPLES),
+        I_WAKE(),
+        I_END(),                                // Stop the ULP timer
+        I_HALT(),
+        M_LABEL(1),
+        I_MOVI(R1, 0),                          // Closed: start over
+        I_ST(R1, R3, 0),
+        M_LABEL(2),
+        I_HALT(),
+    };
+    RTC_SLOW_MEM[HALL_ULP_COUNT_WORD] = 0;
+    size_t size = sizeof(program) / sizeof(ulp_insn_t);
+    ESP_ERROR_CHECK(ulp_process_macros_and_load(0, program, &size));
+
+    // The pin and its pull-up stay in the RTC domain during sleep
+    rtc_gpio_init(HALL_PIN);
+    rtc_gpio_set_direction(HALL_PIN, RTC_GPIO_MODE_INPUT_ONLY);
+    rtc_gpio_pullup_en(HALL_PIN);
+    rtc_gpio_pulldown_dis(HALL_PIN);
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+
+    ESP_ERROR_CHECK(ulp_set_wakeup_period(0, HALL_ULP_PERIOD_US));
+    ESP_ERROR_CHECK(esp_sleep_enable_ulp_wakeup());
+    ESP_ERROR_CHECK(ulp_run(0));
+}
+#endif
+
 static void enter_deep_sleep(void)
 {
     ESP_LOGI(TAG, "Entering deep sleep...");
+    params_flush();
     
     // Zero PWM output before sleep
-    ledc_set_duty(PWM1_MODE, PWM1_CHANNEL, 0);
-    ledc_update_duty(PWM1_MODE, PWM1_CHANNEL);
+    strobe_stop();
+    lens_setduty(0);
     
-    // Configure wake source and sleep - same as original
+    // Configure wake source and sleep
+    gpio_intr_disable(HALL_PIN);
+    gpio_wakeup_disable(HALL_PIN);
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_GPIO);    // Light sleep only
+#if CONFIG_ULP_COPROC_ENABLED
+    hall_ulp_start();
+#else
     esp_sleep_enable_ext0_wakeup(HALL_PIN, 0);
+#endif
+    energy_sleep();
     esp_deep_sleep_start();
 }
 
-static void check_sleep_condition(void)
+static void IRAM_ATTR hall_isr(void *arg)
 {
-    static uint32_t arms_closed_duration = 0;
-    static uint32_t last_check_time = 0;
-    uint32_t current_time = xTaskGetTickCount();
-    
-    if (current_time - last_check_time < (1000 / portTICK_PERIOD_MS)) {
-        return;
-    }
-    last_check_time = current_time;
-    
-    // Session ended - go to sleep
-    if (session_ended) {
-        enter_deep_sleep();
-    }
-    
-    // Hall sensor closed for SLEEP_HALL_WAIT_TIME seconds
-    if (gpio_get_level(HALL_PIN) == 1) {
-        arms_closed_duration++;
-        if (arms_closed_duration >= SLEEP_HALL_WAIT_TIME) {
-            enter_deep_sleep();
+    BaseType_t woken = pdFALSE;
+    gpio_intr_disable(HALL_PIN);    // Level stays until hall_arm flips it
+    xTaskNotifyFromISR(main_task_handle, MAIN_EVT_HALL, eSetBits, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+// Interrupt (and wake light sleep) on the next change from closed/open
+static void hall_arm(uint8_t closed)
+{
+    gpio_wakeup_enable(HALL_PIN, closed ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    gpio_intr_enable(HALL_PIN);
+}
+
+// Hall changes interrupt the app_main task (call from it, pin configured)
+static void hall_init(void)
+{
+    main_task_handle = xTaskGetCurrentTaskHandle();
+    ESP_ERROR_CHECK(gpio_install_isr_service(0));
+    ESP_ERROR_CHECK(gpio_isr_handler_add(HALL_PIN, hall_isr, NULL));
+    main_notify(MAIN_EVT_HALL);     // Pick up the level it starts at
+}
+
+// Block until there is work for the app_main task and return its
+// MAIN_EVT_* bits. Goes to sleep from here once the arms have stayed
+// closed for SLEEP_HALL_WAIT_TIME.
+static uint32_t main_wait(void)
+{
+    static uint8_t closed = 0;
+    static TickType_t closed_at = 0;
+    const TickType_t hold = SLEEP_HALL_WAIT_TIME * 1000 / portTICK_PERIOD_MS;
+
+    while (1) {
+        TickType_t wait = portMAX_DELAY;
+        if (closed) {
+            TickType_t held = xTaskGetTickCount() - closed_at;
+            if (held >= hold) {
+                TRACE(TRACE_SLEEP, TRACE_SLEEP_HALL, SLEEP_HALL_WAIT_TIME);
+                enter_deep_sleep();
+            }
+            wait = hold - held;
+        }
+
+        uint32_t evt = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &evt, wait);
+        if (evt & MAIN_EVT_HALL) {
+            uint8_t level = gpio_get_level(HALL_PIN);
+            if (level && !closed) {
+                closed_at = xTaskGetTickCount();
+            }
+            closed = level;
+            hall_arm(closed);
+        }
+        evt &= ~MAIN_EVT_HALL;
+        if (evt) {
+            return evt;
         }
-    } else {
-        arms_closed_duration = 0;
     }
 }
 
 //*********************************************************** */
 // Main
 //*********************************************************** */
+// Bring up the BLE stack (see ble_transport.h). Runs after the engine is
+// already strobing, below led_task's priority, then exits; advertising
+// is started by the transport once the host is up.
+static void ble_start_task(void *param)
+{
+    esp_err_t ret = ble_transport_start(&ble_cb);
+    if (ret) { ESP_LOGE(TAG, "BLE start fail: %s", esp_err_to_name(ret)); }
+    vTaskDelete(NULL);
+}
+
 void app_main(void)
 {
     esp_err_t ret;
+    boot_mark(BOOT_APP_MAIN);
 
     // Check Hall sensor ONLY after deep sleep wake (not cold boot/power-on)
     // On cold boot, always proceed to full initialization
     esp_sleep_wakeup_cause_t wakeup_reason = esp_sleep_get_wakeup_cause();
+    trace_init();
+    energy_init();
     if (wakeup_reason == ESP_SLEEP_WAKEUP_EXT0 || wakeup_reason == ESP_SLEEP_WAKEUP_TIMER) {
         gpio_config_t hall_conf = {
             .pin_bit_mask = 1ULL << HALL_PIN,
@@ -545,8 +3652,10 @@ void app_main(void)
         
         if (gpio_get_level(HALL_PIN) == 1) {
             // Arms still closed - go back to sleep
+            TRACE(TRACE_SLEEP, TRACE_SLEEP_RESLEEP, 0);
             esp_sleep_enable_timer_wakeup(1000000);
             esp_sleep_enable_ext0_wakeup(HALL_PIN, 0);
+            energy_resleep();
             esp_deep_sleep_start();
         }
     }
@@ -562,27 +3671,14 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
     ESP_LOGI(TAG, "NVS OK");
-
-    // Initialize BLE
-    ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
-    esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
-    ret = esp_bt_controller_init(&bt_cfg);
-    if (ret) { ESP_LOGE(TAG, "BT ctrl init fail: %s", esp_err_to_name(ret)); }
-    ret = esp_bt_controller_enable(ESP_BT_MODE_BLE);
-    if (ret) { ESP_LOGE(TAG, "BT ctrl enable fail: %s", esp_err_to_name(ret)); }
-    ret = esp_bluedroid_init();
-    if (ret) { ESP_LOGE(TAG, "Bluedroid init fail: %s", esp_err_to_name(ret)); }
-    ret = esp_bluedroid_enable();
-    if (ret) { ESP_LOGE(TAG, "Bluedroid enable fail: %s", esp_err_to_name(ret)); }
-    ESP_LOGI(TAG, "BLE stack OK");
-    ESP_ERROR_CHECK(esp_ble_gap_register_callback(gap_event_handler));
-    ESP_ERROR_CHECK(esp_ble_gatts_register_callback(gatts_event_handler));
-    ESP_ERROR_CHECK(esp_ble_gatts_app_register(TEST_APP_ID));
-
-    // Reduce BLE TX power
-    esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_DEFAULT, ESP_PWR_LVL_N12);
-    esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_ADV, ESP_PWR_LVL_N12);
-    esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_CONN_HDL0, ESP_PWR_LVL_N12);
+    params_load();
+    adv_load();
+    energy_load();
+    prog_load();
+    session_engine_init(&session, &session_sink);
+    pace_configure(&pace, &(pace_cfg_t)PACE_CFG_DEFAULT);
+    lut_load();
+    boot_mark(BOOT_NVS);
 
     // Initialize Hall sensor GPIO
     gpio_config_t io_conf = {
@@ -593,31 +3689,55 @@ void app_main(void)
         .intr_type = GPIO_INTR_DISABLE,
     };
     gpio_config(&io_conf);
+    hall_init();
+
+    // Clocks and sleep first: the LEDC clock source depends on it
+    pm_init();
 
-    // Initialize PWM
+    // Initialize PWM, strobe and telemetry timers
     PWM_Init();
+    strobe_init();
+    telem_init();
 
     // Start session immediately on boot
-    session_start_tick = xTaskGetTickCount();
-    session_active = 1;
-    session_ended = 0;
+    session_restart();
+    boot_mark(BOOT_ENGINE);
 
-    // Create LED task
-    xTaskCreate(led_task, "led_task", 4096, NULL, 1, NULL);
+    // Lens engine first, BLE behind it
+    xTaskCreatePinnedToCore(led_task, "led_task", LED_TASK_STACK, NULL, LED_TASK_PRIO,
+                            &led_task_handle, LED_TASK_CORE);
+    xTaskCreatePinnedToCore(ble_start_task, "ble_start", BLE_START_TASK_STACK, NULL,
+                            BLE_START_TASK_PRIO, NULL, HOUSEKEEPING_CORE);
 
     ESP_LOGI(TAG, "============================================");
     ESP_LOGI(TAG, "Smart Glasses v4.0");
-    ESP_LOGI(TAG, "BLE Name: %s", DEVICE_NAME);
-    ESP_LOGI(TAG, "Session: %d min | Strobe: %d->%d Hz", session_minutes, start_hz, end_hz);
+    ESP_LOGI(TAG, "BLE Name: %s", BLE_DEVICE_NAME);
+    const session_params_t *p = params_get();
+    ESP_LOGI(TAG, "Session: %d min | Strobe: %d->%d Hz", p->session_minutes, p->start_hz, p->end_hz);
     ESP_LOGI(TAG, "Breathing: %.1f/0->%.1f/%.1f/0->%.1f",
-             inhale_time/10.0f, hold_in_end/10.0f,
-             exhale_time/10.0f, hold_out_end/10.0f);
+             p->inhale_time/10.0f, p->hold_in_end/10.0f,
+             p->exhale_time/10.0f, p->hold_out_end/10.0f);
+    if (prog_use_stored) {
+        ESP_LOGI(TAG, "Program: %d segments, %lus", session.prog.count,
+                 (unsigned long)(session.total_ms / 1000));
+    }
+#if CONFIG_PM_ENABLE
+    ESP_LOGI(TAG, "CPU: %d-%dMHz (PM) | PWM1 only | BLE: -12dBm", PM_CPU_MIN_MHZ, PM_CPU_MAX_MHZ);
+#else
     ESP_LOGI(TAG, "CPU: 80MHz | PWM1 only | BLE: -12dBm");
+#endif
     ESP_LOGI(TAG, "============================================");
 
-    // Main loop
+    // Main loop: sleep decisions and slow work, event driven
     while (1) {
-        check_sleep_condition();
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
+        uint32_t evt = main_wait();
+        // A restart queued behind the sleep command clears session_ended
+        if ((evt & MAIN_EVT_SESSION_END) && session_ended) {
+            TRACE(TRACE_SLEEP, TRACE_SLEEP_SESSION_END, 0);
+            enter_deep_sleep();
+        }
+        if (evt & MAIN_EVT_TRACE_DUMP) {
+            trace_dump_uart();
+        }
     }
 }
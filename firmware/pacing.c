@@ -0,0 +1,235 @@
+/**
+ * Biofeedback pacing: beat filter, breath-locked lock-in and rate search
+ *
+ * Pure C on purpose - see pacing.h. Heart rate is carried in bpm Q8,
+ * sines in Q15 and shares (coherence, feedback) in Q16.
+ */
+#include <string.h>
+#include "pacing.h"
+
+// sin of a in Q16 turns, Q15. Parabola with one correction step, within
+// 0.1% - plenty for a lock-in.
+static int32_t pace_sin_q15(uint32_t a)
+{
+    a &= 0xFFFF;
+    int32_t neg = a >= 0x8000;
+    int32_t x = (int32_t)(a & 0x7FFF);             // 0..pi in Q15 half turns
+    int32_t y = (int32_t)(((int64_t)x * (0x8000 - x)) >> 13);
+    y += (225 * (((y * (int64_t)y) >> 15) - y)) / 1000;
+    return neg ? -y : y;
+}
+
+static uint32_t pace_isqrt(uint64_t v)
+{
+    uint64_t r = 0;
+    uint64_t bit = 1ULL << 62;
+    while (bit > v) bit >>= 2;
+    while (bit) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)r;
+}
+
+uint8_t pace_rate(const pace_t *pc, uint8_t k)
+{
+    int32_t r = pc->cfg.rate_max - (int32_t)k * pc->rate_step;
+    return (uint8_t)(r < pc->cfg.rate_min ? pc->cfg.rate_min : r);
+}
+
+static void pace_dwell_reset(pace_t *pc)
+{
+    pc->dwell_ms = 0;
+    pc->n = 0;
+    pc->sx = pc->sxx = pc->sxc = pc->sxs = pc->sc = pc->ss = 0;
+}
+
+void pace_configure(pace_t *pc, const pace_cfg_t *cfg)
+{
+    memset(pc, 0, sizeof(*pc));
+    pc->cfg = *cfg;
+    pace_cfg_t *c = &pc->cfg;
+    if (c->mode >= PACE_MODE_COUNT) c->mode = PACE_OFF;
+    if (c->rate_min < PACE_RATE_MIN) c->rate_min = PACE_RATE_MIN;
+    if (c->rate_max > PACE_RATE_MAX) c->rate_max = PACE_RATE_MAX;
+    if (c->rate_max < c->rate_min) c->rate_max = c->rate_min;
+    if (c->inhale_pct < 10) c->inhale_pct = 10;
+    if (c->inhale_pct > 90) c->inhale_pct = 90;
+    if (c->hz_low > 50) c->hz_low = 50;
+    if (c->hz_high > 50) c->hz_high = 50;
+
+    uint32_t span = c->rate_max - c->rate_min;
+    pc->rate_step = PACE_RATE_STEP;
+    if (span > (uint32_t)PACE_RATE_STEP * (PACE_RATES_MAX - 1)) {
+        pc->rate_step = (uint8_t)((span + PACE_RATES_MAX - 2) / (PACE_RATES_MAX - 1));
+    }
+    pc->rate_count = (uint8_t)((span + pc->rate_step - 1) / pc->rate_step + 1);
+    pc->dir = 1;
+    pc->search = c->mode == PACE_RR ? PACE_SCAN : PACE_IDLE;
+}
+
+// Drop artifacts (missed or extra beats) against the running mean
+static bool pace_beat_ok(pace_t *pc, uint16_t rr_ms)
+{
+    if (rr_ms < PACE_RR_MIN_MS || rr_ms > PACE_RR_MAX_MS) {
+        return false;
+    }
+    uint32_t rr_q4 = (uint32_t)rr_ms << 4;
+    if (pc->rr_mean_q4 == 0 || pc->rejects >= PACE_REJECT_RESET) {
+        pc->rr_mean_q4 = rr_q4;
+        return true;
+    }
+    uint32_t lim = pc->rr_mean_q4 * PACE_RR_JUMP_PCT / 100;
+    if (rr_q4 + lim < pc->rr_mean_q4 || rr_q4 > pc->rr_mean_q4 + lim) {
+        return false;
+    }
+    pc->rr_mean_q4 += ((int32_t)rr_q4 - (int32_t)pc->rr_mean_q4) / 8;
+    return true;
+}
+
+// Close a dwell at rate k: swing and coherence, then pick the next rate
+static void pace_dwell_end(pace_t *pc)
+{
+    int64_t n = pc->n;
+    int64_t mean = pc->sx / n;
+    // Remove the mean from the products (beats need not cover the cycle evenly)
+    int64_t i = (pc->sxc - mean * pc->sc) / 32768;
+    int64_t q = (pc->sxs - mean * pc->ss) / 32768;
+    uint32_t amp = (uint32_t)(2 * (int64_t)pace_isqrt((uint64_t)(i * i + q * q)) / n);
+    int64_t var = pc->sxx / n - mean * mean;
+    uint32_t coh = 0;
+    if (var > 0) {
+        int64_t c = ((int64_t)amp * amp / 2) * PACE_Q16 / var;
+        coh = c > PACE_Q16 ? PACE_Q16 : (uint32_t)c;
+    }
+    if (amp > UINT16_MAX) amp = UINT16_MAX;
+    if (amp == 0) amp = 1;                  // 0 means not measured
+    pc->amp_last_q8 = (uint16_t)amp;
+    pc->coherence_q16 = coh;
+    pc->feedback_q16 = (pc->feedback_q16 + coh) / 2;
+
+    uint16_t *a = &pc->amp_q8[pc->k];
+    *a = *a ? (uint16_t)((*a + amp) / 2) : (uint16_t)amp;
+
+    if (pc->search == PACE_SCAN) {
+        if (++pc->k < pc->rate_count) {
+            return;
+        }
+        pc->best = 0;
+        for (uint8_t j = 1; j < pc->rate_count; j++) {
+            if (pc->amp_q8[j] > pc->amp_q8[pc->best]) pc->best = j;
+        }
+        pc->k = pc->best;
+        pc->search = PACE_TRACK;
+    } else if (pc->k == pc->best) {
+        // Probe one side, the other side next time
+        int32_t probe = pc->best + pc->dir;
+        if (probe < 0 || probe >= pc->rate_count) {
+            pc->dir = (int8_t)-pc->dir;
+            probe = pc->best + pc->dir;
+        }
+        if (probe >= 0 && probe < pc->rate_count) {
+            pc->k = (uint8_t)probe;
+        }
+        pc->dir = (int8_t)-pc->dir;
+    } else {
+        if (pc->amp_q8[pc->k] > pc->amp_q8[pc->best]) pc->best = pc->k;
+        pc->k = pc->best;
+    }
+}
+
+bool pace_beat(pace_t *pc, uint16_t rr_ms, uint32_t cycle_q16)
+{
+    if (pc->cfg.mode != PACE_RR) {
+        return false;
+    }
+    uint32_t cycle_ms = 600000u / pace_rate(pc, pc->k);
+    uint32_t settle_ms = PACE_SETTLE_BREATHS * cycle_ms;
+    pc->dwell_ms += rr_ms;
+
+    if (!pace_beat_ok(pc, rr_ms)) {
+        pc->rejected++;
+        pc->rejects++;
+        return false;
+    }
+    pc->accepted++;
+    pc->rejects = 0;
+    pc->hr_q8 = (uint16_t)(60000u * 256 / rr_ms);
+    if (pc->dwell_ms <= settle_ms) {
+        return false;
+    }
+
+    int64_t x = pc->hr_q8;
+    int32_t c = pace_sin_q15(cycle_q16 + PACE_Q16 / 4);
+    int32_t s = pace_sin_q15(cycle_q16);
+    pc->n++;
+    pc->sx += x;
+    pc->sxx += x * x;
+    pc->sxc += x * c;
+    pc->sxs += x * s;
+    pc->sc += c;
+    pc->ss += s;
+    if (pc->dwell_ms < settle_ms + PACE_DWELL_BREATHS * cycle_ms) {
+        return false;
+    }
+
+    uint8_t k = pc->k;
+    uint32_t feedback = pc->feedback_q16;
+    if (pc->n >= PACE_MIN_BEATS) {
+        pace_dwell_end(pc);
+    }
+    pace_dwell_reset(pc);
+    if (pc->k != k) {
+        // The new rate starts at the next breath phase; settle from here
+        return true;
+    }
+    return pc->feedback_q16 != feedback;
+}
+
+bool pace_scalar(pace_t *pc, uint16_t value)
+{
+    if (pc->cfg.mode != PACE_SCALAR) {
+        return false;
+    }
+    uint32_t v = value == UINT16_MAX ? PACE_Q16 : value;
+    uint32_t feedback = pc->feedback_q16;
+    pc->feedback_q16 = (uint32_t)((int32_t)feedback + ((int32_t)v - (int32_t)feedback) / 4);
+    return pc->feedback_q16 != feedback;
+}
+
+uint8_t pace_output(const pace_t *pc, session_pace_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    if (pc->cfg.mode == PACE_OFF) {
+        return 0;
+    }
+    const pace_cfg_t *c = &pc->cfg;
+    uint32_t fb = pc->feedback_q16;
+    uint32_t rate;
+    if (c->mode == PACE_RR) {
+        rate = pace_rate(pc, pc->k);
+    } else {
+        rate = c->rate_max - (((uint32_t)(c->rate_max - c->rate_min) * fb) >> 16);
+    }
+
+    // Cycle in 0.1 s, split into inhale and exhale
+    uint32_t cycle = (6000 + rate / 2) / rate;
+    uint32_t inhale = (cycle * c->inhale_pct + 50) / 100;
+    if (inhale < 1) inhale = 1;
+    if (inhale >= cycle) inhale = cycle - 1;
+    out->active = true;
+    out->inhale = (uint8_t)inhale;
+    out->exhale = (uint8_t)(cycle - inhale);
+
+    if (c->hz_low && c->hz_high) {
+        int32_t lo = (int32_t)c->hz_low << 8;
+        int32_t hi = (int32_t)c->hz_high << 8;
+        out->hz_q8 = (uint32_t)(lo + (int32_t)(((int64_t)(hi - lo) * fb) >> 16));
+    }
+    return (uint8_t)rate;
+}
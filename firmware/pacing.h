@@ -0,0 +1,110 @@
+/**
+ * Biofeedback pacing: breathing rate and strobe from streamed heart beats
+ *
+ * Pure C like session_engine.h, so it can be stepped off target too.
+ * led_task feeds it beats (or a feedback value) and hands pace_output() to
+ * session_engine_pace(), which replaces the program's breathing and
+ * strobe frequency while a mode is set.
+ *
+ * PACE_RR looks for the resonance rate: the breathing rate at which heart
+ * rate swings most with the breath, usually 4.5-7 breaths/min. Each beat's
+ * heart rate is correlated with the device's own breath cycle at the time
+ * of the beat (a lock-in at the pacing frequency). Over PACE_DWELL_BREATHS
+ * whole cycles that gives the amplitude of the breath-locked swing, and
+ * the share of the heart rate variance it explains (coherence, 0-1). The
+ * pacer dwells at each rate from rate_max down to rate_min, settles on the
+ * best one, then keeps probing its neighbours and moves when one does
+ * better. Beats arrive after the fact and a constant report delay only
+ * turns the lock-in phase, not the amplitude.
+ *
+ * PACE_SCALAR takes a feedback value 0-1 worked out elsewhere instead,
+ * smoothed, and breathes from rate_max at 0 down to rate_min at 1.
+ *
+ * In both modes the strobe follows the feedback (coherence in PACE_RR)
+ * from hz_low at 0 to hz_high at 1, if both are set.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "session_engine.h"
+
+#define PACE_RATE_MIN         30          // Breaths/min x0.1, config bounds
+#define PACE_RATE_MAX         200
+#define PACE_RATE_STEP        5           // Search step, 0.5 breaths/min
+#define PACE_RATES_MAX        12          // Rates searched, step widens to fit
+#define PACE_SETTLE_BREATHS   1           // Not measured after a rate change
+#define PACE_DWELL_BREATHS    4           // Measured per rate
+#define PACE_MIN_BEATS        16          // Fewer in a dwell: measure it again
+#define PACE_RR_MIN_MS        300         // 200 bpm
+#define PACE_RR_MAX_MS        2000        // 30 bpm
+#define PACE_RR_JUMP_PCT      25          // Off the running mean by more: artifact
+#define PACE_REJECT_RESET     5           // Rejected in a row: take the new level
+#define PACE_Q16              65536u
+
+typedef enum {
+    PACE_OFF = 0,
+    PACE_RR = 1,                 // RR intervals, resonance search
+    PACE_SCALAR = 2,             // Feedback value from the host
+    PACE_MODE_COUNT,
+} pace_mode_t;
+
+typedef enum {
+    PACE_IDLE = 0,
+    PACE_SCAN,                   // First pass over the rates
+    PACE_TRACK,                  // At the best rate, probing neighbours
+} pace_search_t;
+
+typedef struct {
+    uint8_t mode;                // pace_mode_t
+    uint8_t rate_min;            // Breaths/min x0.1
+    uint8_t rate_max;
+    uint8_t inhale_pct;          // Inhale share of the cycle, 10-90
+    uint8_t hz_low;              // Strobe Hz at feedback 0, 0 = the program's
+    uint8_t hz_high;             // At feedback 1
+} pace_cfg_t;
+
+// Defaults: 4.5-7 breaths/min, 40% inhale, program strobe
+#define PACE_CFG_DEFAULT { .mode = PACE_OFF, .rate_min = 45, .rate_max = 70, \
+                           .inhale_pct = 40, .hz_low = 0, .hz_high = 0 }
+
+typedef struct {
+    pace_cfg_t cfg;
+    uint8_t search;              // pace_search_t
+    uint8_t rate_count;
+    uint8_t rate_step;           // x0.1 breaths/min
+    uint8_t k;                   // Rate running, index from rate_max down
+    uint8_t best;
+    int8_t dir;                  // Next probe from best
+    uint16_t amp_q8[PACE_RATES_MAX];   // Breath-locked swing per rate (bpm Q8), 0 = not yet
+    // Beat filter
+    uint32_t rr_mean_q4;         // ms x16, 0 = no beat yet
+    uint8_t rejects;             // In a row
+    uint32_t accepted, rejected;
+    // Dwell at rate k: time into it, and lock-in sums over the measured part
+    uint32_t dwell_ms;
+    uint32_t n;
+    int64_t sx, sxx, sxc, sxs, sc, ss;
+    // Results
+    uint16_t hr_q8;              // Last accepted beat, bpm Q8
+    uint16_t amp_last_q8;        // Last dwell
+    uint32_t coherence_q16;      // Last dwell, 0-PACE_Q16
+    uint32_t feedback_q16;       // Drives rate (scalar) and strobe, 0-PACE_Q16
+} pace_t;
+
+// Set the mode and bounds (clamped) and start over
+void pace_configure(pace_t *pc, const pace_cfg_t *cfg);
+
+// One RR interval, with the breath cycle position (Q16) at the beat.
+// Returns true when the output has changed.
+bool pace_beat(pace_t *pc, uint16_t rr_ms, uint32_t cycle_q16);
+
+// One feedback value, 0-65535 for 0-1. Returns true when the output changed.
+bool pace_scalar(pace_t *pc, uint16_t value);
+
+// Breathing rate in use, breaths/min x0.1
+uint8_t pace_rate(const pace_t *pc, uint8_t k);
+
+// Breathing and strobe for the session engine. Returns the breathing rate
+// used (breaths/min x0.1), 0 when off.
+uint8_t pace_output(const pace_t *pc, session_pace_t *out);
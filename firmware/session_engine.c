@@ -0,0 +1,256 @@
+/**
+ * Session engine: program compile/evaluate and the breath phase state machine
+ *
+ * Pure C on purpose - see session_engine.h. All times are in ms of the
+ * caller's clock; differences are taken modulo 2^32, so the clock may wrap.
+ */
+#include <string.h>
+#include "session_engine.h"
+
+// Easing curve on x in Q16 (0..PROG_Q16)
+static uint32_t prog_ease(uint8_t ease, uint32_t x)
+{
+    switch (ease) {
+        case PROG_EASE_IN:
+            return (uint32_t)(((uint64_t)x * x) >> 16);
+        case PROG_EASE_OUT: {
+            uint32_t r = PROG_Q16 - x;
+            return PROG_Q16 - (uint32_t)(((uint64_t)r * r) >> 16);
+        }
+        case PROG_EASE_IN_OUT:   // x^2 (3 - 2x)
+            return (uint32_t)(((((uint64_t)x * x) >> 16) * (3 * PROG_Q16 - 2 * x)) >> 16);
+        default:
+            return x;
+    }
+}
+
+// a + (b - a) * u for u in Q16
+static inline uint32_t prog_lerp(uint32_t a, uint32_t b, uint32_t u)
+{
+    return (uint32_t)((int64_t)a + ((((int64_t)b - (int64_t)a) * u) >> 16));
+}
+
+// Build the piece table for se->prog
+static void prog_compile(session_engine_t *se)
+{
+    uint32_t t = 0;
+    uint32_t n = 0;
+    for (uint8_t i = 0; i < se->prog.count; i++) {
+        const prog_seg_t *s = &se->prog.seg[i];
+        uint32_t len = (uint32_t)s->duration_s * 1000;
+        uint32_t k = (s->easing == PROG_EASE_LINEAR) ? 1 : PROG_EASE_PIECES;
+        for (uint32_t j = 0; j < k; j++) {
+            prog_piece_t *pc = &se->pieces[n++];
+            uint32_t a = len * j / k;
+            uint32_t b = len * (j + 1) / k;
+            pc->t_start_ms = t + a;
+            pc->len_ms = b - a;
+            pc->u0 = prog_ease(s->easing, PROG_Q16 * j / k);
+            pc->u1 = prog_ease(s->easing, PROG_Q16 * (j + 1) / k);
+            pc->seg = i;
+        }
+        t += len;
+    }
+    se->piece_count = n;
+    se->total_ms = t;
+    se->cursor = 0;
+}
+
+// Hand one piece to the sink as a linear strobe ramp
+static void prog_ramp(session_engine_t *se, uint32_t piece)
+{
+    const prog_piece_t *pc = &se->pieces[piece];
+    const prog_seg_t *s = &se->prog.seg[pc->seg];
+    se->sink->ramp(se->sink->ctx,
+                   prog_lerp(s->start_hz_q8, s->end_hz_q8, pc->u0),
+                   prog_lerp(s->start_hz_q8, s->end_hz_q8, pc->u1),
+                   pc->t_start_ms, pc->len_ms);
+    se->ramp_piece = piece;
+}
+
+// Program state t_ms into the session. The cursor only moves forward, so
+// this is O(1) per call; crossing into a new piece also moves the strobe
+// ramp on.
+static void prog_eval(session_engine_t *se, uint32_t t_ms, prog_state_t *st)
+{
+    if (se->cursor >= se->piece_count || t_ms < se->pieces[se->cursor].t_start_ms) {
+        se->cursor = 0;
+    }
+    while (se->cursor + 1 < se->piece_count &&
+           t_ms >= se->pieces[se->cursor].t_start_ms + se->pieces[se->cursor].len_ms) {
+        se->cursor++;
+    }
+    if (se->cursor != se->ramp_piece && !se->pace_hz_q8) {
+        prog_ramp(se, se->cursor);
+    }
+
+    const prog_piece_t *pc = &se->pieces[se->cursor];
+    const prog_seg_t *s = &se->prog.seg[pc->seg];
+    uint32_t dt = t_ms - pc->t_start_ms;
+    if (dt > pc->len_ms) dt = pc->len_ms;
+    uint32_t u = pc->len_ms ? prog_lerp(pc->u0, pc->u1, (uint32_t)(((uint64_t)dt << 16) / pc->len_ms))
+                            : pc->u1;
+
+    st->hz_q8 = prog_lerp(s->start_hz_q8, s->end_hz_q8, u);
+    st->inhale = s->inhale;
+    st->exhale = s->exhale;
+    st->hold_in = (uint8_t)prog_lerp(s->hold_in_start, s->hold_in_end, u);
+    st->hold_out = (uint8_t)prog_lerp(s->hold_out_start, s->hold_out_end, u);
+    st->brightness = s->brightness;
+    st->piece_left_ms = pc->len_ms - dt;
+}
+
+static uint32_t pace_glide_at(const session_engine_t *se, uint32_t t_ms)
+{
+    uint32_t dt = t_ms - se->glide_start_ms;
+    if (dt >= SESSION_PACE_GLIDE_MS) {
+        return se->pace_hz_q8;
+    }
+    return prog_lerp(se->glide_from_q8, se->pace_hz_q8, (uint32_t)(((uint64_t)dt << 16) / SESSION_PACE_GLIDE_MS));
+}
+
+// Strobe under a pace: glide to a new frequency from wherever it is now,
+// back to the program's ramp once the pace lets go of it
+static void pace_strobe(session_engine_t *se, uint32_t t_ms, prog_state_t *st)
+{
+    uint32_t target = se->pace.active ? se->pace.hz_q8 : 0;
+    if (target == 0) {
+        if (se->pace_hz_q8) {
+            se->pace_hz_q8 = 0;
+            prog_ramp(se, se->cursor);
+        }
+        return;
+    }
+    if (target != se->pace_hz_q8) {
+        uint32_t from = se->pace_hz_q8 ? pace_glide_at(se, t_ms) : st->hz_q8;
+        se->glide_from_q8 = from;
+        se->glide_start_ms = t_ms;
+        se->pace_hz_q8 = target;
+        se->sink->ramp(se->sink->ctx, from, target, t_ms, SESSION_PACE_GLIDE_MS);
+    }
+    st->hz_q8 = pace_glide_at(se, t_ms);
+}
+
+void session_engine_init(session_engine_t *se, const session_sink_t *sink)
+{
+    memset(se, 0, sizeof(*se));
+    se->phase = 3;
+    se->sink = sink;
+}
+
+void session_engine_start(session_engine_t *se, uint32_t now_ms)
+{
+    prog_compile(se);
+    se->start_ms = now_ms;
+    se->running = false;
+    se->retarget = false;
+    se->cycle_len_ms = 0;
+    se->pace_hz_q8 = 0;
+    prog_ramp(se, 0);
+}
+
+void session_engine_stop(session_engine_t *se)
+{
+    se->running = false;
+}
+
+void session_engine_retarget(session_engine_t *se)
+{
+    se->retarget = true;
+}
+
+void session_engine_pace(session_engine_t *se, const session_pace_t *pace)
+{
+    se->pace = *pace;
+}
+
+bool session_engine_cycle_pos(const session_engine_t *se, uint32_t t_ms, uint32_t *pos_q16)
+{
+    if (!se->running || se->cycle_len_ms == 0) {
+        return false;
+    }
+    int32_t len = (int32_t)se->cycle_len_ms;
+    int32_t dt = (int32_t)(t_ms - se->cycle_start_ms) % len;
+    if (dt < 0) dt += len;
+    *pos_q16 = (uint32_t)(((uint64_t)dt << 16) / (uint32_t)len);
+    return true;
+}
+
+bool session_engine_tick(session_engine_t *se, uint32_t now_ms, uint8_t brightness,
+                         session_tick_t *out)
+{
+    uint32_t elapsed_ms = now_ms - se->start_ms;
+    if (elapsed_ms >= se->total_ms) {
+        se->running = false;
+        return false;
+    }
+
+    // Program state now (strobe frequency, breath timings, brightness),
+    // breathing and strobe from the pace if one is set
+    prog_eval(se, elapsed_ms, &out->st);
+    if (se->pace.active) {
+        out->st.inhale = se->pace.inhale;
+        out->st.exhale = se->pace.exhale;
+        out->st.hold_in = 0;
+        out->st.hold_out = 0;
+    }
+    pace_strobe(se, elapsed_ms, &out->st);
+    const prog_state_t *st = &out->st;
+    uint8_t level = (uint8_t)((uint32_t)st->brightness * brightness / 100);
+
+    if (!se->running || now_ms - se->phase_start_ms >= se->phase_len_ms) {
+        uint32_t phase_durations[4] = {
+            st->inhale * 100u,
+            st->hold_in * 100u,
+            st->exhale * 100u,
+            st->hold_out * 100u
+        };
+
+        // Advance to the next phase with a non-zero duration
+        bool was_idle = se->running && se->breath_idle;
+        if (!se->running) se->phase = 3;
+        uint8_t phase_checks = 0;
+        do {
+            se->phase = (se->phase + 1) % 4;
+            phase_checks++;
+        } while (phase_checks < 4 && phase_durations[se->phase] == 0);
+
+        se->phase_start_ms = now_ms;
+        se->phase_len_ms = phase_durations[se->phase];
+        if (se->phase == 0) {
+            se->cycle_start_ms = now_ms;
+            se->cycle_len_ms = phase_durations[0] + phase_durations[1] +
+                               phase_durations[2] + phase_durations[3];
+        }
+        if (se->phase_len_ms == 0) {
+            // All phases zero: no breathing, hold full brightness and just strobe
+            se->phase = 1;
+            se->phase_len_ms = SESSION_BREATH_RECHECK_MS;
+            se->cycle_len_ms = 0;
+        }
+        se->breath_idle = phase_durations[se->phase] == 0;
+
+        // A re-check that finds every phase still zero is no new phase
+        se->level = level;
+        se->retarget = false;
+        se->running = true;
+        se->sink->envelope(se->sink->ctx, se->phase, se->phase_len_ms, level,
+                           !(was_idle && se->breath_idle));
+    } else if (se->level != level || se->retarget) {
+        // Brightness or lens response changed mid-phase: retarget the rest of the ramp
+        se->level = level;
+        se->retarget = false;
+        se->sink->envelope(se->sink->ctx, se->phase,
+                           se->phase_len_ms - (now_ms - se->phase_start_ms), level, false);
+    }
+
+    uint32_t wait = se->phase_len_ms - (now_ms - se->phase_start_ms);
+    uint32_t session_left = se->total_ms - elapsed_ms;
+    if (wait > st->piece_left_ms) wait = st->piece_left_ms;
+    if (wait > session_left) wait = session_left;
+
+    out->level = level;
+    out->elapsed_ms = elapsed_ms;
+    out->wait_ms = wait;
+    return true;
+}
@@ -0,0 +1,174 @@
+/**
+ * Session engine for the Smart Glasses timed session
+ *
+ * Turns a session program into strobe ramps and breath envelope phases,
+ * from nothing but the time it is handed. It makes no ESP-IDF or FreeRTOS
+ * calls: the caller supplies the clock (a ms count, any epoch, wrapping at
+ * 2^32) and a sink that drives the lenses and the strobe ISR, so the same
+ * code can be stepped off target faster than real time.
+ *
+ * Program wire format, little-endian:
+ *   header  [0] version  [1] segment count  [2] segment size  [3] reserved
+ *           [4..7] CRC-32 of the segment bytes
+ *   segment [0..1] duration (s)  [2..3] start Hz (Q8)  [4..5] end Hz (Q8)
+ *           [6] inhale  [7] exhale  [8] hold_in start  [9] hold_in end
+ *           [10] hold_out start  [11] hold_out end (all x0.1 s)
+ *           [12] brightness (0-100, scaled by 0xA2)  [13] easing (prog_ease_t)
+ *
+ * On start the segments are compiled into linear pieces (eased segments
+ * are split into PROG_EASE_PIECES), each holding the eased segment fraction
+ * at both ends in Q16. Each tick evaluates the current state by integer
+ * interpolation inside the current piece, and each piece is one linear
+ * strobe ramp for the ISR.
+ *
+ * A pace (session_engine_pace(), from biofeedback pacing in pacing.h) can
+ * take over the breathing and strobe frequency of the running program: its
+ * inhale and exhale replace the program's, without holds, from the next
+ * breath phase on, and the strobe glides to its frequency over
+ * SESSION_PACE_GLIDE_MS. Dropping the pace hands both back to the program.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PROG_VERSION        1
+#define PROG_MAX_SEGS       16
+#define PROG_HDR_LEN        8
+#define PROG_SEG_LEN        14
+#define PROG_MAX_LEN        (PROG_HDR_LEN + PROG_MAX_SEGS * PROG_SEG_LEN)
+#define PROG_MAX_SEG_S      3600         // Keeps a piece's ramp within uint32 us
+#define PROG_EASE_PIECES    8
+#define PROG_MAX_PIECES     (PROG_MAX_SEGS * PROG_EASE_PIECES)
+#define PROG_Q16            65536u
+#define SESSION_PACE_GLIDE_MS 2000
+#define SESSION_BREATH_RECHECK_MS 1000   // Hold-in re-check while every phase is zero
+
+typedef enum {
+    PROG_EASE_LINEAR = 0,
+    PROG_EASE_IN,                // Quadratic, slow start
+    PROG_EASE_OUT,               // Quadratic, slow end
+    PROG_EASE_IN_OUT,            // Smoothstep
+} prog_ease_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t duration_s;
+    uint16_t start_hz_q8;
+    uint16_t end_hz_q8;
+    uint8_t inhale;
+    uint8_t exhale;
+    uint8_t hold_in_start;
+    uint8_t hold_in_end;
+    uint8_t hold_out_start;
+    uint8_t hold_out_end;
+    uint8_t brightness;
+    uint8_t easing;
+} prog_seg_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t count;
+    uint8_t seg_len;
+    uint8_t reserved;
+    uint32_t crc;
+    prog_seg_t seg[PROG_MAX_SEGS];
+} prog_t;
+
+typedef struct {
+    uint32_t t_start_ms;         // Offset from session start
+    uint32_t len_ms;
+    uint32_t u0, u1;             // Eased segment fraction at both ends (Q16)
+    uint8_t seg;
+} prog_piece_t;
+
+// Program state at one point of the session
+typedef struct {
+    uint32_t hz_q8;
+    uint8_t inhale, exhale;      // x0.1 s
+    uint8_t hold_in, hold_out;   // x0.1 s
+    uint8_t brightness;          // Segment brightness 0-100
+    uint32_t piece_left_ms;      // Until the next piece (and strobe ramp)
+} prog_state_t;
+
+// Breathing and strobe set from outside the program
+typedef struct {
+    bool active;
+    uint8_t inhale, exhale;      // x0.1 s; holds are zero while pacing
+    uint32_t hz_q8;              // 0 = the program's
+} session_pace_t;
+
+// Outputs, called from inside the engine calls. They must not call back
+// into the engine.
+typedef struct {
+    // Linear strobe ramp from start_hz_q8 to end_hz_q8 over len_ms, starting
+    // start_ms after session start (which may already have passed)
+    void (*ramp)(void *ctx, uint32_t start_hz_q8, uint32_t end_hz_q8,
+                 uint32_t start_ms, uint32_t len_ms);
+    // Breath envelope: phase (0=inhale, 1=hold_in, 2=exhale, 3=hold_out)
+    // for the next len_ms at level 0-100. start is set for a new phase, and
+    // clear when the rest of the current one is retargeted or a re-check
+    // with every phase zero keeps holding.
+    void (*envelope)(void *ctx, uint8_t phase, uint32_t len_ms, uint8_t level, bool start);
+    void *ctx;
+} session_sink_t;
+
+// Engine state. prog is the program being run; the rest is internal.
+typedef struct {
+    prog_t prog;
+    uint32_t total_ms;           // Session length
+    prog_piece_t pieces[PROG_MAX_PIECES];
+    uint32_t piece_count;
+    uint32_t cursor;             // Current piece
+    uint32_t ramp_piece;         // Piece the strobe ramp was set for
+    uint32_t start_ms;           // Clock at session start
+    uint32_t phase_start_ms;     // Clock when the current phase began
+    uint32_t phase_len_ms;
+    uint8_t phase;               // 0=inhale, 1=hold_in, 2=exhale, 3=hold_out
+    uint8_t level;               // Level the envelope was programmed with
+    bool running;                // Envelope running (restart at inhale if not)
+    bool retarget;
+    bool breath_idle;            // Every phase zero: holding, re-checked now and then
+    uint32_t cycle_start_ms;     // Clock when the current breath cycle began
+    uint32_t cycle_len_ms;       // Its length, 0 = not breathing
+    session_pace_t pace;
+    uint32_t pace_hz_q8;         // Strobe target being glided to, 0 = program ramp
+    uint32_t glide_from_q8;
+    uint32_t glide_start_ms;     // Offset from session start
+    const session_sink_t *sink;
+} session_engine_t;
+
+// One tick's result
+typedef struct {
+    prog_state_t st;
+    uint8_t level;               // Envelope level: segment x global brightness
+    uint32_t elapsed_ms;
+    uint32_t wait_ms;            // Until the phase, piece or session ends
+} session_tick_t;
+
+void session_engine_init(session_engine_t *se, const session_sink_t *sink);
+
+// (Re)start se->prog from the beginning at now_ms. The caller fills in
+// se->prog first; it must have passed validation. Sets the first strobe ramp.
+void session_engine_start(session_engine_t *se, uint32_t now_ms);
+
+// Envelope stopped (idle, override): the next tick starts again at inhale
+void session_engine_stop(session_engine_t *se);
+
+// Reprogram the rest of the current phase on the next tick, e.g. after the
+// lens response changed
+void session_engine_retarget(session_engine_t *se);
+
+// Take over (pace->active) or give back breathing and strobe; applies from
+// the next tick
+void session_engine_pace(session_engine_t *se, const session_pace_t *pace);
+
+// Position of t_ms in the breath cycle, Q16 turns, assuming the current
+// cycle's timing; false if no breathing envelope runs
+bool session_engine_cycle_pos(const session_engine_t *se, uint32_t t_ms, uint32_t *pos_q16);
+
+// Step the session to now_ms with brightness 0-100 as the global scale,
+// calling the sink for a new phase, a retarget or a new strobe ramp. Returns
+// false, with nothing called, once the session is over. Nothing changes
+// before out->wait_ms has passed unless brightness or the pace does.
+bool session_engine_tick(session_engine_t *se, uint32_t now_ms, uint8_t brightness,
+                         session_tick_t *out);
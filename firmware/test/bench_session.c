@@ -0,0 +1,118 @@
+/**
+ * Per-tick cost of the session engine and the pacer, on the host
+ *
+ * - event: a 60-minute eased program ticked only when the engine asks, as
+ *   led_task runs it
+ * - dense: the same program ticked every ms, timing each tick, for the
+ *   worst case of a tick inside a piece and a phase
+ * - beat: pace_beat() in RR mode
+ *
+ * Host numbers only compare builds and changes; the ESP32 at 80-240 MHz is
+ * some 10-50x slower.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "session_engine.h"
+#include "pacing.h"
+
+#define HIST_NS_MAX         100000       // 10 ns buckets
+
+static uint32_t sink_calls;
+
+static void bench_ramp(void *ctx, uint32_t a, uint32_t b, uint32_t start_ms, uint32_t len_ms)
+{
+    (void)ctx; (void)a; (void)b; (void)start_ms; (void)len_ms;
+    sink_calls++;
+}
+
+static void bench_envelope(void *ctx, uint8_t phase, uint32_t len_ms, uint8_t level, bool start)
+{
+    (void)ctx; (void)phase; (void)len_ms; (void)level; (void)start;
+    sink_calls++;
+}
+
+static const session_sink_t sink = { .ramp = bench_ramp, .envelope = bench_envelope };
+static session_engine_t se;
+static uint32_t hist[HIST_NS_MAX / 10 + 1];
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void bench_start(void)
+{
+    session_engine_init(&se, &sink);
+    se.prog.version = PROG_VERSION;
+    se.prog.count = 2;
+    se.prog.seg_len = PROG_SEG_LEN;
+    se.prog.seg[0] = (prog_seg_t){ .duration_s = 1800, .start_hz_q8 = 14 << 8, .end_hz_q8 = 10 << 8,
+                                   .inhale = 40, .exhale = 60, .hold_in_end = 30, .hold_out_end = 20,
+                                   .brightness = 100, .easing = PROG_EASE_LINEAR };
+    se.prog.seg[1] = (prog_seg_t){ .duration_s = 1800, .start_hz_q8 = 10 << 8, .end_hz_q8 = 6 << 8,
+                                   .inhale = 40, .exhale = 60, .hold_in_start = 30, .hold_in_end = 10,
+                                   .hold_out_start = 20, .hold_out_end = 40,
+                                   .brightness = 100, .easing = PROG_EASE_IN_OUT };
+    session_engine_start(&se, 0u - 1200000u);
+}
+
+static double hist_ns(uint64_t n, double share)
+{
+    uint64_t want = (uint64_t)(n * share), seen = 0;
+    for (uint32_t i = 0; i < sizeof(hist) / sizeof(hist[0]); i++) {
+        seen += hist[i];
+        if (seen > want) return i * 10.0;
+    }
+    return HIST_NS_MAX;
+}
+
+int main(void)
+{
+    session_tick_t t;
+
+    bench_start();
+    uint64_t t0 = now_ns();
+    uint32_t e = 0, ticks = 0;
+    while (session_engine_tick(&se, (0u - 1200000u) + e, 100, &t)) {
+        e += t.wait_ms ? t.wait_ms : 1;
+        ticks++;
+    }
+    double event_ns = (double)(now_ns() - t0);
+    printf("event  %7u ticks for 60 min  %7.1f ns/tick  %.0fx real time  (%u sink calls)\n",
+           ticks, event_ns / ticks, 3600e9 / event_ns, sink_calls);
+
+    bench_start();
+    memset(hist, 0, sizeof(hist));
+    uint64_t sum = 0, n = 0, worst = 0;
+    for (e = 0; ; e++) {
+        uint64_t a = now_ns();
+        bool more = session_engine_tick(&se, (0u - 1200000u) + e, 100, &t);
+        uint64_t d = now_ns() - a;
+        if (!more) break;
+        sum += d;
+        n++;
+        if (d > worst) worst = d;
+        hist[d < HIST_NS_MAX ? d / 10 : HIST_NS_MAX / 10]++;
+    }
+    printf("dense  %7llu ticks, 1 ms apart   %7.1f ns/tick  p50 %.0f ns  p99 %.0f ns  max %llu ns"
+           "  (timer included)\n",
+           (unsigned long long)n, (double)sum / n, hist_ns(n, 0.5), hist_ns(n, 0.99),
+           (unsigned long long)worst);
+
+    static pace_t pc;
+    pace_cfg_t cfg = PACE_CFG_DEFAULT;
+    cfg.mode = PACE_RR;
+    pace_configure(&pc, &cfg);
+    const uint32_t beats = 1000000;
+    uint32_t pos = 0;
+    t0 = now_ns();
+    for (uint32_t i = 0; i < beats; i++) {
+        pos += 11000;
+        pace_beat(&pc, (uint16_t)(900 + (i * 37) % 80), pos & 0xFFFF);
+    }
+    printf("beat   %7u beats              %7.1f ns/beat\n", beats, (double)(now_ns() - t0) / beats);
+    return 0;
+}
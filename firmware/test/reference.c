@@ -0,0 +1,149 @@
+/**
+ * Float reference model of the session maths - see reference.h
+ */
+#include <math.h>
+#include <stdlib.h>
+#include "reference.h"
+
+double ref_ease(uint8_t ease, double x)
+{
+    switch (ease) {
+        case PROG_EASE_IN:
+            return x * x;
+        case PROG_EASE_OUT:
+            return 1.0 - (1.0 - x) * (1.0 - x);
+        case PROG_EASE_IN_OUT:
+            return x * x * (3.0 - 2.0 * x);
+        default:
+            return x;
+    }
+}
+
+// Largest |f''| of each curve, for the chord error bound
+static double ref_ease_curvature(uint8_t ease)
+{
+    switch (ease) {
+        case PROG_EASE_IN:
+        case PROG_EASE_OUT:
+            return 2.0;
+        case PROG_EASE_IN_OUT:
+            return 6.0;
+        default:
+            return 0.0;
+    }
+}
+
+static const prog_seg_t *ref_seg_at(const prog_t *prog, double t_ms, double *x, uint8_t *index)
+{
+    double t0 = 0;
+    for (uint8_t i = 0; i < prog->count; i++) {
+        const prog_seg_t *s = &prog->seg[i];
+        double len = s->duration_s * 1000.0;
+        if (t_ms < t0 + len || i + 1 == prog->count) {
+            double f = len > 0 ? (t_ms - t0) / len : 1.0;
+            *x = f < 0 ? 0 : f > 1 ? 1 : f;
+            *index = i;
+            return s;
+        }
+        t0 += len;
+    }
+    return NULL;
+}
+
+void ref_state(const prog_t *prog, double t_ms, ref_state_t *out)
+{
+    double x;
+    uint8_t i;
+    const prog_seg_t *s = ref_seg_at(prog, t_ms, &x, &i);
+    double u = ref_ease(s->easing, x);
+    out->hz = (s->start_hz_q8 + (s->end_hz_q8 - s->start_hz_q8) * u) / 256.0;
+    out->inhale = s->inhale;
+    out->exhale = s->exhale;
+    out->hold_in = s->hold_in_start + (s->hold_in_end - s->hold_in_start) * u;
+    out->hold_out = s->hold_out_start + (s->hold_out_end - s->hold_out_start) * u;
+    out->brightness = s->brightness;
+    out->seg = i;
+}
+
+void ref_phases(const prog_t *prog, double t_ms, int side, uint32_t len_ms[4])
+{
+    ref_state_t st;
+    double x;
+    uint8_t i;
+    ref_state(prog, t_ms, &st);
+    const prog_seg_t *s = ref_seg_at(prog, t_ms, &x, &i);
+    double tol = ref_u_tolerance(prog, t_ms);
+    double hold_in = floor(st.hold_in + side * (tol * abs(s->hold_in_end - s->hold_in_start) + 0.01));
+    double hold_out = floor(st.hold_out + side * (tol * abs(s->hold_out_end - s->hold_out_start) + 0.01));
+    len_ms[0] = (uint32_t)(st.inhale * 100);
+    len_ms[1] = (uint32_t)((hold_in < 0 ? 0 : hold_in) * 100);
+    len_ms[2] = (uint32_t)(st.exhale * 100);
+    len_ms[3] = (uint32_t)((hold_out < 0 ? 0 : hold_out) * 100);
+}
+
+uint8_t ref_next_phase(uint8_t phase, const uint32_t len_ms[4])
+{
+    for (int i = 1; i <= 4; i++) {
+        uint8_t p = (uint8_t)((phase + i) % 4);
+        if (len_ms[p]) {
+            return p;
+        }
+    }
+    return 1;
+}
+
+double ref_envelope(uint8_t phase, double bp, double level)
+{
+    if (bp < 0) bp = 0;
+    if (bp > 1) bp = 1;
+    switch (phase) {
+        case 0:  return bp * level;              // Inhale: 0 -> level
+        case 1:  return level;                   // Hold in
+        case 2:  return (1.0 - bp) * level;      // Exhale: level -> 0
+        default: return 0.0;                     // Hold out
+    }
+}
+
+double ref_u_tolerance(const prog_t *prog, double t_ms)
+{
+    double x;
+    uint8_t i;
+    const prog_seg_t *s = ref_seg_at(prog, t_ms, &x, &i);
+    double h = 1.0 / PROG_EASE_PIECES;
+    return ref_ease_curvature(s->easing) * h * h / 8.0 + 4.0 / PROG_Q16;
+}
+
+double ref_hz_tolerance(const prog_t *prog, double t_ms)
+{
+    double x;
+    uint8_t i;
+    const prog_seg_t *s = ref_seg_at(prog, t_ms, &x, &i);
+    double span = fabs((double)s->end_hz_q8 - s->start_hz_q8) / 256.0;
+    return span * ref_u_tolerance(prog, t_ms) + 2.0 / 256.0;
+}
+
+uint32_t ref_breath_cycles(const prog_t *prog)
+{
+    double total = 0;
+    for (uint8_t i = 0; i < prog->count; i++) {
+        total += prog->seg[i].duration_s * 1000.0;
+    }
+
+    uint32_t cycles = 0;
+    uint8_t phase = 3;
+    double t = 0;
+    while (t < total) {
+        uint32_t len[4];
+        ref_phases(prog, t, 0, len);
+        phase = ref_next_phase(phase, len);
+        if (len[phase] == 0) {
+            t += SESSION_BREATH_RECHECK_MS;
+            continue;
+        }
+        if (phase == 0) {
+            cycles++;
+        }
+        t += len[phase];
+    }
+    return cycles;
+}
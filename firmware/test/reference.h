@@ -0,0 +1,50 @@
+/**
+ * Float reference model of the session maths, for the host tests
+ *
+ * The formulas led_task used before the session engine, in double
+ * precision: Hz and holds interpolated on session (here segment) progress,
+ * holds truncated to 0.1 s, the breath phase advance that skips zero-length
+ * phases, and the envelope level per phase. Easing is the exact curve, not
+ * the engine's piecewise-linear approximation of it.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "session_engine.h"
+
+typedef struct {
+    double hz;
+    double inhale, exhale;       // x0.1 s
+    double hold_in, hold_out;    // x0.1 s, not truncated yet
+    uint8_t brightness;
+    uint8_t seg;
+} ref_state_t;
+
+// Eased fraction of x (0-1)
+double ref_ease(uint8_t ease, double x);
+
+// Program state t_ms into the session; t_ms past the end holds the last value
+void ref_state(const prog_t *prog, double t_ms, ref_state_t *out);
+
+// Phase lengths in ms t_ms into the session, holds truncated to 0.1 s as
+// led_task did. side -1 or 1 moves each hold by the most the engine's
+// piecewise easing and integer rounding may move it first, 0 not at all.
+void ref_phases(const prog_t *prog, double t_ms, int side, uint32_t len_ms[4]);
+
+// Next phase after `phase` with a non-zero length; 1 (a hold at full level)
+// when every phase is zero
+uint8_t ref_next_phase(uint8_t phase, const uint32_t len_ms[4]);
+
+// Envelope level at fraction bp (0-1) through phase, for level 0-100
+double ref_envelope(uint8_t phase, double bp, double level);
+
+// Largest error of the engine's eased fraction at t_ms: the chord error of
+// its PROG_EASE_PIECES linear pieces on an eased segment, plus Q16 rounding
+double ref_u_tolerance(const prog_t *prog, double t_ms);
+
+// The same for the strobe frequency, plus Q8 rounding
+double ref_hz_tolerance(const prog_t *prog, double t_ms);
+
+// Breath cycles (inhale starts) a session of prog runs, stepping the phase
+// machine in continuous time
+uint32_t ref_breath_cycles(const prog_t *prog);
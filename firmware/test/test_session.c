@@ -0,0 +1,408 @@
+/**
+ * Host tests for the session engine and biofeedback pacing
+ *
+ * Each case runs a full program through session_engine.c faster than real
+ * time: the clock jumps straight to the time each tick asks to be woken at,
+ * as led_task sleeps. The strobe ramps and envelope phases the engine hands
+ * its sink are rebuilt into waveforms and sampled every SAMPLE_MS against
+ * the float reference model (reference.h). Phase starts are checked too:
+ * the phase picked, its length, and that it starts exactly where the last
+ * one ended, so timing cannot drift over an hour.
+ *
+ * Exit status is the number of failed cases.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "session_engine.h"
+#include "pacing.h"
+#include "reference.h"
+
+#define SAMPLE_MS           10
+#define ENV_TOLERANCE       0.5          // Level units (0-100)
+#define MAX_REPORTED        8            // Failures printed per case
+
+typedef struct {
+    const prog_t *prog;
+    const session_pace_t *pace;  // Breathing paced instead of the program's
+    uint32_t now;                // Elapsed ms of the engine call running
+    uint32_t errors;
+    // Strobe ramp in force
+    uint32_t ramp_from_q8, ramp_to_q8, ramp_start, ramp_len;
+    // Envelope in force: linear from env_from to env_to over env_len
+    double env_from, env_to;
+    uint32_t env_t0, env_len;
+    uint8_t level;
+    uint8_t phase;
+    bool started;
+    uint32_t phase_end;          // Where the last phase should end
+    bool idle;                   // Last phase was an all-zero re-check
+    uint32_t phases, cycles, rechecks;
+    double hz_err_max, env_err_max;
+} sim_t;
+
+#define SIM_FAIL(s, ...) do {                                       \
+        if ((s)->errors++ < MAX_REPORTED) {                         \
+            printf("    ");                                         \
+            printf(__VA_ARGS__);                                    \
+            printf("\n");                                           \
+        }                                                           \
+    } while (0)
+
+static double sim_hz(const sim_t *s, uint32_t t)
+{
+    if (t <= s->ramp_start || s->ramp_len == 0) {
+        return (t < s->ramp_start ? s->ramp_from_q8 : s->ramp_len ? s->ramp_from_q8 : s->ramp_to_q8) / 256.0;
+    }
+    double f = (double)(t - s->ramp_start) / s->ramp_len;
+    if (f > 1) f = 1;
+    return (s->ramp_from_q8 + ((double)s->ramp_to_q8 - s->ramp_from_q8) * f) / 256.0;
+}
+
+static double sim_env(const sim_t *s, uint32_t t)
+{
+    if (s->env_len == 0) {
+        return s->env_to;
+    }
+    double f = (double)(t - s->env_t0) / s->env_len;
+    if (f > 1) f = 1;
+    return s->env_from + (s->env_to - s->env_from) * f;
+}
+
+static void sim_ramp(void *ctx, uint32_t start_hz_q8, uint32_t end_hz_q8,
+                     uint32_t start_ms, uint32_t len_ms)
+{
+    sim_t *s = ctx;
+    s->ramp_from_q8 = start_hz_q8;
+    s->ramp_to_q8 = end_hz_q8;
+    s->ramp_start = start_ms;
+    s->ramp_len = len_ms;
+}
+
+// A new phase: the one the reference picks, as long as it says, starting
+// where the last one ended
+static void sim_check_phase(sim_t *s, uint8_t phase, uint32_t len_ms)
+{
+    uint8_t prev = s->started ? s->phase : 3;
+    bool ok = false;
+    uint8_t want = 0;
+    uint32_t want_len = 0;
+    for (int side = -1; side <= 1 && !ok; side += 2) {
+        uint32_t len[4];
+        ref_phases(s->prog, s->now, side, len);
+        if (s->pace && s->pace->active) {
+            len[0] = s->pace->inhale * 100u;
+            len[1] = 0;
+            len[2] = s->pace->exhale * 100u;
+            len[3] = 0;
+        }
+        want = ref_next_phase(prev, len);
+        want_len = len[want] ? len[want] : SESSION_BREATH_RECHECK_MS;
+        ok = phase == want && len_ms == want_len;
+    }
+    if (!ok) {
+        SIM_FAIL(s, "%u ms: phase %u for %u ms, reference %u for %u ms",
+                 s->now, phase, len_ms, want, want_len);
+    }
+    if (len_ms == 0) {
+        SIM_FAIL(s, "%u ms: zero-length phase %u", s->now, phase);
+    }
+    if (s->started && s->now != s->phase_end) {
+        SIM_FAIL(s, "%u ms: phase starts %d ms off the end of the last one",
+                 s->now, (int)(s->now - s->phase_end));
+    }
+    s->phase_end = s->now + len_ms;
+    s->phases++;
+    s->cycles += phase == 0;
+}
+
+static void sim_envelope(void *ctx, uint8_t phase, uint32_t len_ms, uint8_t level, bool start)
+{
+    sim_t *s = ctx;
+    double now = sim_env(s, s->now);
+    // A re-check while every phase is still zero holds on, with no new phase.
+    // Zero even with the holds moved up by the engine's error: surely idle.
+    bool recheck = phase == 1 && len_ms == SESSION_BREATH_RECHECK_MS;
+    bool idle = false;
+    if (recheck) {
+        uint32_t len[4];
+        ref_phases(s->prog, s->now, 1, len);
+        idle = !len[0] && !len[1] && !len[2] && !len[3];
+    }
+    if (start) {
+        if (idle && s->idle) {
+            SIM_FAIL(s, "%u ms: re-check reported as a new phase", s->now);
+        }
+        sim_check_phase(s, phase, len_ms);
+        s->idle = idle;
+    } else if (s->now == s->phase_end) {
+        // Not a retarget, which comes mid-phase: the hold goes on
+        if (!recheck || !s->idle) {
+            SIM_FAIL(s, "%u ms: phase %u for %u ms not reported as new", s->now, phase, len_ms);
+        }
+        s->phase_end = s->now + len_ms;
+    }
+    s->rechecks += recheck && s->now == s->phase_end - len_ms;
+    // Inhale rises to level, exhale falls from it; a retarget goes on from
+    // wherever the lens is
+    double to = (phase == 0 || phase == 1) ? level : 0;
+    double from = !start ? now : phase == 0 ? 0 : phase == 2 ? level : to;
+    if (phase == 1 || phase == 3) from = to;
+    s->env_from = from;
+    s->env_to = to;
+    s->env_t0 = s->now;
+    s->env_len = len_ms;
+    s->level = level;
+    s->phase = phase;
+    s->started = true;
+}
+
+// One sample between ticks against the reference
+static void sim_sample(sim_t *s, uint32_t t, bool paced)
+{
+    ref_state_t st;
+    ref_state(s->prog, t, &st);
+
+    if (!paced) {
+        double err = fabs(sim_hz(s, t) - st.hz);
+        if (err > s->hz_err_max) s->hz_err_max = err;
+        if (err > ref_hz_tolerance(s->prog, t)) {
+            SIM_FAIL(s, "%u ms: strobe %.4f Hz, reference %.4f Hz", t, sim_hz(s, t), st.hz);
+        }
+    }
+
+    double bp = s->env_len ? (double)(t - s->env_t0) / s->env_len : 1.0;
+    double want = ref_envelope(s->phase, bp, s->level);
+    double err = fabs(sim_env(s, t) - want);
+    if (err > s->env_err_max) s->env_err_max = err;
+    if (err > ENV_TOLERANCE) {
+        SIM_FAIL(s, "%u ms: level %.2f in phase %u, reference %.2f", t, sim_env(s, t), s->phase, want);
+    }
+}
+
+// Initializer for one program segment; Hz may be fractional
+#define SEG(len_s, hz0, hz1, in, ex, hold_in0, hold_in1, hold_out0, hold_out1, bright, ease) \
+    { .duration_s = (len_s),                                                            \
+      .start_hz_q8 = (uint16_t)((hz0) * 256), .end_hz_q8 = (uint16_t)((hz1) * 256),      \
+      .inhale = (in), .exhale = (ex),                                                   \
+      .hold_in_start = (hold_in0), .hold_in_end = (hold_in1),                           \
+      .hold_out_start = (hold_out0), .hold_out_end = (hold_out1),                       \
+      .brightness = (bright), .easing = (ease) }
+
+typedef struct {
+    const char *name;
+    uint32_t clock0;             // Engine clock at session start
+    uint8_t count;
+    prog_seg_t seg[PROG_MAX_SEGS];
+    uint32_t zero_until_ms;      // All phases zero until here: rechecks only
+} sim_case_t;
+
+static session_engine_t se;
+
+// Run one program to the end. Returns true if it passed.
+static bool run_case(const sim_case_t *c)
+{
+    sim_t s;
+    memset(&s, 0, sizeof(s));
+    const session_sink_t sink = { .ramp = sim_ramp, .envelope = sim_envelope, .ctx = &s };
+
+    session_engine_init(&se, &sink);
+    se.prog.version = PROG_VERSION;
+    se.prog.count = c->count;
+    se.prog.seg_len = PROG_SEG_LEN;
+    memcpy(se.prog.seg, c->seg, sizeof(c->seg));
+    s.prog = &se.prog;
+
+    clock_t wall = clock();
+    session_engine_start(&se, c->clock0);
+    uint32_t total = se.total_ms;
+    uint32_t e = 0, sample = 0, ticks = 0, zero_waits = 0;
+    session_tick_t t;
+    while (1) {
+        s.now = e;
+        if (!session_engine_tick(&se, c->clock0 + e, 100, &t)) {
+            break;
+        }
+        ticks++;
+        if (t.elapsed_ms != e) {
+            SIM_FAIL(&s, "%u ms: engine reports %u ms elapsed", e, t.elapsed_ms);
+        }
+        uint32_t pos;
+        if (e < c->zero_until_ms && session_engine_cycle_pos(&se, c->clock0 + e, &pos)) {
+            SIM_FAIL(&s, "%u ms: breath cycle position with every phase zero", e);
+        }
+        if (t.wait_ms == 0) {
+            // Nothing to wait for would spin led_task
+            if (++zero_waits > 4) {
+                SIM_FAIL(&s, "%u ms: tick keeps asking for no wait", e);
+                break;
+            }
+            continue;
+        }
+        zero_waits = 0;
+        uint32_t next = e + t.wait_ms;
+        for (; sample < next && sample < total; sample += SAMPLE_MS) {
+            sim_sample(&s, sample, false);
+        }
+        e = next;
+    }
+    double wall_s = (double)(clock() - wall) / CLOCKS_PER_SEC;
+
+    if (e != total) {
+        SIM_FAIL(&s, "session ended at %u ms, program is %u ms", e, total);
+    }
+    if (c->zero_until_ms && s.rechecks < c->zero_until_ms / SESSION_BREATH_RECHECK_MS) {
+        SIM_FAIL(&s, "%u rechecks in the all-zero part, expected %u", s.rechecks,
+                 c->zero_until_ms / SESSION_BREATH_RECHECK_MS);
+    }
+    uint32_t ref_cycles = ref_breath_cycles(&se.prog);
+    if (s.cycles + 1 < ref_cycles || s.cycles > ref_cycles + 1) {
+        SIM_FAIL(&s, "%u breath cycles, reference %u", s.cycles, ref_cycles);
+    }
+
+    printf("%s %-28s %5u ticks %5u phases %4u cycles (ref %u)  max err %.4f Hz %.3f  %.0fx real time\n",
+           s.errors ? "FAIL" : "ok  ", c->name, ticks, s.phases, s.cycles, ref_cycles,
+           s.hz_err_max, s.env_err_max, wall_s > 0 ? total / 1000.0 / wall_s : INFINITY);
+    return s.errors == 0;
+}
+
+// Simulated heart: rate swings with the breath, most at 5.5 breaths/min
+static uint32_t rng = 1;
+static double rng_uniform(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return (rng & 0xFFFFFF) / (double)0x1000000;
+}
+
+// Pacing in RR mode on a 60-minute program: the rate search has to settle
+// on the simulated resonance, and the engine has to breathe and strobe as
+// it is told
+static bool run_pacing(void)
+{
+    sim_t s;
+    memset(&s, 0, sizeof(s));
+    const session_sink_t sink = { .ramp = sim_ramp, .envelope = sim_envelope, .ctx = &s };
+    static pace_t pc;
+    pace_cfg_t cfg = PACE_CFG_DEFAULT;
+    cfg.mode = PACE_RR;
+    cfg.hz_low = 12;
+    cfg.hz_high = 8;
+    const uint8_t resonance = 55;
+
+    session_engine_init(&se, &sink);
+    se.prog.version = PROG_VERSION;
+    se.prog.count = 1;
+    se.prog.seg_len = PROG_SEG_LEN;
+    se.prog.seg[0] = (prog_seg_t)SEG(3600, 10, 10, 40, 40, 0, 0, 0, 0, 100, PROG_EASE_LINEAR);
+    s.prog = &se.prog;
+    session_pace_t out;
+    s.pace = &out;
+    uint32_t clock0 = 0u - 600000u;
+    session_engine_start(&se, clock0);
+    pace_configure(&pc, &cfg);
+    pace_output(&pc, &out);
+    session_engine_pace(&se, &out);
+
+    uint32_t e = 0, next_tick = 0, next_beat = 900, last_change = 0;
+    session_tick_t t;
+    while (e < se.total_ms) {
+        s.now = e;
+        if (e == next_tick) {
+            if (!session_engine_tick(&se, clock0 + e, 100, &t)) {
+                break;
+            }
+            next_tick = e + (t.wait_ms ? t.wait_ms : 1);
+        }
+        if (e == next_beat) {
+            uint32_t pos = 0;
+            double paced = 600.0 / (t.st.inhale + t.st.exhale);
+            double swing = 8.0 / (1 + pow((paced - resonance / 10.0) / 0.6, 2));
+            bool ok = session_engine_cycle_pos(&se, clock0 + e, &pos);
+            double hr = 62 + swing * cos(2 * M_PI * pos / PACE_Q16 - 1.0) + (rng_uniform() - 0.5) * 4;
+            uint16_t rr = (uint16_t)(60000 / hr);
+            next_beat = e + rr;
+            if (rng_uniform() < 0.02) rr /= 2;          // Artifact
+            if (ok && pace_beat(&pc, rr, pos)) {
+                pace_output(&pc, &out);
+                session_engine_pace(&se, &out);
+                last_change = e;
+                next_tick = e;                          // led_task is notified
+                continue;
+            }
+        }
+        e = next_tick < next_beat ? next_tick : next_beat;
+    }
+
+    uint8_t best = pace_rate(&pc, pc.best);
+    if (pc.search != PACE_TRACK || best < resonance - PACE_RATE_STEP || best > resonance + PACE_RATE_STEP) {
+        SIM_FAIL(&s, "settled on %u.%u breaths/min, resonance is %u.%u", best / 10, best % 10,
+                 resonance / 10, resonance % 10);
+    }
+    if (t.st.inhale != out.inhale || t.st.exhale != out.exhale || t.st.hold_in || t.st.hold_out) {
+        SIM_FAIL(&s, "breathing %u/%u/%u/%u, paced %u/%u", t.st.inhale, t.st.hold_in,
+                 t.st.exhale, t.st.hold_out, out.inhale, out.exhale);
+    }
+    if (e - last_change >= SESSION_PACE_GLIDE_MS &&
+        fabs(sim_hz(&s, e - 1) - out.hz_q8 / 256.0) > 2.0 / 256) {
+        SIM_FAIL(&s, "strobe %.3f Hz, paced %.3f Hz", sim_hz(&s, e - 1), out.hz_q8 / 256.0);
+    }
+    printf("%s %-28s best %u.%u/min, %u beats (%u rejected), coherence %.2f\n",
+           s.errors ? "FAIL" : "ok  ", "pacing resonance search", best / 10, best % 10,
+           pc.accepted, pc.rejected, pc.coherence_q16 / 65536.0);
+    return s.errors == 0;
+}
+
+static const sim_case_t cases[] = {
+    {
+        .name = "linear, holds growing in",
+        .clock0 = 0u - 1200000u,            // Clock wraps 20 minutes in
+        .count = 1,
+        .seg = { SEG(3600, 12, 8, 40, 40, 0, 40, 0, 40, 100, PROG_EASE_LINEAR) },
+    },
+    {
+        .name = "linear then eased",
+        .clock0 = 0u - 2700000u,
+        .count = 2,
+        .seg = {
+            SEG(1800, 14, 10, 40, 60, 0, 30, 0, 20, 90, PROG_EASE_LINEAR),
+            SEG(1800, 10, 6, 40, 60, 30, 10, 20, 40, 90, PROG_EASE_IN_OUT),
+        },
+    },
+    {
+        .name = "every easing",
+        .clock0 = 0x12345678,
+        .count = 4,
+        .seg = {
+            SEG(900, 20, 12, 30, 30, 0, 20, 0, 0, 100, PROG_EASE_IN),
+            SEG(900, 12, 9, 40, 50, 20, 20, 0, 30, 100, PROG_EASE_OUT),
+            SEG(900, 9, 5, 50, 70, 20, 0, 30, 45, 100, PROG_EASE_IN_OUT),
+            SEG(900, 5, 4, 50, 80, 0, 0, 45, 0, 100, PROG_EASE_LINEAR),
+        },
+    },
+    {
+        // BREATH_RECHECK path: nothing to breathe, then holds grow in from zero
+        .name = "all phases zero",
+        .clock0 = 0u - 300000u,
+        .count = 2,
+        .seg = {
+            SEG(600, 10, 10, 0, 0, 0, 0, 0, 0, 100, PROG_EASE_LINEAR),
+            SEG(3000, 10, 6, 0, 0, 0, 30, 0, 20, 100, PROG_EASE_LINEAR),
+        },
+        .zero_until_ms = 600000,
+    },
+};
+
+int main(void)
+{
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        failed += !run_case(&cases[i]);
+    }
+    failed += !run_pacing();
+    printf("%d failed\n", failed);
+    return failed;
+}
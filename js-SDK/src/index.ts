@@ -9,6 +9,8 @@
 // BLE UUIDs
 const SERVICE_UUID = 0x00ff;
 const CHAR_UUID = 0xff01;
+const TELEMETRY_UUID = 0xff02;
+const TELEMETRY_TYPE_STATUS = 0x01;
 const DEVICE_NAME = 'Smart_Glasses';
 
 /**
@@ -33,6 +35,139 @@ export interface SessionConfig {
   brightness?: number;    // percent (0-100)
 }
 
+/**
+ * Live session status notified on FF02 (see 0xAA in the API reference)
+ */
+export interface Telemetry {
+  sessionRunning: boolean;
+  override: boolean;
+  progress: number;       // 0.0-1.0
+  hz: number;             // current strobe frequency (0 when stopped)
+  breathPhase: number;    // 0=inhale, 1=hold_in, 2=exhale, 3=hold_out
+  duty: number;           // envelope duty now, percent (0-100)
+  remainingS: number;     // session time left, seconds
+  brightness: number;     // percent (0-100)
+  tUs: number;            // device time, low 32 bits of microseconds
+}
+
+/**
+ * One segment of an uploadable session program (see 0xAB)
+ */
+export interface ProgramSegment {
+  duration: number;                 // seconds (1-3600)
+  strobeStart: number;              // Hz (1-50)
+  strobeEnd: number;                // Hz (1-50)
+  inhale?: number;                  // seconds
+  exhale?: number;                  // seconds
+  holdIn?: [number, number];        // seconds at segment start, end
+  holdOut?: [number, number];       // seconds at segment start, end
+  brightness?: number;              // percent, scaled by setBrightness()
+  easing?: 'linear' | 'in' | 'out' | 'inOut';
+}
+
+/**
+ * Program report (read after [0xA8, 0x03])
+ */
+export interface ProgramStatus {
+  result: number;         // 0 = last upload OK, 5 = stored in RAM only
+  uploaded: boolean;      // running the uploaded program
+  segments: number;
+  crc: number;
+  totalS: number;
+}
+
+/**
+ * Connection report (read after [0xA8, 0x05])
+ */
+export interface ConnectionParams {
+  profile: ConnectionProfile;     // set with setConnectionProfile
+  requested: ConnectionProfile | 'none';  // last profile the device asked for
+  connected: boolean;
+  intervalMs: number;
+  latency: number;                // connection events the device may skip
+  timeoutMs: number;
+}
+
+export type ConnectionProfile = 'auto' | 'lowLatency' | 'lowPower';
+const CONN_PROFILES: ConnectionProfile[] = ['auto', 'lowLatency', 'lowPower'];
+
+/**
+ * One lens in the lens report (read after [0xA8, 0x06])
+ */
+export interface LensLayout {
+  lens: number;                   // 0 = left, 1 = right
+  strobe: boolean;                // false = breathing envelope only
+  phase: number;                  // strobe phase offset, fraction of a cycle
+  scale: number;                  // duty scale, % of the envelope
+}
+
+/**
+ * Calibration report (read after [0xA8, 0x07])
+ */
+export interface LensTable {
+  stored: boolean;                // device-calibrated table in use, else built-in
+  result: number;                 // 0 = last upload step OK
+  raw: number[];                  // raw PWM (0-1024) for duty 0-100%
+}
+
+const LENS_TABLE_SIZE = 101;
+const LENS_TABLE_CHUNK = 9;     // entries per 0xAE 0x01 write
+
+export type EyePattern = 'together' | 'alternate' | 'left' | 'right';
+export const ALL_LENSES = 0xff;
+
+// [strobe, phase, scale] for lens 0 (left) and lens 1 (right)
+const EYE_PATTERNS: Record<EyePattern, [boolean, number, number][]> = {
+  together: [[true, 0, 100], [true, 0, 100]],
+  alternate: [[true, 0, 100], [true, 0.5, 100]],
+  left: [[true, 0, 100], [true, 0, 0]],
+  right: [[true, 0, 0], [true, 0, 100]],
+};
+
+function lensCmd(lens: number, strobe: boolean, phase: number, scale: number): number[] {
+  const phaseByte = Math.round((((phase % 1) + 1) % 1) * 256) & 0xff;
+  return [0xAD, lens & 0xff, strobe ? 1 : 0, phaseByte, Math.max(0, Math.min(100, Math.round(scale)))];
+}
+
+const PROGRAM_CHUNK = 17;   // data bytes per 0xAB 0x02 write
+const EASING = { linear: 0, in: 1, out: 2, inOut: 3 };
+
+// CRC-32 (zlib polynomial), as checked by the firmware
+function crc32(data: Uint8Array): number {
+  let crc = 0xffffffff;
+  for (const byte of data) {
+    crc ^= byte;
+    for (let i = 0; i < 8; i++) {
+      crc = (crc >>> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+  }
+  return (crc ^ 0xffffffff) >>> 0;
+}
+
+/**
+ * Write queue counters (see Glasses.queueStats)
+ */
+export interface QueueStats {
+  queued: number;                 // operations handed to the queue
+  coalesced: number;              // writes replaced by a newer value before sending
+  batched: number;                // commands that shared an 0xA9 frame
+  writes: number;                 // GATT writes made
+  pending: number;                // operations waiting now
+}
+
+// One queued GATT operation: a write of data, or run for anything else
+interface GattOp {
+  data?: number[];
+  run?: () => Promise<unknown>;
+  key?: string;                   // coalescing slot
+  batch: boolean;                 // may share an 0xA9 frame with its neighbours
+  withResponse: boolean;
+  done: { resolve: (v: unknown) => void; reject: (e: unknown) => void }[];
+}
+
+const BATCH_MAX_ENTRIES = 8;    // firmware limit per 0xA9 frame
+const BATCH_MAX_FRAME = 20;     // fits the default ATT MTU (23)
+
 /**
  * EDGE Smart Glasses Controller
  * 
@@ -48,7 +183,13 @@ export class Glasses {
   private device: BluetoothDevice | null = null;
   private server: BluetoothRemoteGATTServer | null = null;
   private characteristic: BluetoothRemoteGATTCharacteristic | null = null;
+  private telemetryChar: BluetoothRemoteGATTCharacteristic | null = null;
+  private telemetryCb: ((t: Telemetry) => void) | null = null;
   private _connected = false;
+  private queue: GattOp[] = [];
+  private pumping = false;
+  private realtime = false;
+  private stats = { queued: 0, coalesced: 0, batched: 0, writes: 0 };
 
   /**
    * Check if currently connected
@@ -96,12 +237,21 @@ export class Glasses {
       // Get service and characteristic
       const service = await this.server.getPrimaryService(SERVICE_UUID);
       this.characteristic = await service.getCharacteristic(CHAR_UUID);
+      // Telemetry is optional: older firmware has no FF02
+      this.telemetryChar = await service.getCharacteristic(TELEMETRY_UUID).catch(() => null);
+      this.telemetryChar?.addEventListener('characteristicvaluechanged', () => {
+        const value = this.telemetryChar?.value;
+        if (value && value.getUint8(0) === TELEMETRY_TYPE_STATUS && this.telemetryCb) {
+          this.telemetryCb(Glasses.parseTelemetry(value));
+        }
+      });
 
       this._connected = true;
 
       // Handle disconnection
       this.device.addEventListener('gattserverdisconnected', () => {
         this._connected = false;
+        this.dropQueue();
         console.log('EDGE Glasses disconnected');
       });
 
@@ -119,9 +269,12 @@ export class Glasses {
       this.server.disconnect();
     }
     this._connected = false;
+    this.dropQueue();
     this.device = null;
     this.server = null;
     this.characteristic = null;
+    this.telemetryChar = null;
+    this.telemetryCb = null;
   }
 
   // -------------------------------------------------------------------------
@@ -129,15 +282,199 @@ export class Glasses {
   // -------------------------------------------------------------------------
 
   /**
-   * Send raw bytes to glasses
+   * Queue a GATT operation. Web Bluetooth rejects overlapping operations
+   * on a device ("GATT operation already in progress"), so every write,
+   * read and notification change goes through one queue and runs in
+   * order. A write with a key replaces a queued, not yet started write
+   * with the same key: the stale one is dropped and the new one joins the
+   * tail, so it still goes out after everything queued before it (latest
+   * value wins; both callers resolve when it is sent). Consecutive
+   * batchable writes are merged into one 0xA9 frame.
    */
-  private async send(data: number[]): Promise<void> {
+  private enqueue<T>(op: Omit<GattOp, 'done'>): Promise<T> {
     if (!this.isConnected || !this.characteristic) {
-      throw new Error('Not connected. Call connect() first.');
+      return Promise.reject(new Error('Not connected. Call connect() first.'));
     }
+    return new Promise<T>((resolve, reject) => {
+      this.stats.queued++;
+      const waiter = { resolve: resolve as (v: unknown) => void, reject };
+      const stale = op.key === undefined ? -1 : this.queue.findIndex((q) => q.key === op.key);
+      if (stale >= 0) {
+        // The firmware applies writes in order and the last action wins, so
+        // the new value must not overtake ops queued after the stale one
+        const [old] = this.queue.splice(stale, 1);
+        this.queue.push({ ...op, done: [...old.done, waiter] });
+        this.stats.coalesced++;
+      } else {
+        this.queue.push({ ...op, done: [waiter] });
+      }
+      void this.pump();
+    });
+  }
+
+  private async pump(): Promise<void> {
+    if (this.pumping) return;
+    this.pumping = true;
+    try {
+      while (this.queue.length > 0) {
+        const ops = this.takeNext();
+        try {
+          const result = await this.execute(ops);
+          ops.forEach((op) => op.done.forEach((d) => d.resolve(result)));
+        } catch (error) {
+          ops.forEach((op) => op.done.forEach((d) => d.reject(error)));
+        }
+      }
+    } finally {
+      this.pumping = false;
+    }
+  }
 
+  // Next operation, with the batchable writes that follow it merged in
+  private takeNext(): GattOp[] {
+    const ops = [this.queue.shift()!];
+    if (!ops[0].batch) return ops;
+    let size = 1 + ops[0].data!.length + 1;
+    while (ops.length < BATCH_MAX_ENTRIES && this.queue.length > 0) {
+      const next = this.queue[0];
+      if (!next.batch || next.withResponse !== ops[0].withResponse ||
+          size + next.data!.length + 1 > BATCH_MAX_FRAME) {
+        break;
+      }
+      size += next.data!.length + 1;
+      ops.push(this.queue.shift()!);
+    }
+    return ops;
+  }
+
+  private async execute(ops: GattOp[]): Promise<unknown> {
+    if (!this.isConnected || !this.characteristic) {
+      throw new Error('Not connected. Call connect() first.');
+    }
+    if (ops[0].run) {
+      return ops[0].run();
+    }
+    let data = ops[0].data!;
+    if (ops.length > 1) {
+      data = [0xA9];
+      for (const op of ops) {
+        data.push(op.data![0], op.data!.length - 1, ...op.data!.slice(1));
+      }
+      this.stats.batched += ops.length;
+    }
     const buffer = new Uint8Array(data);
-    await this.characteristic.writeValueWithResponse(buffer);
+    if (ops[0].withResponse) {
+      await this.characteristic.writeValueWithResponse(buffer);
+    } else {
+      await this.characteristic.writeValueWithoutResponse(buffer);
+    }
+    this.stats.writes++;
+    return undefined;
+  }
+
+  // Fail everything still queued (disconnect)
+  private dropQueue(): void {
+    const error = new Error('Disconnected');
+    for (const op of this.queue.splice(0)) {
+      op.done.forEach((d) => d.reject(error));
+    }
+  }
+
+  /**
+   * Send raw bytes to glasses
+   *
+   * @param withResponse Wait for the ATT write response; false uses
+   *   write-without-response for real-time streams
+   */
+  private send(data: number[], withResponse = true): Promise<void> {
+    return this.enqueue({ data, withResponse, batch: false });
+  }
+
+  // A parameter command: may share a batch frame with its neighbours
+  private sendConfig(cmd: number[]): Promise<void> {
+    return this.enqueue({ data: cmd, withResponse: true, batch: true });
+  }
+
+  // A streamed value: only the newest queued one per key is sent
+  private sendLatest(key: string, data: number[], batch: boolean): Promise<void> {
+    return this.enqueue({ key, data, withResponse: !this.realtime, batch });
+  }
+
+  // Any other GATT operation, in queue order
+  private gatt<T>(run: () => Promise<T>): Promise<T> {
+    return this.enqueue({ run, withResponse: true, batch: false });
+  }
+
+  // Select a report with 0xA8 and read it back, as one queued operation
+  private query(what: number): Promise<DataView> {
+    return this.gatt(async () => {
+      await this.characteristic!.writeValueWithResponse(new Uint8Array([0xA8, what]));
+      return this.characteristic!.readValue();
+    });
+  }
+
+  /**
+   * Send several commands as one 0xA9 batch frame
+   * The firmware applies the whole frame in one step (one session restart)
+   *
+   * @param commands Encoded commands, each [opcode, ...args]
+   */
+  private async sendBatch(commands: number[][]): Promise<void> {
+    const frame = [0xA9];
+    for (const cmd of commands) {
+      frame.push(cmd[0], cmd.length - 1, ...cmd.slice(1));
+    }
+    await this.send(frame);
+  }
+
+  /**
+   * Real-time mode for feedback loops: setOpacity(), hold() and
+   * setBrightness() go out as write-without-response. They always
+   * coalesce to the newest queued value.
+   */
+  setRealtime(enabled: boolean): void {
+    this.realtime = enabled;
+  }
+
+  /**
+   * Write queue counters
+   */
+  get queueStats(): QueueStats {
+    return { ...this.stats, pending: this.queue.length };
+  }
+
+  // -------------------------------------------------------------------------
+  // Command Encoding
+  // -------------------------------------------------------------------------
+
+  private static strobeCmd(startHz: number, endHz: number): number[] {
+    startHz = Math.max(1, Math.min(50, Math.floor(startHz)));
+    endHz = Math.max(1, Math.min(50, Math.floor(endHz)));
+    return [0xA1, startHz, endHz];
+  }
+
+  private static brightnessCmd(percent: number): number[] {
+    percent = Math.max(0, Math.min(100, Math.floor(percent)));
+    return [0xA2, percent];
+  }
+
+  private static breathingCmd(
+    inhale: number,
+    holdInEnd: number,
+    exhale: number,
+    holdOutEnd: number
+  ): number[] {
+    // Convert seconds to 0.1s units (max 25.5s)
+    const inh = Math.max(0, Math.min(255, Math.floor(inhale * 10)));
+    const hIn = Math.max(0, Math.min(255, Math.floor(holdInEnd * 10)));
+    const exh = Math.max(0, Math.min(255, Math.floor(exhale * 10)));
+    const hOut = Math.max(0, Math.min(255, Math.floor(holdOutEnd * 10)));
+    return [0xA3, inh, hIn, exh, hOut];
+  }
+
+  private static durationCmd(minutes: number): number[] {
+    minutes = Math.max(1, Math.min(60, Math.floor(minutes)));
+    return [0xA4, minutes];
   }
 
   // -------------------------------------------------------------------------
@@ -152,7 +489,7 @@ export class Glasses {
    */
   async setOpacity(value: number): Promise<void> {
     value = Math.max(0, Math.min(255, Math.floor(value)));
-    await this.send([value]);
+    await this.sendLatest('override', [value], false);
   }
 
   /**
@@ -181,9 +518,7 @@ export class Glasses {
    * @param endHz Ending frequency 1-50 Hz
    */
   async setStrobe(startHz: number, endHz: number): Promise<void> {
-    startHz = Math.max(1, Math.min(50, Math.floor(startHz)));
-    endHz = Math.max(1, Math.min(50, Math.floor(endHz)));
-    await this.send([0xA1, startHz, endHz]);
+    await this.sendConfig(Glasses.strobeCmd(startHz, endHz));
   }
 
   /**
@@ -193,8 +528,7 @@ export class Glasses {
    * @param percent Brightness 0-100%
    */
   async setBrightness(percent: number): Promise<void> {
-    percent = Math.max(0, Math.min(100, Math.floor(percent)));
-    await this.send([0xA2, percent]);
+    await this.sendLatest('brightness', Glasses.brightnessCmd(percent), true);
   }
 
   /**
@@ -212,12 +546,7 @@ export class Glasses {
     exhale: number,
     holdOutEnd: number
   ): Promise<void> {
-    // Convert seconds to 0.1s units (max 25.5s)
-    const inh = Math.max(0, Math.min(255, Math.floor(inhale * 10)));
-    const hIn = Math.max(0, Math.min(255, Math.floor(holdInEnd * 10)));
-    const exh = Math.max(0, Math.min(255, Math.floor(exhale * 10)));
-    const hOut = Math.max(0, Math.min(255, Math.floor(holdOutEnd * 10)));
-    await this.send([0xA3, inh, hIn, exh, hOut]);
+    await this.sendConfig(Glasses.breathingCmd(inhale, holdInEnd, exhale, holdOutEnd));
   }
 
   /**
@@ -227,8 +556,7 @@ export class Glasses {
    * @param minutes Session length 1-60 minutes
    */
   async setDuration(minutes: number): Promise<void> {
-    minutes = Math.max(1, Math.min(60, Math.floor(minutes)));
-    await this.send([0xA4, minutes]);
+    await this.sendConfig(Glasses.durationCmd(minutes));
   }
 
   /**
@@ -238,7 +566,7 @@ export class Glasses {
    */
   async hold(duty: number): Promise<void> {
     duty = Math.max(0, Math.min(100, Math.floor(duty)));
-    await this.send([0xA5, duty]);
+    await this.sendLatest('override', [0xA5, duty], true);
   }
 
   /**
@@ -255,12 +583,322 @@ export class Glasses {
     await this.send([0xA7]);
   }
 
+  // -------------------------------------------------------------------------
+  // Telemetry
+  // -------------------------------------------------------------------------
+
+  private static parseTelemetry(v: DataView): Telemetry {
+    if (v.byteLength < 15 || v.getUint8(0) !== TELEMETRY_TYPE_STATUS) {
+      throw new Error('Unexpected telemetry packet');
+    }
+    const flags = v.getUint8(1);
+    return {
+      sessionRunning: (flags & 0x01) !== 0,
+      override: (flags & 0x02) !== 0,
+      progress: v.getUint16(2, true) / 256,
+      hz: v.getUint16(4, true) / 256,
+      breathPhase: v.getUint8(6),
+      duty: v.getUint8(7),
+      remainingS: v.getUint16(8, true),
+      brightness: v.getUint8(10),
+      tUs: v.getUint32(11, true),
+    };
+  }
+
+  /**
+   * Set the telemetry notify period
+   * @param periodMs 10-2550 ms in 10 ms steps, 0 stops notifications
+   */
+  async setTelemetryRate(periodMs: number): Promise<void> {
+    let period = Math.max(0, Math.min(255, Math.round(periodMs / 10)));
+    if (periodMs > 0) period = Math.max(1, period);
+    await this.sendConfig([0xAA, period]);
+  }
+
+  /**
+   * Receive live session status (progress, Hz, breath phase, duty, time left)
+   * straight from the firmware engine
+   *
+   * @param callback Called with each status packet
+   * @param periodMs Notify period (10-2550 ms)
+   */
+  async onTelemetry(callback: (t: Telemetry) => void, periodMs = 100): Promise<void> {
+    if (!this.isConnected || !this.telemetryChar) {
+      throw new Error('Not connected. Call connect() first.');
+    }
+    await this.setTelemetryRate(periodMs);
+    this.telemetryCb = callback;
+    const char = this.telemetryChar;
+    await this.gatt(() => char.startNotifications());
+  }
+
+  /**
+   * Stop telemetry notifications
+   */
+  async offTelemetry(): Promise<void> {
+    if (this.isConnected && this.telemetryChar && this.telemetryCb) {
+      const char = this.telemetryChar;
+      await this.gatt(() => char.stopNotifications());
+    }
+    this.telemetryCb = null;
+  }
+
+  /**
+   * Read one status packet without subscribing
+   */
+  async readTelemetry(): Promise<Telemetry> {
+    if (!this.isConnected || !this.telemetryChar) {
+      throw new Error('Not connected. Call connect() first.');
+    }
+    const char = this.telemetryChar;
+    return Glasses.parseTelemetry(await this.gatt(() => char.readValue()));
+  }
+
+  // -------------------------------------------------------------------------
+  // Session Programs
+  // -------------------------------------------------------------------------
+
+  /**
+   * Encode segments into the 0xAB program format (header + segments)
+   */
+  static encodeProgram(segments: ProgramSegment[]): Uint8Array {
+    if (segments.length < 1 || segments.length > 16) {
+      throw new Error('A program has 1-16 segments');
+    }
+    const hz = (v: number) => Math.round(Math.max(1, Math.min(50, v)) * 256);
+    const tenths = (v: number) => Math.max(0, Math.min(255, Math.round(v * 10)));
+    const out = new Uint8Array(8 + segments.length * 14);
+    const view = new DataView(out.buffer);
+    segments.forEach((seg, i) => {
+      const o = 8 + i * 14;
+      const holdIn = seg.holdIn ?? [0, 0];
+      const holdOut = seg.holdOut ?? [0, 0];
+      view.setUint16(o, Math.max(1, Math.min(3600, Math.round(seg.duration))), true);
+      view.setUint16(o + 2, hz(seg.strobeStart), true);
+      view.setUint16(o + 4, hz(seg.strobeEnd), true);
+      out[o + 6] = tenths(seg.inhale ?? 4);
+      out[o + 7] = tenths(seg.exhale ?? 4);
+      out[o + 8] = tenths(holdIn[0]);
+      out[o + 9] = tenths(holdIn[1]);
+      out[o + 10] = tenths(holdOut[0]);
+      out[o + 11] = tenths(holdOut[1]);
+      out[o + 12] = Math.max(0, Math.min(100, Math.round(seg.brightness ?? 100)));
+      out[o + 13] = EASING[seg.easing ?? 'linear'];
+    });
+    out[0] = 1;
+    out[1] = segments.length;
+    out[2] = 14;
+    view.setUint32(4, crc32(out.subarray(8)), true);
+    return out;
+  }
+
+  /**
+   * Upload, store and start a multi-segment session program. The device
+   * keeps it across power cycles and runs it instead of the strobe,
+   * breathing and duration parameters until one of those is set.
+   *
+   * @throws Error if the device rejected the program
+   */
+  async uploadProgram(segments: ProgramSegment[]): Promise<ProgramStatus> {
+    const program = Glasses.encodeProgram(segments);
+    await this.send([0xAB, 0x01, program.length & 0xff, program.length >> 8]);
+    for (let off = 0; off < program.length; off += PROGRAM_CHUNK) {
+      const chunk = program.subarray(off, off + PROGRAM_CHUNK);
+      await this.send([0xAB, 0x02, off & 0xff, off >> 8, ...chunk]);
+    }
+    await this.send([0xAB, 0x03]);
+    const status = await this.programStatus();
+    if (status.result !== 0 && status.result !== 5) {
+      throw new Error(`Program rejected (status ${status.result})`);
+    }
+    return status;
+  }
+
+  /**
+   * Restart the session with the stored program
+   */
+  async runProgram(): Promise<void> {
+    await this.send([0xAB, 0x05]);
+  }
+
+  /**
+   * Erase the stored program and go back to the session parameters
+   */
+  async clearProgram(): Promise<void> {
+    await this.send([0xAB, 0x04]);
+  }
+
+  /**
+   * Read the program report
+   */
+  async programStatus(): Promise<ProgramStatus> {
+    const v = await this.query(0x03);
+    if (v.byteLength < 12 || v.getUint8(0) !== 0x02) {
+      throw new Error('Unexpected program report');
+    }
+    return {
+      result: v.getUint8(1),
+      uploaded: v.getUint8(2) !== 0,
+      segments: v.getUint8(3),
+      crc: v.getUint32(4, true),
+      totalS: v.getUint32(8, true),
+    };
+  }
+
+  // -------------------------------------------------------------------------
+  // Connection Parameters
+  // -------------------------------------------------------------------------
+
+  /**
+   * Choose the connection parameters the device asks for
+   * @param profile 'lowLatency' (7.5-15 ms, for real-time streams),
+   *                'lowPower' (100-200 ms with slave latency) or
+   *                'auto' (low power while a timed session runs)
+   */
+  async setConnectionProfile(profile: ConnectionProfile = 'auto'): Promise<void> {
+    const index = CONN_PROFILES.indexOf(profile);
+    if (index < 0) {
+      throw new Error(`Unknown connection profile: ${profile}`);
+    }
+    await this.sendConfig([0xAC, index]);
+  }
+
+  /**
+   * Read the connection parameters in use
+   */
+  async connectionParams(): Promise<ConnectionParams> {
+    const v = await this.query(0x05);
+    if (v.byteLength < 10 || v.getUint8(0) !== 0x04) {
+      throw new Error('Unexpected connection report');
+    }
+    const requested = v.getUint8(2);
+    return {
+      profile: CONN_PROFILES[v.getUint8(1)] ?? 'auto',
+      requested: requested === 0 ? 'none' : CONN_PROFILES[requested] ?? 'none',
+      connected: v.getUint8(3) !== 0,
+      intervalMs: v.getUint16(4, true) * 1.25,
+      latency: v.getUint16(6, true),
+      timeoutMs: v.getUint16(8, true) * 10,
+    };
+  }
+
+  // -------------------------------------------------------------------------
+  // Lens Layout
+  // -------------------------------------------------------------------------
+
+  /**
+   * Set one lens's strobe and duty (boards with separately wired lenses)
+   * @param lens 0 = left, 1 = right, ALL_LENSES = both
+   * @param strobe false leaves the lens on the breathing envelope only
+   * @param phase Strobe phase offset as a fraction of a cycle (0.5 = opposite)
+   * @param scale Duty scale, 0-100% of the envelope
+   */
+  async setLens(lens: number, strobe = true, phase = 0, scale = 100): Promise<void> {
+    await this.sendConfig(lensCmd(lens, strobe, phase, scale));
+  }
+
+  /**
+   * Apply a per-eye pattern in one step: 'together', 'alternate' (eyes half
+   * a cycle apart), 'left' or 'right' (the other lens stays clear)
+   */
+  async setEyePattern(pattern: EyePattern = 'together'): Promise<void> {
+    const layout = EYE_PATTERNS[pattern];
+    if (!layout) {
+      throw new Error(`Unknown eye pattern: ${pattern}`);
+    }
+    await this.sendBatch(layout.map(([strobe, phase, scale], i) => lensCmd(i, strobe, phase, scale)));
+  }
+
+  /**
+   * Read the lens count and per-lens layout
+   */
+  async lensLayout(): Promise<LensLayout[]> {
+    const v = await this.query(0x06);
+    if (v.byteLength < 2 || v.getUint8(0) !== 0x05 || v.byteLength < 2 + 3 * v.getUint8(1)) {
+      throw new Error('Unexpected lens report');
+    }
+    const lenses: LensLayout[] = [];
+    for (let i = 0; i < v.getUint8(1); i++) {
+      lenses.push({
+        lens: i,
+        strobe: v.getUint8(2 + 3 * i) !== 0,
+        phase: v.getUint8(3 + 3 * i) / 256,
+        scale: v.getUint8(4 + 3 * i),
+      });
+    }
+    return lenses;
+  }
+
+  // -------------------------------------------------------------------------
+  // Lens Calibration
+  // -------------------------------------------------------------------------
+
+  /**
+   * Hold a raw PWM value (0-1024) on every lens, bypassing the table.
+   * For measuring the lens response; stops any running session.
+   */
+  async holdRaw(raw: number): Promise<void> {
+    const v = Math.max(0, Math.min(1024, Math.round(raw)));
+    await this.send([0xAE, 0x04, v & 0xff, v >> 8]);
+  }
+
+  /**
+   * Store a measured response table and use it
+   * @param raw 101 raw PWM values (0-1024) for duty 0-100%, starting at 0
+   *            and never decreasing
+   * @returns The calibration report after the commit
+   */
+  async uploadLensTable(raw: number[]): Promise<LensTable> {
+    if (raw.length !== LENS_TABLE_SIZE) {
+      throw new Error(`Table needs ${LENS_TABLE_SIZE} entries`);
+    }
+    if (raw[0] !== 0 || raw.some((v, i) => v > 1024 || (i > 0 && v < raw[i - 1]))) {
+      throw new Error('Table must start at 0, never decrease and stay <= 1024');
+    }
+    for (let start = 0; start < raw.length; start += LENS_TABLE_CHUNK) {
+      const cmd = [0xAE, 0x01, start];
+      for (const v of raw.slice(start, start + LENS_TABLE_CHUNK)) {
+        cmd.push(v & 0xff, v >> 8);
+      }
+      await this.send(cmd);
+    }
+    await this.send([0xAE, 0x02]);
+    const table = await this.lensTable();
+    if (table.result !== 0) {
+      throw new Error(`Lens table rejected: ${table.result}`);
+    }
+    return table;
+  }
+
+  /**
+   * Erase the stored table and go back to the built-in one
+   */
+  async resetLensTable(): Promise<void> {
+    await this.send([0xAE, 0x03]);
+  }
+
+  /**
+   * Read the response table in use
+   */
+  async lensTable(): Promise<LensTable> {
+    const v = await this.query(0x07);
+    if (v.byteLength < 3 + 2 * LENS_TABLE_SIZE || v.getUint8(0) !== 0x06) {
+      throw new Error('Unexpected calibration report');
+    }
+    const raw: number[] = [];
+    for (let i = 0; i < LENS_TABLE_SIZE; i++) {
+      raw.push(v.getUint16(3 + 2 * i, true));
+    }
+    return { stored: v.getUint8(1) !== 0, result: v.getUint8(2), raw };
+  }
+
   // -------------------------------------------------------------------------
   // High-level Session Control
   // -------------------------------------------------------------------------
 
   /**
    * Configure and start a complete session
+   * All parameters go out in a single batch write
    * 
    * @param config Session configuration
    */
@@ -276,10 +914,12 @@ export class Glasses {
       brightness = 100
     } = config;
 
-    await this.setBrightness(brightness);
-    await this.setBreathing(inhale, holdInEnd, exhale, holdOutEnd);
-    await this.setStrobe(strobeStart, strobeEnd);
-    await this.setDuration(duration);  // This restarts the session
+    await this.sendBatch([
+      Glasses.brightnessCmd(brightness),
+      Glasses.breathingCmd(inhale, holdInEnd, exhale, holdOutEnd),
+      Glasses.strobeCmd(strobeStart, strobeEnd),
+      Glasses.durationCmd(duration),
+    ]);
   }
 
   // -------------------------------------------------------------------------
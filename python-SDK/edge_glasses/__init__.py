@@ -3,7 +3,29 @@ EDGE Glasses Python SDK
 Control smart LCD glasses over Bluetooth Low Energy
 """
 
-from .glasses import Glasses, ScanResult
+from .glasses import (
+    Glasses,
+    ScanResult,
+    TraceRecord,
+    Telemetry,
+    ProgramSegment,
+    ProgramStatus,
+    ConnectionParams,
+    AdvertisingStatus,
+    PacingStatus,
+    EnergyReport,
+    LensLayout,
+    LensTable,
+    BenchStat,
+    BenchRow,
+    BenchReport,
+    ClockSync,
+    Marker
+)
+from .streaming import StreamingController, StreamStats
+from .group import GlassesGroup, GroupResult
+from .bench import LinkBench, LinkBenchResult, LatencyStats, Throughput
+from .lsl import LSLMarkerOutlet
 from .exceptions import (
     GlassesError,
     ConnectionError,
@@ -16,6 +38,30 @@ __version__ = "1.0.0"
 __all__ = [
     "Glasses",
     "ScanResult", 
+    "TraceRecord",
+    "Telemetry",
+    "ProgramSegment",
+    "ProgramStatus",
+    "ConnectionParams",
+    "AdvertisingStatus",
+    "PacingStatus",
+    "EnergyReport",
+    "LensLayout",
+    "LensTable",
+    "BenchStat",
+    "BenchRow",
+    "BenchReport",
+    "ClockSync",
+    "Marker",
+    "StreamingController",
+    "StreamStats",
+    "GlassesGroup",
+    "GroupResult",
+    "LinkBench",
+    "LinkBenchResult",
+    "LatencyStats",
+    "Throughput",
+    "LSLMarkerOutlet",
     "GlassesError",
     "ConnectionError",
     "DeviceNotFoundError",
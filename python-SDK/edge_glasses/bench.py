@@ -0,0 +1,328 @@
+"""
+EDGE Glasses - Link benchmark: connect time, write latency, throughput and echo
+"""
+
+import asyncio
+import json
+import math
+import platform
+import time
+from dataclasses import dataclass, field, asdict
+from typing import Dict, List, Optional
+
+from .glasses import Glasses, Telemetry
+from .streaming import StreamingController
+from .exceptions import CommandError
+
+
+@dataclass
+class LatencyStats:
+    """Distribution of one latency measurement, in ms"""
+    count: int = 0
+    lost: int = 0               # Samples that timed out
+    min_ms: float = 0.0
+    p50_ms: float = 0.0
+    p90_ms: float = 0.0
+    p99_ms: float = 0.0
+    max_ms: float = 0.0
+    mean_ms: float = 0.0
+
+    @classmethod
+    def of(cls, samples_s: List[float], lost: int = 0) -> "LatencyStats":
+        """Summarise samples given in seconds (nearest-rank percentiles)"""
+        if not samples_s:
+            return cls(lost=lost)
+        ms = sorted(s * 1000 for s in samples_s)
+        n = len(ms)
+
+        def rank(p: float) -> float:
+            return ms[max(0, math.ceil(p / 100 * n) - 1)]
+
+        return cls(count=n, lost=lost, min_ms=ms[0], p50_ms=rank(50), p90_ms=rank(90),
+                   p99_ms=rank(99), max_ms=ms[-1], mean_ms=sum(ms) / n)
+
+    def __str__(self):
+        if not self.count:
+            return f"no samples ({self.lost} lost)"
+        s = (f"p50 {self.p50_ms:.1f} ms, p99 {self.p99_ms:.1f} ms "
+             f"(min {self.min_ms:.1f}, max {self.max_ms:.1f}, n={self.count})")
+        return s + (f", {self.lost} lost" if self.lost else "")
+
+
+@dataclass
+class Throughput:
+    """Commands sent back to back for a while"""
+    commands: int = 0
+    seconds: float = 0.0        # First write to the closing ping's pong
+    per_s: float = 0.0
+    drain_ms: float = 0.0       # Last write returned to the pong
+
+    def __str__(self):
+        return (f"{self.per_s:.0f} commands/s ({self.commands} in {self.seconds:.2f} s, "
+                f"drain {self.drain_ms:.1f} ms)")
+
+
+@dataclass
+class LinkBenchResult:
+    """Everything one LinkBench run measured (to_json() for tools)"""
+    address: str = ""
+    profile: str = ""
+    connection: Dict[str, object] = field(default_factory=dict)  # ConnectionParams
+    host: Dict[str, str] = field(default_factory=dict)
+    first_connect_ms: float = 0.0       # Including the scan
+    connect: LatencyStats = field(default_factory=LatencyStats)   # Reconnects, cached
+    write_response: LatencyStats = field(default_factory=LatencyStats)
+    write_no_response: LatencyStats = field(default_factory=LatencyStats)
+    throughput: Throughput = field(default_factory=Throughput)
+    stream: Dict[str, float] = field(default_factory=dict)       # StreamingController
+    echo: LatencyStats = field(default_factory=LatencyStats)
+    echo_period_ms: int = 0             # Telemetry period, bounds echo resolution
+
+    def to_dict(self) -> dict:
+        return asdict(self)
+
+    def to_json(self, indent: Optional[int] = 2) -> str:
+        return json.dumps(self.to_dict(), indent=indent)
+
+    def __str__(self):
+        c = self.connection
+        link = (f"{c['interval_ms']:.2f} ms interval, latency {c['latency']}"
+                if c else "unknown")
+        return "\n".join([
+            f"Device:          {self.address} ({self.profile}, {link})",
+            f"First connect:   {self.first_connect_ms:.0f} ms (with scan)",
+            f"Reconnect:       {self.connect}",
+            f"Write (rsp):     {self.write_response}",
+            f"Write (no rsp):  {self.write_no_response}",
+            f"Throughput:      {self.throughput}",
+            f"Stream:          {self.stream.get('sent_per_s', 0):.0f} updates/s, "
+            f"{self.stream.get('writes_per_s', 0):.0f} writes/s, latency "
+            f"{self.stream.get('latency_mean_ms', 0):.1f} ms mean, "
+            f"{self.stream.get('latency_max_ms', 0):.1f} ms max",
+            f"Echo:            {self.echo} (telemetry every {self.echo_period_ms} ms)",
+        ])
+
+
+class LinkBench:
+    """
+    End-to-end link benchmark against real glasses
+
+    Measures, in this order:
+      - connect: the first connect (scan included), then reconnects to the
+        cached device
+      - write_response: a lens hold (0xA5) written with response, the ATT
+        write round trip
+      - write_no_response: a 0xB0 ping written without response until its
+        pong, the link round trip less the device's own turnaround
+      - throughput: lens holds written back to back without response for
+        `seconds`, closed by a ping so the time covers delivery
+      - stream: the same load through a StreamingController, which
+        coalesces to one write per connection interval
+      - echo: a hold written without response until the first telemetry
+        packet (10 ms period) showing its duty
+
+    The lenses flicker during the run and are cleared at the end. Use the
+    same profile and host to compare firmware builds, or one build across
+    profiles.
+
+    Usage:
+        result = await LinkBench(profile="low_latency").run()
+        print(result)
+        open("bench.json", "w").write(result.to_json())
+    """
+
+    ECHO_PERIOD_MS = 10
+    TIMEOUT = 2.0               # Per sample, seconds
+
+    def __init__(self, address: Optional[str] = None, profile: Optional[str] = "low_latency",
+                 samples: int = 200, seconds: float = 5.0, connects: int = 5,
+                 log=print):
+        """
+        Args:
+            address: Device to use. None takes the first found.
+            profile: Connection profile to measure with, None leaves it
+            samples: Latency samples per measurement
+            seconds: Length of each throughput run
+            connects: Reconnects timed after the first connect
+            log: Progress output, None for quiet
+        """
+        if profile is not None and profile not in Glasses.CONN_PROFILES:
+            raise ValueError(f"Profile must be one of {Glasses.CONN_PROFILES}")
+        self._address = address
+        self._profile = profile
+        self._samples = max(1, samples)
+        self._seconds = max(0.5, seconds)
+        self._connects = max(0, connects)
+        self._log = log or (lambda *_a: None)
+
+    async def run(self) -> LinkBenchResult:
+        """Run every measurement on one device"""
+        result = LinkBenchResult()
+        result.host = {"platform": platform.platform(), "python": platform.python_version(),
+                       "time": time.strftime("%Y-%m-%dT%H:%M:%S%z")}
+        glasses = Glasses(address=self._address)
+
+        self._log("Connecting...")
+        t0 = time.perf_counter()
+        await glasses.connect()
+        result.first_connect_ms = (time.perf_counter() - t0) * 1000
+        result.address = glasses.address
+        try:
+            result.connect = await self.measure_connect(glasses)
+            if self._profile is not None:
+                await glasses.set_connection_profile(self._profile)
+                await asyncio.sleep(1.0)        # Parameter update takes a few events
+            params = await glasses.connection_params()
+            result.profile = params.profile
+            result.connection = asdict(params)
+
+            self._log(f"Link: {params}")
+            self._log("Write round trips...")
+            result.write_response = await self.measure_write_response(glasses)
+            result.write_no_response = await self.measure_write_no_response(glasses)
+            self._log("Throughput...")
+            result.throughput = await self.measure_throughput(glasses)
+            result.stream = await self.measure_stream(glasses)
+            self._log("Echo...")
+            result.echo_period_ms = self.ECHO_PERIOD_MS
+            result.echo = await self.measure_echo(glasses)
+        finally:
+            if glasses.is_connected:
+                try:
+                    await glasses.clear()
+                except CommandError:
+                    pass
+            await glasses.disconnect()
+        return result
+
+    async def measure_connect(self, glasses: Glasses) -> LatencyStats:
+        """Disconnect and reconnect `connects` times (the device is cached)"""
+        times = []
+        lost = 0
+        for _ in range(self._connects):
+            await glasses.disconnect()
+            await asyncio.sleep(0.5)
+            t0 = time.perf_counter()
+            try:
+                await glasses.connect()
+                times.append(time.perf_counter() - t0)
+            except Exception:
+                lost += 1
+                await glasses.connect()
+        return LatencyStats.of(times, lost)
+
+    async def measure_write_response(self, glasses: Glasses) -> LatencyStats:
+        times = []
+        for i in range(self._samples):
+            t0 = time.perf_counter()
+            await glasses._send(bytes([0xA5, 20 if i & 1 else 0]))
+            times.append(time.perf_counter() - t0)
+        return LatencyStats.of(times)
+
+    async def _with_notify(self, glasses: Glasses, fn):
+        await glasses._start_notify()
+        try:
+            return await fn()
+        finally:
+            await glasses._release_notify()
+
+    async def measure_write_no_response(self, glasses: Glasses) -> LatencyStats:
+        async def pings():
+            times = []
+            lost = 0
+            for i in range(self._samples):
+                r = await glasses._ping(i & 0xFF, timeout=self.TIMEOUT)
+                if r is None:
+                    lost += 1
+                else:
+                    times.append(r[2])
+            return LatencyStats.of(times, lost)
+
+        return await self._with_notify(glasses, pings)
+
+    async def measure_throughput(self, glasses: Glasses) -> Throughput:
+        async def flood():
+            n = 0
+            t0 = time.perf_counter()
+            end = t0 + self._seconds
+            while time.perf_counter() < end:
+                await glasses._send(bytes([0xA5, 20 if n & 1 else 0]), response=False)
+                n += 1
+            t_last = time.perf_counter()
+            # Writes arrive in order, so the pong closes the run
+            if await glasses._ping(0xFF, timeout=self.TIMEOUT) is None:
+                raise CommandError("No pong after the throughput run")
+            t_end = time.perf_counter()
+            seconds = t_end - t0
+            return Throughput(commands=n, seconds=seconds, per_s=n / seconds,
+                              drain_ms=(t_end - t_last) * 1000)
+
+        return await self._with_notify(glasses, flood)
+
+    async def measure_stream(self, glasses: Glasses) -> Dict[str, float]:
+        async with StreamingController(glasses) as stream:
+            t0 = time.perf_counter()
+            end = t0 + self._seconds
+            n = 0
+            while time.perf_counter() < end:
+                stream.hold(20 if n & 1 else 0)
+                n += 1
+                await asyncio.sleep(0.001)
+            await stream.flush()
+            seconds = time.perf_counter() - t0
+            s = stream.stats
+        return {
+            "submitted": s.submitted,
+            "sent": s.sent,
+            "writes": s.writes,
+            "seconds": seconds,
+            "sent_per_s": s.sent / seconds,
+            "writes_per_s": s.writes / seconds,
+            "interval_ms": (stream.interval or 0) * 1000,
+            "latency_mean_ms": s.latency_mean_ms,
+            "latency_max_ms": s.latency_max_ms,
+        }
+
+    async def measure_echo(self, glasses: Glasses) -> LatencyStats:
+        loop = asyncio.get_running_loop()
+        waiting: List = [None, 0, 0]    # Future, the duty it waits for, the one before
+
+        def on_telemetry(t: Telemetry) -> None:
+            # Closer to the new duty than the old one: lens scales and the
+            # drive curve may keep the reading off the exact value
+            fut, duty, before = waiting
+            if (fut is not None and not fut.done() and t.override and
+                    abs(t.duty - duty) < abs(t.duty - before)):
+                fut.set_result(time.perf_counter())
+
+        async def echo(duty: int, before: int) -> float:
+            waiting[:] = [loop.create_future(), duty, before]
+            await glasses._send(bytes([0xA5, duty]), response=False)
+            return await asyncio.wait_for(waiting[0], self.TIMEOUT)
+
+        times = []
+        lost = 0
+        prev_cb, prev_period = glasses._telemetry_cb, glasses.telemetry_period_ms
+        await glasses.subscribe_telemetry(on_telemetry, period_ms=self.ECHO_PERIOD_MS)
+        try:
+            # Start from a duty seen in telemetry: after the other runs the
+            # device may already hold the first one waited for
+            try:
+                await echo(60, 20)
+            except asyncio.TimeoutError:
+                pass
+            for i in range(self._samples):
+                duty, before = (60, 20) if i & 1 else (20, 60)
+                t0 = time.perf_counter()
+                try:
+                    times.append(await echo(duty, before) - t0)
+                except asyncio.TimeoutError:
+                    lost += 1
+        finally:
+            waiting[0] = None
+            if prev_cb is not None:
+                await glasses.subscribe_telemetry(prev_cb, period_ms=prev_period)
+            else:
+                await glasses.unsubscribe_telemetry()
+                await glasses.set_telemetry_rate(prev_period)
+        return LatencyStats.of(times, lost)
@@ -10,11 +10,13 @@ Usage:
     edge-glasses dark              # Darken lenses
     edge-glasses session relax 10  # 10-min relax session
     edge-glasses sleep             # Put to sleep
+    edge-glasses bench --json out.json   # Link benchmark
 """
 
 import asyncio
 import sys
 from edge_glasses import Glasses
+from edge_glasses.bench import LinkBench
 
 
 async def cmd_scan():
@@ -91,6 +93,54 @@ async def cmd_resume():
         print("Session resumed")
 
 
+async def cmd_bench(args: list):
+    """Link benchmark"""
+    address = None
+    profile = "low_latency"
+    samples = 200
+    seconds = 5.0
+    json_out = None
+    i = 0
+    while i < len(args):
+        a = args[i]
+        value = args[i + 1] if i + 1 < len(args) else None
+        if a == "--profile" and value:
+            profile = None if value == "keep" else value
+            i += 1
+        elif a == "--samples" and value:
+            samples = int(value)
+            i += 1
+        elif a == "--seconds" and value:
+            seconds = float(value)
+            i += 1
+        elif a == "--json":
+            # File name, or "-" (also when none follows) for stdout
+            if value and not value.startswith("--"):
+                json_out = value
+                i += 1
+            else:
+                json_out = "-"
+        elif not a.startswith("--") and address is None:
+            address = a
+        else:
+            print(f"Unknown option: {a}")
+            return
+        i += 1
+
+    quiet = json_out == "-"
+    bench = LinkBench(address, profile=profile, samples=samples, seconds=seconds,
+                      log=None if quiet else print)
+    result = await bench.run()
+    if quiet:
+        print(result.to_json())
+        return
+    print(result)
+    if json_out:
+        with open(json_out, "w") as f:
+            f.write(result.to_json() + "\n")
+        print(f"Results written to {json_out}")
+
+
 def print_help():
     print(__doc__)
     print("Commands:")
@@ -102,6 +152,11 @@ def print_help():
     print("  session <type> <mins>    Start session (relax/focus/meditate/sleep)")
     print("  resume                   Resume/restart session")
     print("  sleep                    Put device to sleep")
+    print("  bench [address] [opts]   Link benchmark: connect, write latency, throughput, echo")
+    print("      --profile <p>        low_latency (default), low_power, auto or keep")
+    print("      --samples <n>        Latency samples per measurement (default 200)")
+    print("      --seconds <s>        Throughput run length (default 5)")
+    print("      --json [file]        JSON to a file, or alone for JSON only on stdout")
 
 
 async def main():
@@ -146,6 +201,9 @@ async def main():
         elif cmd == "sleep":
             await cmd_sleep()
         
+        elif cmd == "bench":
+            await cmd_bench(sys.argv[2:])
+        
         elif cmd in ("help", "-h", "--help"):
             print_help()
         
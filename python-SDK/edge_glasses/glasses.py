@@ -3,9 +3,14 @@ EDGE Glasses - Main SDK module
 """
 
 import asyncio
+import struct
+import time
+import zlib
 from dataclasses import dataclass
-from typing import Optional, List, Callable
+from typing import Optional, List, Callable, Dict, Tuple
 from bleak import BleakClient, BleakScanner
+from bleak.backends.device import BLEDevice
+from bleak.backends.scanner import AdvertisementData
 from bleak.exc import BleakError
 
 from .exceptions import (
@@ -19,6 +24,7 @@ from .exceptions import (
 # BLE UUIDs
 SERVICE_UUID = "000000ff-0000-1000-8000-00805f9b34fb"
 CHAR_UUID = "0000ff01-0000-1000-8000-00805f9b34fb"
+TELEMETRY_UUID = "0000ff02-0000-1000-8000-00805f9b34fb"
 DEVICE_NAME = "Smart_Glasses"
 
 
@@ -33,6 +39,374 @@ class ScanResult:
         return f"{self.name} ({self.address}) RSSI: {self.rssi}"
 
 
+@dataclass
+class TraceRecord:
+    """One firmware event trace record (see 0xA8 in the API reference)"""
+    seq: int
+    t_us: int       # Device time, low 32 bits of microseconds
+    type: int
+    a: int
+    b: int
+
+    TYPES = {
+        1: "command",
+        2: "phase",
+        3: "edge",
+        4: "session",
+        5: "sleep",
+        6: "dropped",
+    }
+
+    @property
+    def type_name(self) -> str:
+        return self.TYPES.get(self.type, f"0x{self.type:02X}")
+
+    def __str__(self):
+        return f"#{self.seq} {self.t_us}us {self.type_name} a={self.a} b={self.b}"
+
+
+@dataclass
+class Telemetry:
+    """Live session status notified on FF02 (see 0xAA in the API reference)"""
+    flags: int
+    progress: float       # Session progress 0.0-1.0
+    hz: float             # Current strobe frequency (0 when stopped)
+    breath_phase: int     # 0=inhale, 1=hold_in, 2=exhale, 3=hold_out
+    duty: int             # Envelope duty now 0-100%
+    remaining_s: int      # Session time left
+    brightness: int
+    t_us: int             # Device time, low 32 bits of microseconds
+
+    TYPE = 0x01
+    FORMAT = "<BBHHBBHBI"
+    PHASES = ("inhale", "hold_in", "exhale", "hold_out")
+
+    @classmethod
+    def parse(cls, data: bytes) -> "Telemetry":
+        """Decode a status packet"""
+        if len(data) < struct.calcsize(cls.FORMAT) or data[0] != cls.TYPE:
+            raise CommandError("Unexpected telemetry packet")
+        (_type, flags, progress_q8, hz_q8, phase, duty,
+         remaining_s, brightness, t_us) = struct.unpack_from(cls.FORMAT, data)
+        return cls(flags, progress_q8 / 256, hz_q8 / 256, phase, duty,
+                   remaining_s, brightness, t_us)
+
+    @property
+    def session_running(self) -> bool:
+        return bool(self.flags & 0x01)
+
+    @property
+    def override(self) -> bool:
+        return bool(self.flags & 0x02)
+
+    @property
+    def phase_name(self) -> str:
+        return self.PHASES[self.breath_phase & 3]
+
+    @property
+    def advertising(self) -> str:
+        """Advertising policy set with Glasses.set_advertising()"""
+        p = (self.flags >> 4) & 3
+        return Glasses.ADV_POLICIES[p] if p < len(Glasses.ADV_POLICIES) else f"0x{p:02X}"
+
+    @property
+    def pacing(self) -> bool:
+        """Biofeedback pacing on (Glasses.set_pacing())"""
+        return bool(self.flags & 0x40)
+
+    def __str__(self):
+        return (f"{self.progress * 100:.0f}% {self.hz:.2f}Hz {self.phase_name} "
+                f"duty={self.duty}% remaining={self.remaining_s}s")
+
+
+@dataclass
+class ProgramSegment:
+    """One segment of an uploadable session program (see 0xAB)"""
+    duration: float             # seconds (1-3600)
+    strobe_start: float         # Hz (1-50)
+    strobe_end: float           # Hz (1-50)
+    inhale: float = 4.0         # seconds
+    exhale: float = 4.0         # seconds
+    hold_in: tuple = (0.0, 0.0)     # seconds at segment start, end
+    hold_out: tuple = (0.0, 0.0)    # seconds at segment start, end
+    brightness: int = 100       # percent, scaled by set_brightness()
+    easing: str = "linear"      # linear, in, out, in_out
+
+    EASING = {"linear": 0, "in": 1, "out": 2, "in_out": 3}
+
+    def encode(self) -> bytes:
+        def hz(v: float) -> int:
+            return int(round(max(1.0, min(50.0, v)) * 256))
+        def tenths(v: float) -> int:
+            return max(0, min(255, int(round(v * 10))))
+        if self.easing not in self.EASING:
+            raise ValueError(f"Unknown easing: {self.easing}")
+        return struct.pack(
+            "<HHHBBBBBBBB",
+            max(1, min(3600, int(round(self.duration)))),
+            hz(self.strobe_start), hz(self.strobe_end),
+            tenths(self.inhale), tenths(self.exhale),
+            tenths(self.hold_in[0]), tenths(self.hold_in[1]),
+            tenths(self.hold_out[0]), tenths(self.hold_out[1]),
+            max(0, min(100, int(self.brightness))),
+            self.EASING[self.easing],
+        )
+
+
+@dataclass
+class ProgramStatus:
+    """Program report (read after [0xA8, 0x03])"""
+    result: int             # 0 = last upload OK
+    uploaded: bool          # Running the uploaded program
+    segments: int
+    crc: int
+    total_s: int
+
+    RESULTS = {
+        0: "ok",
+        1: "bad length",
+        2: "bad header",
+        3: "CRC mismatch",
+        4: "segment out of range",
+        5: "flash write failed",
+        6: "no stored program",
+    }
+
+    @property
+    def result_name(self) -> str:
+        return self.RESULTS.get(self.result, f"0x{self.result:02X}")
+
+
+@dataclass
+class ConnectionParams:
+    """Connection report (read after [0xA8, 0x05])"""
+    profile: str            # Set with set_connection_profile
+    requested: str          # Last profile the device asked for ("none" yet)
+    connected: bool
+    interval_ms: float
+    latency: int            # Connection events the device may skip
+    timeout_ms: int
+
+    def __str__(self):
+        return (f"{self.interval_ms:.2f} ms, latency {self.latency}, "
+                f"timeout {self.timeout_ms} ms ({self.profile})")
+
+
+@dataclass
+class AdvertisingStatus:
+    """Advertising report (read after [0xA8, 0x0A])"""
+    policy: str             # Set with set_advertising
+    window_s: int           # Fast advertising after wake or disconnect
+    state: str              # "fast", "slow", "off" or "connected"
+    time_ms: Dict[str, int] # Time in each state since wake
+
+    STATES = ("fast", "slow", "off", "connected")
+
+    def __str__(self):
+        times = ", ".join(f"{k} {v / 1000:.0f} s" for k, v in self.time_ms.items())
+        return f"{self.state} ({self.policy}, {self.window_s} s window): {times}"
+
+
+@dataclass
+class PacingStatus:
+    """Pacing report (read after [0xA8, 0x0C])"""
+    mode: str                   # "off", "rr" or "value"
+    search: str                 # "none", "scan" (first pass) or "track"
+    rate: float                 # Breaths/min paced now, 0 when off
+    best_rate: float
+    inhale: float               # Seconds
+    exhale: float
+    heart_rate: float           # bpm, last beat
+    swing_bpm: float            # Breath-locked heart rate swing, last measurement
+    coherence: float            # Share of heart rate variance in that swing, 0-1
+    feedback: float             # Drives the rate (value mode) and strobe, 0-1
+    strobe_hz: Optional[float]  # Target, None = the program's
+    beats: int
+    rejected: int
+    swing_by_rate: Dict[float, Optional[float]]   # Swing per breaths/min, None = not yet
+
+    SEARCH = ("none", "scan", "track")
+
+    def __str__(self):
+        s = f"{self.mode}: {self.rate:.1f}/min ({self.inhale:.1f}s in, {self.exhale:.1f}s out)"
+        if self.mode == "rr":
+            s += (f", {self.search}, best {self.best_rate:.1f}/min, HR {self.heart_rate:.0f}, "
+                  f"swing {self.swing_bpm:.1f} bpm, coherence {self.coherence:.2f}, "
+                  f"{self.beats} beats ({self.rejected} rejected)")
+        if self.strobe_hz is not None:
+            s += f", strobe {self.strobe_hz:.1f} Hz"
+        return s
+
+
+@dataclass
+class EnergyReport:
+    """Energy report (read after [0xA8, 0x0B]), counted since power-up or reset_energy()"""
+    wakes: int                  # Full boots
+    resleeps: int               # Wakes that found the arms closed and slept again
+    total_uah: int              # Estimated charge, all states
+    time_ms: Dict[str, int]     # Per state, see STATES
+    current_ua: Dict[str, int]  # Current the estimate uses
+    charge_uah: Dict[str, int]
+
+    # Radio states, then engine states (both run while awake), then asleep
+    STATES = ("adv_fast", "adv_slow", "adv_off", "connected",
+              "session", "override", "idle", "resleep", "deep_sleep")
+    RADIO_STATES = STATES[:4]
+    ENGINE_STATES = STATES[4:7]
+
+    @property
+    def awake_ms(self) -> int:
+        return sum(self.time_ms.get(k, 0) for k in self.ENGINE_STATES)
+
+    @property
+    def average_ua(self) -> float:
+        """Mean current over all the time counted"""
+        hours = (self.awake_ms + self.time_ms.get("resleep", 0) +
+                 self.time_ms.get("deep_sleep", 0)) / 3600000
+        return self.total_uah / hours if hours > 0 else 0.0
+
+    def __str__(self):
+        s = (f"{self.total_uah} uAh over {self.wakes} wakes ({self.resleeps} resleeps), "
+             f"average {self.average_ua:.0f} uA")
+        for k, ms in self.time_ms.items():
+            s += f"\n  {k:<10} {ms / 1000:>10.1f} s  {self.current_ua[k]:>6} uA  {self.charge_uah[k]:>6} uAh"
+        return s
+
+
+@dataclass
+class LensLayout:
+    """One lens in the lens report (read after [0xA8, 0x06])"""
+    lens: int               # 0 = left, 1 = right
+    strobe: bool            # False = breathing envelope only
+    phase: float            # Strobe phase offset, fraction of a cycle
+    scale: int              # Duty scale, % of the envelope
+
+    def __str__(self):
+        mode = f"strobe +{self.phase:.2f}" if self.strobe else "steady"
+        return f"lens {self.lens}: {mode}, {self.scale}%"
+
+
+@dataclass
+class LensTable:
+    """Calibration report (read after [0xA8, 0x07])"""
+    stored: bool            # Device-calibrated table in use, else built-in
+    result: int             # 0 = last upload step OK
+    raw: List[int]          # Raw PWM (0-1024) for duty 0-100%
+
+    RESULTS = {
+        0: "ok",
+        1: "chunk out of range",
+        2: "bad table",
+        3: "flash write failed",
+    }
+
+    @property
+    def result_name(self) -> str:
+        return self.RESULTS.get(self.result, f"0x{self.result:02X}")
+
+
+@dataclass
+class BenchStat:
+    """Error statistics over one benchmark rate, in microseconds"""
+    count: int
+    min_us: int
+    max_us: int
+    mean_us: float
+    histogram: List[int]    # |error| <= BUCKETS_US[i], last bucket above
+
+    BUCKETS_US = (1, 2, 5, 10, 20, 50, 100, 200, 500)
+
+    @classmethod
+    def parse(cls, data: bytes, offset: int) -> "BenchStat":
+        count, lo, hi, mean = struct.unpack_from("<Hhhh", data, offset)
+        hist = list(struct.unpack_from("<10H", data, offset + 8))
+        return cls(count, lo, hi, mean / 10, hist)
+
+    def __str__(self):
+        return f"{self.min_us:+d}..{self.max_us:+d} us (mean {self.mean_us:+.1f}, n={self.count})"
+
+
+@dataclass
+class BenchRow:
+    """One strobe rate of a benchmark run"""
+    hz: int
+    writes: int             # FF01 writes received meanwhile (BLE load)
+    late_max_us: int        # Worst strobe interrupt lateness
+    period: BenchStat
+    duty: BenchStat
+
+
+@dataclass
+class BenchReport:
+    """Benchmark report (read after [0xA8, 0x08])"""
+    state: str              # "idle", "running", "done" or "aborted"
+    seconds: int            # Per rate
+    stack_free: int         # Lens task stack never used since boot, bytes
+    rows: List[BenchRow]
+
+    STATES = ("idle", "running", "done", "aborted")
+
+
+@dataclass
+class ClockSync:
+    """
+    Device clock estimate from 0xB0 pings (see Glasses.sync_clock)
+
+    Host times are time.perf_counter() seconds, device times esp_timer
+    microseconds since boot.
+    """
+    offset_us: float        # Device minus host time, at host_time
+    host_time: float        # When the offset was measured
+    drift_ppm: float        # Device clock rate error against the host (0 = unknown)
+    rtt_ms: float           # Round trip of the sample used
+    samples: int            # Pongs received in the last burst
+    bursts: int             # Bursts the drift is fitted over
+
+    def device_time(self, host_time: Optional[float] = None) -> int:
+        """Device time (us) at a host time, default now"""
+        if host_time is None:
+            host_time = time.perf_counter()
+        offset = self.offset_us + self.drift_ppm * (host_time - self.host_time)
+        return round(host_time * 1e6 + offset)
+
+    def host_time_of(self, device_us: int) -> float:
+        """Host time of a device time (us)"""
+        return ((device_us - self.offset_us + self.drift_ppm * self.host_time) /
+                (1e6 + self.drift_ppm))
+
+    def __str__(self):
+        return (f"offset {self.offset_us / 1000:.3f} ms, drift {self.drift_ppm:+.1f} ppm, "
+                f"rtt {self.rtt_ms:.1f} ms ({self.samples} samples, {self.bursts} bursts)")
+
+
+@dataclass
+class Marker:
+    """Stimulus event the device recorded (see 0xB2 in the API reference)"""
+    kind: str               # "strobe", "phase" or "session"
+    arg: int                # Dark lens mask / breath phase / session event
+    seq: int                # Firmware sequence number (u16)
+    device_us: int          # Device time, microseconds since boot
+    host_time: Optional[float]  # time.perf_counter() time, None without a clock sync
+
+    TYPE = 0x03
+    KINDS = ("strobe", "phase", "session")
+    SESSION_EVENTS = ("start", "override", "complete", "raw_hold", "benchmark")
+
+    @property
+    def label(self) -> str:
+        """Short text form: "strobe:dark=1", "phase:exhale", "session:start" ..."""
+        if self.kind == "strobe":
+            return f"strobe:dark={self.arg}"
+        if self.kind == "phase":
+            return f"phase:{Telemetry.PHASES[self.arg & 3]}"
+        if self.kind == "session" and self.arg < len(self.SESSION_EVENTS):
+            return f"session:{self.SESSION_EVENTS[self.arg]}"
+        return f"{self.kind}:{self.arg}"
+
+    def __str__(self):
+        return f"#{self.seq} {self.device_us}us {self.label}"
+
+
 class Glasses:
     """
     EDGE Smart Glasses controller
@@ -48,16 +422,32 @@ class Glasses:
         await glasses.disconnect()
     """
     
+    # Devices seen by any scan in this process, by upper-case address.
+    # Connecting through the BLEDevice skips the scan bleak would otherwise
+    # run to resolve a plain address, which is most of a reconnect.
+    _known: Dict[str, BLEDevice] = {}
+    
     def __init__(self, address: Optional[str] = None):
         """
         Initialize glasses controller
         
         Args:
-            address: Optional BLE address. If None, will scan for device.
+            address: Optional BLE address. If None, connects to the first
+                device a scan finds.
         """
         self._address = address
         self._client: Optional[BleakClient] = None
         self._connected = False
+        self._telemetry_cb: Optional[Callable[[Telemetry], None]] = None
+        self._telemetry_period_ms = 100                 # Firmware default until set
+        self._notifying = False
+        self._pongs: Dict[int, asyncio.Future] = {}
+        self._sync_points: List[Tuple[float, float]] = []   # (host time, offset us) per burst
+        self._clock: Optional[ClockSync] = None
+        self._marker_cb: Optional[Callable[[List[Marker]], None]] = None
+        self._marker_last_us: Optional[int] = None     # For unwrapping the 32-bit times
+        self._marker_seq: Optional[int] = None
+        self.markers_lost = 0
         
     @property
     def is_connected(self) -> bool:
@@ -69,10 +459,23 @@ class Glasses:
         """Get the device address"""
         return self._address
     
+    @property
+    def telemetry_period_ms(self) -> int:
+        """Telemetry notify period last set from this controller (0 = off)"""
+        return self._telemetry_period_ms
+    
     # -------------------------------------------------------------------------
     # Connection Management
     # -------------------------------------------------------------------------
     
+    @staticmethod
+    def _is_glasses(device: BLEDevice, adv: AdvertisementData) -> bool:
+        # Service UUID in the advertising data; the name for older firmware
+        if SERVICE_UUID in (u.lower() for u in adv.service_uuids):
+            return True
+        name = adv.local_name or device.name
+        return bool(name and DEVICE_NAME in name)
+    
     @staticmethod
     async def scan(timeout: float = 5.0) -> List[ScanResult]:
         """
@@ -82,49 +485,124 @@ class Glasses:
             timeout: Scan duration in seconds
             
         Returns:
-            List of discovered devices
+            List of discovered devices, strongest first (also cached for connect())
         """
         devices = []
         
-        discovered = await BleakScanner.discover(timeout=timeout)
-        for d in discovered:
-            if d.name and DEVICE_NAME in d.name:
+        discovered = await BleakScanner.discover(timeout=timeout, return_adv=True)
+        for d, adv in discovered.values():
+            if Glasses._is_glasses(d, adv):
+                Glasses._known[d.address.upper()] = d
                 devices.append(ScanResult(
-                    name=d.name,
+                    name=adv.local_name or d.name or DEVICE_NAME,
                     address=d.address,
-                    rssi=d.rssi or -100
+                    rssi=adv.rssi
                 ))
         
         return sorted(devices, key=lambda x: x.rssi, reverse=True)
     
-    async def connect(self, timeout: float = 10.0) -> None:
+    @staticmethod
+    async def find(address: Optional[str] = None, timeout: float = 5.0) -> Optional[BLEDevice]:
+        """
+        Scan until the first EDGE Glasses, or the one at address, is seen
+        
+        Unlike scan() this stops at the first match, usually within one
+        advertising interval, instead of waiting out the whole timeout.
+        
+        Args:
+            address: Device to look for; None takes any EDGE Glasses
+            timeout: Longest scan in seconds
+            
+        Returns:
+            The device (also cached for connect()), or None if not seen
+        """
+        def match(device: BLEDevice, adv: AdvertisementData) -> bool:
+            if address is not None:
+                return device.address.upper() == address.upper()
+            return Glasses._is_glasses(device, adv)
+        
+        device = await BleakScanner.find_device_by_filter(match, timeout=timeout)
+        if device is not None:
+            Glasses._known[device.address.upper()] = device
+        return device
+    
+    @classmethod
+    def known_devices(cls) -> List[str]:
+        """Addresses seen by a scan in this process, which connect without scanning"""
+        return [d.address for d in cls._known.values()]
+    
+    @classmethod
+    def forget(cls, address: Optional[str] = None) -> None:
+        """Drop one address from the device cache, or all of them"""
+        if address is None:
+            cls._known.clear()
+        else:
+            cls._known.pop(address.upper(), None)
+    
+    def _on_disconnected(self, client: BleakClient) -> None:
+        # Link lost (or closed); notifications have to be enabled again
+        # after a reconnect, as the device resets its client config
+        if client is self._client:
+            self._connected = False
+            self._notifying = False
+    
+    async def connect(self, timeout: float = 10.0, scan_timeout: float = 5.0) -> None:
         """
-        Connect to glasses
+        Connect to glasses, or reconnect after the link dropped
+        
+        A device already in the cache (seen by scan(), find() or an earlier
+        connect() in this process) is connected to at once, without a scan.
+        After a dropout the firmware directs its advertising at this host
+        for the first 1.28 s, which such a cached reconnect can catch.
+        Otherwise find() looks for the device, stopping at the first match;
+        directed advertising carries no service UUID, so a scan only finds
+        the device once it advertises normally again.
         
         Args:
             timeout: Connection timeout in seconds
+            scan_timeout: Longest scan for a device not in the cache
             
         Raises:
             DeviceNotFoundError: If no device found during scan
             ConnectionError: If connection fails
         """
-        # Find device if no address specified
-        if not self._address:
-            devices = await self.scan(timeout=5.0)
-            if not devices:
+        device = self._known.get(self._address.upper()) if self._address else None
+        cached = device is not None
+        if device is None:
+            device = await self.find(self._address, timeout=scan_timeout)
+            if device is None:
+                if self._address:
+                    raise DeviceNotFoundError(f"EDGE Glasses {self._address} not found")
                 raise DeviceNotFoundError("No EDGE Glasses found. Is the device powered on?")
-            self._address = devices[0].address
+            self._address = device.address
         
         # Connect
         try:
-            self._client = BleakClient(self._address, timeout=timeout)
-            await self._client.connect()
-            self._connected = True
+            try:
+                await self._connect(device, timeout)
+            except BleakError:
+                if not cached:
+                    raise
+                # Stale cache entry (e.g. the OS dropped the device): look again
+                self.forget(self._address)
+                device = await self.find(self._address, timeout=scan_timeout)
+                if device is None:
+                    raise
+                await self._connect(device, timeout)
         except BleakError as e:
             raise ConnectionError(f"Failed to connect: {e}")
         except asyncio.TimeoutError:
             raise TimeoutError(f"Connection timed out after {timeout}s")
     
+    async def _connect(self, device: BLEDevice, timeout: float) -> None:
+        self._client = BleakClient(device, disconnected_callback=self._on_disconnected,
+                                   timeout=timeout)
+        await self._client.connect()
+        self._connected = True
+        self._notifying = False
+        self._sync_points = []      # The device may have rebooted meanwhile
+        self._clock = None
+    
     async def disconnect(self) -> None:
         """Disconnect from glasses"""
         if self._client:
@@ -135,6 +613,9 @@ class Glasses:
             finally:
                 self._connected = False
                 self._client = None
+                self._telemetry_cb = None
+                self._marker_cb = None
+                self._notifying = False
     
     async def __aenter__(self):
         """Async context manager entry"""
@@ -150,12 +631,14 @@ class Glasses:
     # Low-level Commands
     # -------------------------------------------------------------------------
     
-    async def _send(self, data: bytes) -> None:
+    async def _send(self, data: bytes, response: bool = True) -> None:
         """
         Send raw bytes to glasses
         
         Args:
             data: Bytes to send
+            response: Wait for the ATT write response. False uses
+                write-without-response (no round trip, no delivery report).
             
         Raises:
             ConnectionError: If not connected
@@ -165,10 +648,62 @@ class Glasses:
             raise ConnectionError("Not connected. Call connect() first.")
         
         try:
-            await self._client.write_gatt_char(CHAR_UUID, data, response=True)
+            await self._client.write_gatt_char(CHAR_UUID, data, response=response)
         except BleakError as e:
             raise CommandError(f"Command failed: {e}")
     
+    async def _send_batch(self, commands: List[bytes], response: bool = True) -> None:
+        """
+        Send several commands as one 0xA9 batch frame
+        
+        The firmware applies the whole frame in one step, so parameters
+        that each restart the session only restart it once. Falls back to
+        separate writes if the frame does not fit the negotiated MTU.
+        
+        Args:
+            commands: Encoded commands, each [opcode, args...]
+            response: As for _send()
+        """
+        frame = bytearray([0xA9])
+        for cmd in commands:
+            frame += bytes([cmd[0], len(cmd) - 1]) + cmd[1:]
+        
+        if self._client is not None and len(frame) > self._client.mtu_size - 3:
+            for cmd in commands:
+                await self._send(cmd, response)
+            return
+        await self._send(bytes(frame), response)
+    
+    # -------------------------------------------------------------------------
+    # Command Encoding
+    # -------------------------------------------------------------------------
+    
+    @staticmethod
+    def _strobe_cmd(start_hz: int, end_hz: int) -> bytes:
+        start_hz = max(1, min(50, int(start_hz)))
+        end_hz = max(1, min(50, int(end_hz)))
+        return bytes([0xA1, start_hz, end_hz])
+    
+    @staticmethod
+    def _brightness_cmd(percent: int) -> bytes:
+        percent = max(0, min(100, int(percent)))
+        return bytes([0xA2, percent])
+    
+    @staticmethod
+    def _breathing_cmd(inhale: float, hold_in_end: float,
+                       exhale: float, hold_out_end: float) -> bytes:
+        # Convert seconds to 0.1s units (max 25.5s per phase)
+        inh = max(0, min(255, int(inhale * 10)))
+        h_in = max(0, min(255, int(hold_in_end * 10)))
+        exh = max(0, min(255, int(exhale * 10)))
+        h_out = max(0, min(255, int(hold_out_end * 10)))
+        return bytes([0xA3, inh, h_in, exh, h_out])
+    
+    @staticmethod
+    def _duration_cmd(minutes: int) -> bytes:
+        minutes = max(1, min(60, int(minutes)))
+        return bytes([0xA4, minutes])
+    
     # -------------------------------------------------------------------------
     # Simple Control (Legacy API)
     # -------------------------------------------------------------------------
@@ -217,9 +752,7 @@ class Glasses:
         Example:
             await glasses.set_strobe(12, 8)  # 12Hz -> 8Hz over session
         """
-        start_hz = max(1, min(50, int(start_hz)))
-        end_hz = max(1, min(50, int(end_hz)))
-        await self._send(bytes([0xA1, start_hz, end_hz]))
+        await self._send(self._strobe_cmd(start_hz, end_hz))
     
     async def set_brightness(self, percent: int) -> None:
         """
@@ -230,8 +763,7 @@ class Glasses:
         Args:
             percent: Brightness 0-100%
         """
-        percent = max(0, min(100, int(percent)))
-        await self._send(bytes([0xA2, percent]))
+        await self._send(self._brightness_cmd(percent))
     
     async def set_breathing(
         self,
@@ -261,12 +793,7 @@ class Glasses:
             # 4s inhale, 0->4s hold, 4s exhale, 0->4s hold
             await glasses.set_breathing(4.0, 4.0, 4.0, 4.0)
         """
-        # Convert seconds to 0.1s units (max 25.5s per phase)
-        inh = max(0, min(255, int(inhale * 10)))
-        h_in = max(0, min(255, int(hold_in_end * 10)))
-        exh = max(0, min(255, int(exhale * 10)))
-        h_out = max(0, min(255, int(hold_out_end * 10)))
-        await self._send(bytes([0xA3, inh, h_in, exh, h_out]))
+        await self._send(self._breathing_cmd(inhale, hold_in_end, exhale, hold_out_end))
     
     async def set_duration(self, minutes: int) -> None:
         """
@@ -277,8 +804,7 @@ class Glasses:
         Args:
             minutes: Session length 1-60 minutes
         """
-        minutes = max(1, min(60, int(minutes)))
-        await self._send(bytes([0xA4, minutes]))
+        await self._send(self._duration_cmd(minutes))
     
     async def hold(self, duty: int) -> None:
         """
@@ -300,6 +826,813 @@ class Glasses:
         """Put glasses into deep sleep mode"""
         await self._send(bytes([0xA7]))
     
+    # -------------------------------------------------------------------------
+    # Diagnostics
+    # -------------------------------------------------------------------------
+    
+    async def _query(self, data: bytes) -> bytes:
+        """
+        Select a firmware report with 0xA8 and read it back
+        
+        Args:
+            data: Query bytes following the 0xA8 opcode
+            
+        Returns:
+            Raw report bytes
+        """
+        await self._send(bytes([0xA8]) + data)
+        try:
+            return bytes(await self._client.read_gatt_char(CHAR_UUID))
+        except BleakError as e:
+            raise CommandError(f"Report read failed: {e}")
+    
+    async def read_trace(self, since: int = 0) -> List[TraceRecord]:
+        """
+        Read the firmware event trace
+        
+        The trace is a ring in device RTC memory, so older records are
+        overwritten; it survives deep sleep.
+        
+        Args:
+            since: First sequence number wanted (0 = oldest still held)
+            
+        Returns:
+            Trace records, oldest first
+        """
+        records: List[TraceRecord] = []
+        seq = since
+        while True:
+            report = await self._query(bytes([0x01]) + struct.pack("<I", seq))
+            if len(report) < 16 or report[0] != 0x01:
+                raise CommandError("Unexpected trace report")
+            rec_size, count = report[1], report[2]
+            first, head, _now = struct.unpack_from("<III", report, 4)
+            for i in range(count):
+                t_us, typ, a, b = struct.unpack_from("<IBBH", report, 16 + i * rec_size)
+                records.append(TraceRecord(first + i, t_us, typ, a, b))
+            seq = first + count
+            if count == 0 or seq >= head:
+                return records
+    
+    async def set_trace_mask(self, mask: int) -> None:
+        """
+        Choose which event types the firmware traces
+        
+        Args:
+            mask: Bit n enables trace type n (0xFF = everything incl. strobe edges)
+        """
+        await self._send(bytes([0xA8, 0x02, mask & 0xFF]))
+    
+    async def dump_trace_uart(self) -> None:
+        """Ask the firmware to print its event trace on the UART console"""
+        await self._send(bytes([0xA8, 0x00]))
+    
+    BOOT_STAGES = ("app_main", "nvs", "engine", "first_strobe",
+                   "ble_controller", "ble_host", "advertising")
+    
+    async def boot_timings(self) -> dict:
+        """
+        Read when each firmware boot stage was reached
+        
+        Returns:
+            Stage name -> microseconds since startup (None if not reached),
+            e.g. "first_strobe" is the time-to-first-strobe metric
+        """
+        report = await self._query(bytes([0x04]))
+        if len(report) < 4 or report[0] != 0x03:
+            raise CommandError("Unexpected boot report")
+        count = min(report[1], (len(report) - 4) // 4)
+        stamps = struct.unpack_from(f"<{count}I", report, 4)
+        return {
+            (self.BOOT_STAGES[i] if i < len(self.BOOT_STAGES) else f"stage{i}"): (t or None)
+            for i, t in enumerate(stamps)
+        }
+    
+    # -------------------------------------------------------------------------
+    # Telemetry
+    # -------------------------------------------------------------------------
+    
+    def _on_notify(self, _sender, data: bytearray) -> None:
+        """Dispatch an FF02 notification by its packet type byte"""
+        t = time.perf_counter()
+        if not data:
+            return
+        if data[0] == Telemetry.TYPE and self._telemetry_cb:
+            self._telemetry_cb(Telemetry.parse(bytes(data)))
+        elif data[0] == self.PONG_TYPE and len(data) >= 18:
+            pending = self._pongs.pop(data[1], None)
+            if pending is not None and not pending.done():
+                pending.set_result((t, bytes(data)))
+        elif data[0] == Marker.TYPE and self._marker_cb:
+            self._marker_cb(self._parse_markers(bytes(data)))
+    
+    async def _start_notify(self) -> None:
+        """Enable FF02 notifications, if not on already"""
+        if not self._notifying:
+            await self._client.start_notify(TELEMETRY_UUID, self._on_notify)
+            self._notifying = True
+    
+    async def _release_notify(self) -> None:
+        """Disable FF02 notifications once nothing listens to them"""
+        if self._notifying and self._telemetry_cb is None and self._marker_cb is None:
+            self._notifying = False
+            if self.is_connected:
+                await self._client.stop_notify(TELEMETRY_UUID)
+    
+    async def set_telemetry_rate(self, period_ms: int) -> None:
+        """
+        Set the telemetry notify period
+        
+        Args:
+            period_ms: 10-2550 ms in 10 ms steps, 0 stops notifications
+        """
+        period = max(0, min(255, round(period_ms / 10)))
+        if period_ms > 0:
+            period = max(1, period)
+        await self._send(bytes([0xAA, period]))
+        self._telemetry_period_ms = period * 10
+    
+    async def subscribe_telemetry(self, callback: Callable[[Telemetry], None],
+                                  period_ms: int = 100) -> None:
+        """
+        Receive live session status from the device
+        
+        The state comes from the firmware engine itself, so there is no
+        need to re-derive progress or frequency on the host.
+        
+        Args:
+            callback: Called with each Telemetry packet
+            period_ms: Notify period (10-2550 ms)
+        """
+        if not self.is_connected:
+            raise ConnectionError("Not connected. Call connect() first.")
+        await self.set_telemetry_rate(period_ms)
+        self._telemetry_cb = callback
+        try:
+            await self._start_notify()
+        except BleakError as e:
+            self._telemetry_cb = None
+            raise CommandError(f"Telemetry subscribe failed: {e}")
+    
+    async def unsubscribe_telemetry(self) -> None:
+        """Stop telemetry notifications"""
+        self._telemetry_cb = None
+        try:
+            await self._release_notify()
+        except BleakError as e:
+            raise CommandError(f"Telemetry unsubscribe failed: {e}")
+    
+    async def read_telemetry(self) -> Telemetry:
+        """Read one status packet without subscribing"""
+        if not self.is_connected:
+            raise ConnectionError("Not connected. Call connect() first.")
+        try:
+            return Telemetry.parse(bytes(await self._client.read_gatt_char(TELEMETRY_UUID)))
+        except BleakError as e:
+            raise CommandError(f"Telemetry read failed: {e}")
+    
+    # -------------------------------------------------------------------------
+    # Event Markers
+    # -------------------------------------------------------------------------
+    
+    def _parse_markers(self, data: bytes) -> List[Marker]:
+        """Decode a marker packet, extending the device times to 64 bits"""
+        count, seq = data[1], struct.unpack_from("<H", data, 2)[0]
+        if self._marker_seq is not None:
+            self.markers_lost += (seq - self._marker_seq) & 0xFFFF
+        self._marker_seq = (seq + count) & 0xFFFF
+        
+        if self._clock is not None:
+            ref = self._clock.device_time()
+        else:
+            ref = self._marker_last_us
+        markers = []
+        for i in range(min(count, (len(data) - 4) // 6)):
+            t32, kind, arg = struct.unpack_from("<IBB", data, 4 + 6 * i)
+            if ref is None:
+                ref = t32
+            # Nearest time to the reference with these low 32 bits
+            device_us = ref + ((t32 - ref + (1 << 31)) & 0xFFFFFFFF) - (1 << 31)
+            host = self._clock.host_time_of(device_us) if self._clock else None
+            markers.append(Marker(
+                kind=Marker.KINDS[kind] if kind < len(Marker.KINDS) else f"0x{kind:02X}",
+                arg=arg, seq=(seq + i) & 0xFFFF, device_us=device_us, host_time=host))
+            ref = device_us
+        self._marker_last_us = ref
+        return markers
+    
+    async def subscribe_markers(self, callback: Callable[[List[Marker]], None],
+                                strobe: bool = True, phases: bool = True,
+                                session: bool = True) -> None:
+        """
+        Receive the device's own strobe edge, breath phase and session
+        event times
+        
+        They arrive in batches every 20 ms or so. Run sync_clock() first
+        (and again now and then) to get host times; markers_lost counts
+        markers the link could not keep up with.
+        
+        Args:
+            callback: Called with each batch of Marker
+            strobe, phases, session: Kinds to record
+        """
+        if not self.is_connected:
+            raise ConnectionError("Not connected. Call connect() first.")
+        self._marker_cb = callback
+        self._marker_seq = None
+        try:
+            await self._start_notify()
+        except BleakError as e:
+            self._marker_cb = None
+            raise CommandError(f"Marker subscribe failed: {e}")
+        await self._send(bytes([0xB2, int(strobe) | int(phases) << 1 | int(session) << 2]))
+    
+    async def unsubscribe_markers(self) -> None:
+        """Stop recording and sending markers"""
+        if self.is_connected and self._marker_cb:
+            await self._send(bytes([0xB2, 0]))
+        self._marker_cb = None
+        try:
+            await self._release_notify()
+        except BleakError as e:
+            raise CommandError(f"Marker unsubscribe failed: {e}")
+    
+    # -------------------------------------------------------------------------
+    # Session Programs
+    # -------------------------------------------------------------------------
+    
+    PROGRAM_CHUNK = 17      # Data bytes per 0xAB 0x02 write
+    
+    @staticmethod
+    def encode_program(segments: List[ProgramSegment]) -> bytes:
+        """Encode segments into the 0xAB program format (header + segments)"""
+        if not 1 <= len(segments) <= 16:
+            raise ValueError("A program has 1-16 segments")
+        body = b"".join(seg.encode() for seg in segments)
+        return struct.pack("<BBBBI", 1, len(segments), 14, 0, zlib.crc32(body)) + body
+    
+    async def upload_program(self, segments: List[ProgramSegment]) -> ProgramStatus:
+        """
+        Upload, store and start a multi-segment session program
+        
+        The device keeps the program across power cycles and runs it
+        instead of the set_strobe/set_breathing/set_duration parameters
+        until one of those is called.
+        
+        Args:
+            segments: 1-16 program segments, run in order
+            
+        Returns:
+            Program status after the commit
+            
+        Raises:
+            CommandError: If the device rejected the program
+        """
+        program = self.encode_program(segments)
+        await self._send(bytes([0xAB, 0x01]) + struct.pack("<H", len(program)))
+        for off in range(0, len(program), self.PROGRAM_CHUNK):
+            chunk = program[off:off + self.PROGRAM_CHUNK]
+            await self._send(bytes([0xAB, 0x02]) + struct.pack("<H", off) + chunk)
+        await self._send(bytes([0xAB, 0x03]))
+        status = await self.program_status()
+        if status.result not in (0, 5):
+            raise CommandError(f"Program rejected: {status.result_name}")
+        return status
+    
+    async def run_program(self) -> None:
+        """Restart the session with the stored program"""
+        await self._send(bytes([0xAB, 0x05]))
+    
+    async def clear_program(self) -> None:
+        """Erase the stored program and go back to the session parameters"""
+        await self._send(bytes([0xAB, 0x04]))
+    
+    async def program_status(self) -> ProgramStatus:
+        """Read the program report"""
+        report = await self._query(bytes([0x03]))
+        if len(report) < 12 or report[0] != 0x02:
+            raise CommandError("Unexpected program report")
+        result, uploaded, count, crc, total_s = struct.unpack_from("<BBBII", report, 1)
+        return ProgramStatus(result, bool(uploaded), count, crc, total_s)
+    
+    # -------------------------------------------------------------------------
+    # Connection Parameters
+    # -------------------------------------------------------------------------
+    
+    CONN_PROFILES = ("auto", "low_latency", "low_power")
+    
+    async def set_connection_profile(self, profile: str = "auto") -> None:
+        """
+        Choose the connection parameters the device asks for
+        
+        Args:
+            profile: "low_latency" (7.5-15 ms, for real-time streams),
+                     "low_power" (100-200 ms with slave latency) or
+                     "auto" (low power while a timed session runs)
+        """
+        if profile not in self.CONN_PROFILES:
+            raise ValueError(f"Profile must be one of {self.CONN_PROFILES}")
+        await self._send(bytes([0xAC, self.CONN_PROFILES.index(profile)]))
+    
+    async def connection_params(self) -> ConnectionParams:
+        """Read the connection parameters in use"""
+        report = await self._query(bytes([0x05]))
+        if len(report) < 10 or report[0] != 0x04:
+            raise CommandError("Unexpected connection report")
+        profile, requested, connected, interval, latency, timeout = \
+            struct.unpack_from("<BBBHHH", report, 1)
+        def name(p: int) -> str:
+            return self.CONN_PROFILES[p] if p < len(self.CONN_PROFILES) else f"0x{p:02X}"
+        return ConnectionParams(
+            profile=name(profile),
+            requested="none" if requested == 0 else name(requested),
+            connected=bool(connected),
+            interval_ms=interval * 1.25,
+            latency=latency,
+            timeout_ms=timeout * 10,
+        )
+    
+    # -------------------------------------------------------------------------
+    # Advertising Policy
+    # -------------------------------------------------------------------------
+    
+    ADV_POLICIES = ("fast", "adaptive", "quiet")
+    
+    async def set_advertising(self, policy: str = "adaptive",
+                              window_s: Optional[int] = None) -> None:
+        """
+        Choose how the device advertises while nobody is connected
+        
+        Kept on the device across sleep and power cycles.
+        
+        Args:
+            policy: "fast" (always 20-40 ms), "adaptive" (20-40 ms for
+                    window_s after wake or disconnect, then 500 ms-1 s) or
+                    "quiet" (as adaptive, but none while a session runs;
+                    the device cannot be found until the session ends)
+            window_s: Fast advertising window 0-255 s; None keeps the
+                      current one (30 s by default)
+        """
+        if policy not in self.ADV_POLICIES:
+            raise ValueError(f"Policy must be one of {self.ADV_POLICIES}")
+        cmd = bytes([0xB3, self.ADV_POLICIES.index(policy)])
+        if window_s is not None:
+            if not 0 <= window_s <= 255:
+                raise ValueError("Window must be 0-255 seconds")
+            cmd += bytes([window_s])
+        await self._send(cmd)
+    
+    async def advertising_status(self) -> AdvertisingStatus:
+        """Read the advertising policy and the time spent in each state"""
+        report = await self._query(bytes([0x0A]))
+        if len(report) < 20 or report[0] != 0x09:
+            raise CommandError("Unexpected advertising report")
+        policy, window_s, state = report[1], report[2], report[3]
+        times = struct.unpack_from("<4I", report, 4)
+        return AdvertisingStatus(
+            policy=self.ADV_POLICIES[policy] if policy < len(self.ADV_POLICIES) else f"0x{policy:02X}",
+            window_s=window_s,
+            state=AdvertisingStatus.STATES[state] if state < 4 else f"0x{state:02X}",
+            time_ms=dict(zip(AdvertisingStatus.STATES, times)),
+        )
+    
+    # -------------------------------------------------------------------------
+    # Biofeedback Pacing
+    # -------------------------------------------------------------------------
+    
+    PACING_MODES = ("off", "rr", "value")
+    RR_PER_WRITE = 10
+    
+    async def set_pacing(self, mode: str = "rr", rate_min: float = 4.5, rate_max: float = 7.0,
+                         inhale_ratio: float = 0.4,
+                         strobe_hz: Optional[Tuple[int, int]] = None) -> None:
+        """
+        Let the device pace breathing (and strobe) from a heart rate stream
+        
+        The control loop runs on the glasses: the host only forwards data
+        with send_rr() or send_feedback(). Acts on the running session, from
+        its next breath phase; "off" gives breathing back to the program.
+        
+        Args:
+            mode: "rr" (find the resonance breathing rate from RR intervals),
+                  "value" (breathe from rate_max at feedback 0 to rate_min
+                  at 1) or "off"
+            rate_min: Slowest breathing, breaths/min (3-20)
+            rate_max: Fastest breathing, breaths/min
+            inhale_ratio: Share of each breath spent inhaling (0.1-0.9)
+            strobe_hz: (Hz at feedback 0, Hz at feedback 1), feedback being
+                       coherence in "rr" mode; None keeps the program's strobe
+        """
+        if mode not in self.PACING_MODES:
+            raise ValueError(f"Mode must be one of {self.PACING_MODES}")
+        if not 3.0 <= rate_min <= rate_max <= 20.0:
+            raise ValueError("Rates must be 3-20 breaths/min, rate_min <= rate_max")
+        if not 0.1 <= inhale_ratio <= 0.9:
+            raise ValueError("Inhale ratio must be 0.1-0.9")
+        low, high = strobe_hz if strobe_hz is not None else (0, 0)
+        if strobe_hz is not None and not (1 <= low <= 50 and 1 <= high <= 50):
+            raise ValueError("Strobe must be 1-50 Hz")
+        await self._send(bytes([0xB5, self.PACING_MODES.index(mode),
+                                int(round(rate_min * 10)), int(round(rate_max * 10)),
+                                int(round(inhale_ratio * 100)), int(low), int(high)]))
+    
+    async def send_rr(self, rr_ms: List[float]) -> None:
+        """
+        Forward RR intervals to the pacer, oldest first, as they arrive
+        
+        Sent without write response; the last interval is taken as the beat
+        just reported (a steady delay does not matter).
+        """
+        rr = [max(0, min(0xFFFF, int(round(v)))) for v in rr_ms]
+        for i in range(0, len(rr), self.RR_PER_WRITE):
+            chunk = rr[i:i + self.RR_PER_WRITE]
+            await self._send(struct.pack(f"<B{len(chunk)}H", 0xB6, *chunk), response=False)
+    
+    async def send_feedback(self, value: float) -> None:
+        """Forward a feedback value 0-1 to the pacer ("value" mode)"""
+        v = int(round(max(0.0, min(1.0, value)) * 0xFFFF))
+        await self._send(struct.pack("<BH", 0xB7, v), response=False)
+    
+    async def pacing_status(self) -> PacingStatus:
+        """Read the pacer's rate, search state and heart rate estimates"""
+        report = await self._query(bytes([0x0C]))
+        if len(report) < 28 or report[0] != 0x0B:
+            raise CommandError("Unexpected pacing report")
+        (mode, search, count, k, best, inhale, exhale, rate, best_rate,
+         hr, swing, coherence, feedback, hz, beats, rejected) = \
+            struct.unpack_from("<9B5H2I", report, 1)
+        if len(report) < 28 + 3 * count:
+            raise CommandError("Unexpected pacing report")
+        swing_by_rate = {}
+        for i in range(count):
+            r, v = struct.unpack_from("<BH", report, 28 + 3 * i)
+            swing_by_rate[r / 10] = v / 256 if v else None
+        return PacingStatus(
+            mode=self.PACING_MODES[mode] if mode < len(self.PACING_MODES) else f"0x{mode:02X}",
+            search=PacingStatus.SEARCH[search] if search < 3 else f"0x{search:02X}",
+            rate=rate / 10,
+            best_rate=best_rate / 10,
+            inhale=inhale / 10,
+            exhale=exhale / 10,
+            heart_rate=hr / 256,
+            swing_bpm=swing / 256,
+            coherence=coherence / 0xFFFF,
+            feedback=feedback / 0xFFFF,
+            strobe_hz=hz / 256 if hz else None,
+            beats=beats,
+            rejected=rejected,
+            swing_by_rate=swing_by_rate,
+        )
+    
+    # -------------------------------------------------------------------------
+    # Energy Accounting
+    # -------------------------------------------------------------------------
+    
+    async def energy_report(self) -> EnergyReport:
+        """Read the time and estimated charge per power state"""
+        report = await self._query(bytes([0x0B]))
+        if len(report) < 16 or report[0] != 0x0A:
+            raise CommandError("Unexpected energy report")
+        count, size = report[1], report[2]
+        if size < 16 or len(report) < 16 + count * size:
+            raise CommandError("Unexpected energy report")
+        wakes, resleeps, total = struct.unpack_from("<3I", report, 4)
+        time_ms, current_ua, charge_uah = {}, {}, {}
+        for i in range(count):
+            name = EnergyReport.STATES[i] if i < len(EnergyReport.STATES) else f"0x{i:02X}"
+            time_ms[name], current_ua[name], charge_uah[name] = \
+                struct.unpack_from("<QII", report, 16 + i * size)
+        return EnergyReport(wakes, resleeps, total, time_ms, current_ua, charge_uah)
+    
+    async def set_energy_currents(self, currents: Dict[str, int]) -> None:
+        """
+        Set the current the device assumes for each state
+        
+        Measure them on a unit; the built-in ones are rough. Kept on the
+        device across sleep and power cycles.
+        
+        Args:
+            currents: uA by state name (EnergyReport.STATES); radio states
+                      are what the radio adds, engine states include the chip
+        """
+        values = {}
+        for name, ua in currents.items():
+            if name not in EnergyReport.STATES:
+                raise ValueError(f"State must be one of {EnergyReport.STATES}")
+            if not 0 <= ua <= 0xFFFFFFFF:
+                raise ValueError("Current out of range")
+            values[EnergyReport.STATES.index(name)] = int(ua)
+        # Runs of consecutive states, up to 4 per command
+        commands = []
+        states = sorted(values)
+        while states:
+            first = states[0]
+            run = [first]
+            while len(run) < 4 and run[-1] + 1 in values:
+                run.append(run[-1] + 1)
+            commands.append(struct.pack(f"<BBB{len(run)}I", 0xB4, 0x01, first,
+                                        *(values[i] for i in run)))
+            states = [i for i in states if i not in run]
+        if len(commands) == 1:
+            await self._send(commands[0])
+        elif commands:
+            await self._send_batch(commands)
+    
+    async def reset_energy_currents(self) -> None:
+        """Erase the stored currents and go back to the built-in ones"""
+        await self._send(bytes([0xB4, 0x03]))
+    
+    async def reset_energy(self) -> None:
+        """Clear the time and wake counters"""
+        await self._send(bytes([0xB4, 0x02]))
+    
+    # -------------------------------------------------------------------------
+    # Lens Layout
+    # -------------------------------------------------------------------------
+    
+    ALL_LENSES = 0xFF
+    
+    # (strobe, phase, scale) for lens 0 (left) and lens 1 (right)
+    EYE_PATTERNS = {
+        "together":  ((True, 0.0, 100), (True, 0.0, 100)),
+        "alternate": ((True, 0.0, 100), (True, 0.5, 100)),
+        "left":      ((True, 0.0, 100), (True, 0.0, 0)),
+        "right":     ((True, 0.0, 0), (True, 0.0, 100)),
+    }
+    
+    @staticmethod
+    def _lens_cmd(lens: int, strobe: bool, phase: float, scale: int) -> bytes:
+        phase_b = int(round((phase % 1.0) * 256)) & 0xFF
+        scale = max(0, min(100, int(scale)))
+        return bytes([0xAD, lens & 0xFF, 1 if strobe else 0, phase_b, scale])
+    
+    async def set_lens(self, lens: int, strobe: bool = True,
+                       phase: float = 0.0, scale: int = 100) -> None:
+        """
+        Set one lens's strobe and duty (boards with separately wired lenses)
+        
+        Args:
+            lens: 0 = left, 1 = right, Glasses.ALL_LENSES = both
+            strobe: False leaves the lens on the breathing envelope only
+            phase: Strobe phase offset as a fraction of a cycle (0.5 = opposite)
+            scale: Duty scale, 0-100% of the envelope
+        """
+        await self._send(self._lens_cmd(lens, strobe, phase, scale))
+    
+    async def set_eye_pattern(self, pattern: str = "together") -> None:
+        """
+        Apply a per-eye pattern in one step
+        
+        Args:
+            pattern: "together", "alternate" (eyes half a cycle apart),
+                     "left" or "right" (the other lens stays clear)
+        """
+        if pattern not in self.EYE_PATTERNS:
+            raise ValueError(f"Pattern must be one of {tuple(self.EYE_PATTERNS)}")
+        await self._send_batch([self._lens_cmd(i, *cfg)
+                                for i, cfg in enumerate(self.EYE_PATTERNS[pattern])])
+    
+    async def lens_layout(self) -> List[LensLayout]:
+        """Read the lens count and per-lens layout"""
+        report = await self._query(bytes([0x06]))
+        if len(report) < 2 or report[0] != 0x05 or len(report) < 2 + 3 * report[1]:
+            raise CommandError("Unexpected lens report")
+        return [LensLayout(i, bool(report[2 + 3 * i]), report[3 + 3 * i] / 256,
+                           report[4 + 3 * i])
+                for i in range(report[1])]
+    
+    # -------------------------------------------------------------------------
+    # Lens Calibration
+    # -------------------------------------------------------------------------
+    
+    LENS_TABLE_SIZE = 101
+    LENS_TABLE_CHUNK = 9    # entries per 0xAE 0x01 write
+    
+    async def hold_raw(self, raw: int) -> None:
+        """
+        Hold a raw PWM value (0-1024) on every lens, bypassing the table
+        
+        For measuring the lens response; stops any running session.
+        """
+        raw = max(0, min(1024, int(raw)))
+        await self._send(struct.pack("<BBH", 0xAE, 0x04, raw))
+    
+    async def upload_lens_table(self, raw: List[int]) -> LensTable:
+        """
+        Store a measured response table and use it
+        
+        Args:
+            raw: 101 raw PWM values (0-1024) for duty 0-100%, starting at 0
+                 and never decreasing
+        
+        Returns:
+            The calibration report after the commit
+        """
+        if len(raw) != self.LENS_TABLE_SIZE:
+            raise ValueError(f"Table needs {self.LENS_TABLE_SIZE} entries")
+        if raw[0] != 0 or any(b < a for a, b in zip(raw, raw[1:])) or max(raw) > 1024:
+            raise ValueError("Table must start at 0, never decrease and stay <= 1024")
+        for start in range(0, len(raw), self.LENS_TABLE_CHUNK):
+            chunk = raw[start:start + self.LENS_TABLE_CHUNK]
+            await self._send(bytes([0xAE, 0x01, start]) +
+                             struct.pack(f"<{len(chunk)}H", *chunk))
+        await self._send(bytes([0xAE, 0x02]))
+        table = await self.lens_table()
+        if table.result != 0:
+            raise CommandError(f"Lens table rejected: {table.result_name}")
+        return table
+    
+    async def reset_lens_table(self) -> None:
+        """Erase the stored table and go back to the built-in one"""
+        await self._send(bytes([0xAE, 0x03]))
+    
+    async def lens_table(self) -> LensTable:
+        """Read the response table in use"""
+        report = await self._query(bytes([0x07]))
+        if len(report) < 3 + 2 * self.LENS_TABLE_SIZE or report[0] != 0x06:
+            raise CommandError("Unexpected calibration report")
+        raw = list(struct.unpack_from(f"<{self.LENS_TABLE_SIZE}H", report, 3))
+        return LensTable(bool(report[1]), report[2], raw)
+    
+    # -------------------------------------------------------------------------
+    # Strobe Benchmark
+    # -------------------------------------------------------------------------
+    
+    BENCH_RATES = 8
+    
+    async def start_benchmark(self, seconds: int = 5) -> None:
+        """
+        Start the on-device strobe timing benchmark (stops the session)
+        
+        Args:
+            seconds: Time per rate (1-60); the run covers 8 rates, 1-50 Hz
+        """
+        seconds = max(1, min(60, int(seconds)))
+        await self._send(bytes([0xAF, seconds]))
+    
+    async def abort_benchmark(self) -> None:
+        """Stop a running benchmark, keeping the rates done so far"""
+        await self._send(bytes([0xAF, 0x00]))
+    
+    async def benchmark_results(self) -> BenchReport:
+        """Read the benchmark report"""
+        report = await self._query(bytes([0x08]))
+        if len(report) < 6 or report[0] != 0x07:
+            raise CommandError("Unexpected benchmark report")
+        count = report[2]
+        if len(report) < 6 + 61 * count:
+            raise CommandError("Short benchmark report")
+        rows = []
+        for i in range(count):
+            base = 6 + 61 * i
+            hz, writes, late = struct.unpack_from("<BHH", report, base)
+            rows.append(BenchRow(hz, writes, late, BenchStat.parse(report, base + 5),
+                                 BenchStat.parse(report, base + 33)))
+        state = report[1]
+        return BenchReport(
+            state=BenchReport.STATES[state] if state < len(BenchReport.STATES) else f"0x{state:02X}",
+            seconds=report[3],
+            stack_free=struct.unpack_from("<H", report, 4)[0],
+            rows=rows,
+        )
+    
+    async def run_benchmark(self, seconds: int = 5) -> BenchReport:
+        """Run the benchmark and wait for the results"""
+        await self.start_benchmark(seconds)
+        await asyncio.sleep(self.BENCH_RATES * seconds + 0.5)
+        while True:
+            report = await self.benchmark_results()
+            if report.state != "running":
+                return report
+            await asyncio.sleep(0.5)
+    
+    # -------------------------------------------------------------------------
+    # Clock Sync
+    # -------------------------------------------------------------------------
+    
+    PONG_TYPE = 0x02
+    SYNC_DRIFT_MIN_SPAN = 10.0      # Seconds between bursts before drift is fitted
+    SYNC_MAX_POINTS = 32            # Bursts kept for the drift fit
+    SYNC_RTT_SLACK = 0.002          # Seconds over the best round trip still averaged
+    
+    @property
+    def clock(self) -> Optional[ClockSync]:
+        """Last clock estimate from sync_clock(), None before the first"""
+        return self._clock
+    
+    async def _ping(self, seq: int, timeout: float) -> Optional[Tuple[float, float, float]]:
+        """One 0xB0 exchange: (host midpoint s, offset us, round trip s), None if lost"""
+        pending = asyncio.get_running_loop().create_future()
+        self._pongs[seq] = pending
+        try:
+            t0 = time.perf_counter()
+            await self._send(bytes([0xB0, seq]), response=False)
+            t3, pong = await asyncio.wait_for(pending, timeout)
+        except asyncio.TimeoutError:
+            return None
+        finally:
+            self._pongs.pop(seq, None)
+        rx_us, tx_us = struct.unpack_from("<qq", pong, 2)
+        rtt = (t3 - t0) - (tx_us - rx_us) / 1e6
+        mid = (t0 + t3) / 2
+        return mid, (rx_us + tx_us) / 2 - mid * 1e6, rtt
+    
+    async def sync_clock(self, samples: int = 16, interval: float = 0.05) -> ClockSync:
+        """
+        Estimate the device clock from a burst of 0xB0 pings
+        
+        The offset comes from the pings with the shortest round trips,
+        which had the least BLE delay to be split wrongly between the two
+        ways; with the low_latency profile that is within about a ms.
+        Each call adds one point; once calls span SYNC_DRIFT_MIN_SPAN
+        seconds, drift is fitted over them, so call it again now and then
+        in a long run (and once more just before a scheduled start).
+        
+        Args:
+            samples: Pings in the burst
+            interval: Seconds between pings
+            
+        Returns:
+            The estimate (also kept as .clock)
+            
+        Raises:
+            CommandError: If no pong came back
+        """
+        if not self.is_connected:
+            raise ConnectionError("Not connected. Call connect() first.")
+        try:
+            await self._start_notify()
+        except BleakError as e:
+            raise CommandError(f"Clock sync subscribe failed: {e}")
+        
+        results = []
+        try:
+            for i in range(max(1, samples)):
+                if i:
+                    await asyncio.sleep(interval)
+                r = await self._ping(i & 0xFF, timeout=max(1.0, interval * 4))
+                if r is not None:
+                    results.append(r)
+        finally:
+            try:
+                await self._release_notify()
+            except BleakError:
+                pass
+        if not results:
+            raise CommandError("No clock sync reply (firmware without 0xB0?)")
+        
+        # Average the pings that were (nearly) as quick as the quickest: the
+        # way BLE splits a round trip varies by up to a connection event
+        mid, _offset, rtt = min(results, key=lambda r: r[2])
+        near = [r[1] for r in results if r[2] <= rtt + self.SYNC_RTT_SLACK]
+        offset = sum(near) / len(near)
+        points = self._sync_points
+        if points:
+            # A jump far beyond any drift means the device clock restarted
+            last_t, last_offset = points[-1]
+            if abs(offset - last_offset) > 1000 + 1000 * (mid - last_t):
+                points.clear()
+        points.append((mid, offset))
+        del points[:-self.SYNC_MAX_POINTS]
+        
+        drift = 0.0
+        if points[-1][0] - points[0][0] >= self.SYNC_DRIFT_MIN_SPAN:
+            # Least squares slope of offset (us) over host time (s) = ppm
+            n = len(points)
+            mt = sum(p[0] for p in points) / n
+            mo = sum(p[1] for p in points) / n
+            drift = (sum((p[0] - mt) * (p[1] - mo) for p in points) /
+                     sum((p[0] - mt) ** 2 for p in points))
+        
+        self._clock = ClockSync(offset_us=offset, host_time=mid, drift_ppm=drift,
+                                rtt_ms=rtt * 1000, samples=len(results), bursts=len(points))
+        return self._clock
+    
+    async def start_at(self, device_us: int) -> None:
+        """
+        Start the session (as resume()) at a device time
+        
+        The lenses clear until then; the first strobe edge falls on the
+        given time. Up to 60 s ahead.
+        
+        Args:
+            device_us: Device time in microseconds, e.g. clock.device_time(t)
+        """
+        await self._send(self._start_at_cmd(device_us))
+    
+    async def start_at_host_time(self, host_time: float) -> None:
+        """
+        Start the session at a host time.perf_counter() time, using the
+        last sync_clock() estimate
+        """
+        if self._clock is None:
+            raise CommandError("Clock not synced. Call sync_clock() first.")
+        await self.start_at(self._clock.device_time(host_time))
+    
+    @staticmethod
+    def _start_at_cmd(device_us: int) -> bytes:
+        return bytes([0xB1]) + struct.pack("<q", int(device_us))
+    
     # -------------------------------------------------------------------------
     # High-level Session Control
     # -------------------------------------------------------------------------
@@ -319,7 +1652,7 @@ class Glasses:
         Configure and start a complete meditation session
         
         This is the recommended high-level method for starting sessions.
-        Sets all parameters and starts the session.
+        Sets all parameters in a single batch write and starts the session.
         
         Args:
             duration: Session length in minutes (1-60)
@@ -344,10 +1677,12 @@ class Glasses:
                 brightness=100
             )
         """
-        await self.set_brightness(brightness)
-        await self.set_breathing(inhale, hold_in_end, exhale, hold_out_end)
-        await self.set_strobe(strobe_start, strobe_end)
-        await self.set_duration(duration)  # This restarts the session
+        await self._send_batch([
+            self._brightness_cmd(brightness),
+            self._breathing_cmd(inhale, hold_in_end, exhale, hold_out_end),
+            self._strobe_cmd(strobe_start, strobe_end),
+            self._duration_cmd(duration),
+        ])
     
     # -------------------------------------------------------------------------
     # Preset Sessions
@@ -0,0 +1,268 @@
+"""
+EDGE Glasses - Controlling several devices from one host
+"""
+
+import asyncio
+import time
+from dataclasses import dataclass, field
+from typing import Any, Awaitable, Callable, Dict, List, Optional
+
+from .glasses import Glasses, ScanResult
+from .exceptions import DeviceNotFoundError
+
+
+@dataclass
+class GroupResult:
+    """Outcome of one group operation, per device address"""
+    ok: List[str] = field(default_factory=list)
+    failed: Dict[str, BaseException] = field(default_factory=dict)
+    values: Dict[str, Any] = field(default_factory=dict)    # Return value per device
+    spread_ms: float = 0.0      # start_session(): first to last trigger write, or
+                                # worst clock uncertainty for a scheduled start
+
+    @property
+    def all_ok(self) -> bool:
+        return not self.failed
+
+    def __str__(self):
+        s = f"{len(self.ok)} ok, {len(self.failed)} failed"
+        for address, e in self.failed.items():
+            s += f"\n  {address}: {e}"
+        return s
+
+
+class GlassesGroup:
+    """
+    Several EDGE Glasses driven together (group sessions)
+
+    One shared scan finds every device, connections are made concurrently
+    (at most max_concurrent at a time, as most BLE adapters serialise
+    connection setup), and commands fan out to all connected devices at
+    once. Failures are collected per device instead of aborting the group.
+
+    Usage:
+        async with GlassesGroup() as group:         # Every device in range
+            print(group.connect_result)
+            result = await group.start_session(duration=20)
+            print(f"started within {result.spread_ms:.1f} ms")
+    """
+
+    def __init__(self, addresses: Optional[List[str]] = None, max_concurrent: int = 4,
+                 connect_timeout: float = 10.0):
+        """
+        Args:
+            addresses: Devices to use. None scans and takes all found.
+            max_concurrent: Connections set up in parallel
+            connect_timeout: Per device, in seconds
+        """
+        self._addresses = list(addresses) if addresses else None
+        self._max_concurrent = max(1, max_concurrent)
+        self._connect_timeout = connect_timeout
+        self._devices: Dict[str, Glasses] = {}
+        self.connect_result: Optional[GroupResult] = None
+
+    @property
+    def devices(self) -> Dict[str, Glasses]:
+        """Connected devices by address"""
+        return {a: g for a, g in self._devices.items() if g.is_connected}
+
+    def __len__(self) -> int:
+        return len(self.devices)
+
+    # -------------------------------------------------------------------------
+    # Connection Management
+    # -------------------------------------------------------------------------
+
+    async def connect(self, scan_timeout: float = 5.0) -> GroupResult:
+        """
+        Find and connect every device
+
+        Args:
+            scan_timeout: Length of the shared scan when no addresses were given
+
+        Returns:
+            Per-device result (also kept as connect_result)
+
+        Raises:
+            DeviceNotFoundError: If the scan finds no device
+        """
+        if self._addresses is None:
+            found: List[ScanResult] = await Glasses.scan(timeout=scan_timeout)
+            if not found:
+                raise DeviceNotFoundError("No EDGE Glasses found. Are the devices powered on?")
+            self._addresses = [d.address for d in found]
+
+        limit = asyncio.Semaphore(self._max_concurrent)
+
+        async def connect_one(glasses: Glasses) -> None:
+            async with limit:
+                await glasses.connect(timeout=self._connect_timeout)
+
+        for address in self._addresses:
+            self._devices.setdefault(address, Glasses(address=address))
+        pending = {a: g for a, g in self._devices.items() if not g.is_connected}
+        self.connect_result = await self._gather(pending, connect_one)
+        return self.connect_result
+
+    async def disconnect(self) -> None:
+        """Disconnect every device"""
+        await asyncio.gather(*(g.disconnect() for g in self._devices.values()),
+                             return_exceptions=True)
+
+    async def __aenter__(self):
+        await self.connect()
+        return self
+
+    async def __aexit__(self, exc_type, exc_val, exc_tb):
+        await self.disconnect()
+        return False
+
+    # -------------------------------------------------------------------------
+    # Fan-out
+    # -------------------------------------------------------------------------
+
+    @staticmethod
+    async def _gather(devices: Dict[str, Glasses],
+                      fn: Callable[[Glasses], Awaitable[Any]],
+                      timeout: Optional[float] = None) -> GroupResult:
+        async def run(glasses: Glasses) -> Any:
+            if timeout is None:
+                return await fn(glasses)
+            return await asyncio.wait_for(fn(glasses), timeout)
+
+        result = GroupResult()
+        outcomes = await asyncio.gather(*(run(g) for g in devices.values()),
+                                        return_exceptions=True)
+        for address, outcome in zip(devices, outcomes):
+            if isinstance(outcome, asyncio.CancelledError):
+                raise outcome
+            if isinstance(outcome, BaseException):
+                result.failed[address] = outcome
+            else:
+                result.ok.append(address)
+                result.values[address] = outcome
+        return result
+
+    async def broadcast(self, fn: Callable[[Glasses], Awaitable[Any]],
+                        timeout: Optional[float] = None) -> GroupResult:
+        """
+        Run fn(glasses) on every connected device at once
+
+        Args:
+            fn: Coroutine function taking one Glasses
+            timeout: Per device, in seconds
+
+        Example:
+            await group.broadcast(lambda g: g.set_strobe(10, 6))
+            stats = (await group.broadcast(lambda g: g.read_telemetry())).values
+        """
+        return await self._gather(self.devices, fn, timeout)
+
+    async def set_opacity(self, value: int) -> GroupResult:
+        return await self.broadcast(lambda g: g.set_opacity(value))
+
+    async def hold(self, duty: int) -> GroupResult:
+        return await self.broadcast(lambda g: g.hold(duty))
+
+    async def set_brightness(self, percent: int) -> GroupResult:
+        return await self.broadcast(lambda g: g.set_brightness(percent))
+
+    async def set_connection_profile(self, profile: str = "auto") -> GroupResult:
+        return await self.broadcast(lambda g: g.set_connection_profile(profile))
+
+    async def set_advertising(self, policy: str = "adaptive",
+                              window_s: Optional[int] = None) -> GroupResult:
+        return await self.broadcast(lambda g: g.set_advertising(policy, window_s))
+
+    async def sleep(self) -> GroupResult:
+        return await self.broadcast(lambda g: g.sleep())
+
+    async def sync_clocks(self, samples: int = 16) -> GroupResult:
+        """Estimate every device's clock (Glasses.sync_clock); values are ClockSync"""
+        return await self.broadcast(lambda g: g.sync_clock(samples))
+
+    # -------------------------------------------------------------------------
+    # Synchronized Session Start
+    # -------------------------------------------------------------------------
+
+    async def start_session(
+        self,
+        duration: int = 10,
+        strobe_start: int = 12,
+        strobe_end: int = 8,
+        inhale: float = 4.0,
+        hold_in_end: float = 4.0,
+        exhale: float = 4.0,
+        hold_out_end: float = 4.0,
+        brightness: int = 100,
+        start_in: Optional[float] = None
+    ) -> GroupResult:
+        """
+        Start the same session on every device at the same moment
+
+        Two steps, so the slow part is not in the start: every device first
+        gets the parameters in one batch that ends in a clear hold (0xA5 0),
+        so none of them runs yet. Then the one-byte resume (0xA6) goes to
+        all of them back to back, without write responses. What is left is
+        each link's connection event phase, so use the "low_latency"
+        connection profile for a start within a few ms.
+
+        With start_in, the link is taken out of it: every device's clock is
+        synced first (0xB0), gets the same held batch, then a scheduled
+        start (0xB1) at the same host instant, converted to each device's
+        time. The 0xB1 is a write of its own: with it the frame would not
+        fit the default ATT MTU, and split into single writes each
+        parameter would restart the session out of phase. The
+        strobes then start in phase to about the sync accuracy, typically
+        well under a millisecond, and stay within crystal drift after.
+
+        Args:
+            As Glasses.start_session(), plus
+            start_in: Seconds from now to a scheduled start; None triggers
+                with 0xA6 instead. Leave time for the parameter writes.
+
+        Returns:
+            Devices that started; spread_ms is the time from the first to
+            the last trigger write leaving the host, or for a scheduled
+            start the worst half round trip of the clock syncs
+        """
+        session = [
+            Glasses._brightness_cmd(brightness),
+            Glasses._breathing_cmd(inhale, hold_in_end, exhale, hold_out_end),
+            Glasses._strobe_cmd(strobe_start, strobe_end),
+            Glasses._duration_cmd(duration),
+        ]
+        session.append(bytes([0xA5, 0]))
+        if start_in is not None:
+            return await self._start_scheduled(session, start_in)
+
+        staged = await self.broadcast(lambda g: g._send_batch(session))
+        ready = {a: self._devices[a] for a in staged.ok}
+
+        loop = asyncio.get_running_loop()
+        sent: Dict[str, float] = {}
+
+        async def trigger(glasses: Glasses) -> None:
+            await glasses._send(bytes([0xA6]), response=False)
+            sent[glasses.address] = loop.time()
+
+        result = await self._gather(ready, trigger)
+        result.failed.update(staged.failed)
+        if sent:
+            result.spread_ms = (max(sent.values()) - min(sent.values())) * 1000
+        return result
+
+    async def _start_scheduled(self, session: List[bytes], start_in: float) -> GroupResult:
+        synced = await self.sync_clocks()
+        ready = {a: self._devices[a] for a in synced.ok}
+        staged = await self._gather(ready, lambda g: g._send_batch(session))
+        ready = {a: self._devices[a] for a in staged.ok}
+        start = time.perf_counter() + start_in
+
+        result = await self._gather(ready, lambda g: g._send(
+            Glasses._start_at_cmd(g.clock.device_time(start))))
+        result.failed.update(synced.failed)
+        result.failed.update(staged.failed)
+        if result.ok:
+            result.spread_ms = max(self._devices[a].clock.rtt_ms for a in result.ok) / 2
+        return result
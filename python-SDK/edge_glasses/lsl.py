@@ -0,0 +1,122 @@
+"""
+EDGE Glasses - Device stimulus markers as a Lab Streaming Layer stream
+"""
+
+import asyncio
+import time
+from typing import List, Optional
+
+from .glasses import Glasses, Marker
+from .exceptions import CommandError
+
+try:
+    import pylsl
+except ImportError:     # Optional: pip install edge-glasses[lsl]
+    pylsl = None
+
+
+class LSLMarkerOutlet:
+    """
+    Publishes the device's strobe edge, breath phase and session event
+    times as an irregular-rate LSL marker stream
+
+    Each marker is stamped with the LSL clock time of the event itself,
+    mapped from device time through the clock sync, not with the time the
+    BLE notify came in. The clock is re-synced every `resync` seconds to
+    follow drift, so offline epoching lines up with EEG to about a ms
+    without a photodiode (use the "low_latency" connection profile).
+
+    Usage:
+        async with Glasses() as glasses:
+            await glasses.set_connection_profile("low_latency")
+            async with LSLMarkerOutlet(glasses) as outlet:
+                await glasses.start_session(duration=20)
+                await asyncio.sleep(20 * 60)
+
+    Sample strings are Marker.label: "strobe:dark=<lens mask>",
+    "phase:<inhale|hold_in|exhale|hold_out>", "session:<event>".
+    """
+
+    def __init__(self, glasses: Glasses, name: str = "EDGE_Glasses_Markers",
+                 strobe: bool = True, phases: bool = True, session: bool = True,
+                 resync: float = 10.0, source_id: Optional[str] = None):
+        """
+        Args:
+            glasses: Connected controller
+            name: LSL stream name
+            strobe, phases, session: Marker kinds to publish
+            resync: Seconds between clock syncs
+            source_id: LSL source id, default from the device address
+        """
+        if pylsl is None:
+            raise ImportError("pylsl not installed. Run: pip install pylsl")
+        self._glasses = glasses
+        self._kinds = (strobe, phases, session)
+        self._resync = resync
+        info = pylsl.StreamInfo(name=name, type="Markers", channel_count=1,
+                                nominal_srate=pylsl.IRREGULAR_RATE,
+                                channel_format="string",
+                                source_id=source_id or f"edge_glasses_{glasses.address}")
+        info.desc().append_child_value("clock", "device time via 0xB0 clock sync")
+        self._outlet = pylsl.StreamOutlet(info)
+        self._lsl_offset = 0.0                  # LSL clock minus time.perf_counter()
+        self._task: Optional[asyncio.Task] = None
+        self.pushed = 0
+
+    @property
+    def lost(self) -> int:
+        """Markers the link dropped"""
+        return self._glasses.markers_lost
+
+    def _measure_lsl_offset(self) -> None:
+        # Bracket the LSL clock read with the host clock
+        t0 = time.perf_counter()
+        lsl = pylsl.local_clock()
+        t1 = time.perf_counter()
+        self._lsl_offset = lsl - (t0 + t1) / 2
+
+    def _on_markers(self, markers: List[Marker]) -> None:
+        for m in markers:
+            if m.host_time is None:
+                continue
+            self._outlet.push_sample([m.label], m.host_time + self._lsl_offset)
+            self.pushed += 1
+
+    async def _run(self) -> None:
+        while True:
+            await asyncio.sleep(self._resync)
+            try:
+                await self._glasses.sync_clock()
+            except CommandError:
+                pass    # Keep the last estimate; the next round tries again
+            self._measure_lsl_offset()
+
+    async def start(self) -> None:
+        """Sync the clock and start publishing"""
+        if self._task is not None:
+            return
+        await self._glasses.sync_clock()
+        self._measure_lsl_offset()
+        strobe, phases, session = self._kinds
+        await self._glasses.subscribe_markers(self._on_markers, strobe, phases, session)
+        self._task = asyncio.create_task(self._run())
+
+    async def stop(self) -> None:
+        """Stop publishing"""
+        if self._task is None:
+            return
+        self._task.cancel()
+        try:
+            await self._task
+        except asyncio.CancelledError:
+            pass
+        self._task = None
+        if self._glasses.is_connected:
+            await self._glasses.unsubscribe_markers()
+
+    async def __aenter__(self):
+        await self.start()
+        return self
+
+    async def __aexit__(self, exc_type, exc_val, exc_tb):
+        await self.stop()
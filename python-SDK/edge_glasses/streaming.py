@@ -0,0 +1,248 @@
+"""
+EDGE Glasses - Streaming control for real-time feedback loops
+"""
+
+import asyncio
+import struct
+from dataclasses import dataclass, replace
+from typing import Dict, Hashable, List, Optional, Tuple
+
+from .glasses import Glasses
+from .exceptions import CommandError
+
+
+@dataclass
+class StreamStats:
+    """Counters of a StreamingController"""
+    submitted: int = 0              # Updates handed to the controller
+    sent: int = 0                   # Updates written to the device
+    coalesced: int = 0              # Updates replaced by a newer one before sending
+    writes: int = 0                 # GATT writes (one batch carries several updates)
+    backlog: int = 0                # Updates waiting now
+    latency_ms: float = 0.0         # Submit to write done, last update sent
+    latency_mean_ms: float = 0.0
+    latency_max_ms: float = 0.0
+
+    def __str__(self):
+        return (f"{self.sent}/{self.submitted} sent ({self.coalesced} coalesced), "
+                f"latency {self.latency_mean_ms:.1f} ms mean, "
+                f"{self.latency_max_ms:.1f} ms max, backlog {self.backlog}")
+
+
+class StreamingController:
+    """
+    Latest-value-wins control channel for driving the glasses from a stream
+
+    Updates are queued without waiting for the link. A background sender
+    keeps only the newest value per command type and writes at most once
+    per connection interval, using write-without-response, so a sensor
+    running faster than the link costs lag of one interval, not a growing
+    queue.
+
+    Usage:
+        async with Glasses() as glasses:
+            await glasses.set_connection_profile("low_latency")
+            async with StreamingController(glasses) as stream:
+                while True:
+                    stream.set_opacity(read_sensor())   # Never blocks
+                    await asyncio.sleep(0.005)
+    """
+
+    DEFAULT_INTERVAL = 0.015        # Seconds, when the device does not say
+    BATCH_MAX = 8                   # Entries per 0xA9 frame
+
+    def __init__(self, glasses: Glasses, interval: Optional[float] = None):
+        """
+        Args:
+            glasses: Connected controller
+            interval: Minimum time between writes in seconds. None uses the
+                connection interval the device reports at start().
+        """
+        self._glasses = glasses
+        self._interval = interval
+        # key -> (frame, batchable, submit time)
+        self._pending: Dict[Hashable, Tuple[bytes, bool, float]] = {}
+        self._wake: Optional[asyncio.Event] = None      # Made in start(), on the running loop
+        self._idle: Optional[asyncio.Event] = None
+        self._task: Optional[asyncio.Task] = None
+        self._stats = StreamStats()
+        self._latency_sum = 0.0
+
+    @property
+    def interval(self) -> Optional[float]:
+        """Minimum time between writes in seconds"""
+        return self._interval
+
+    @property
+    def stats(self) -> StreamStats:
+        """Snapshot of the counters"""
+        return replace(self._stats, backlog=len(self._pending))
+
+    async def start(self) -> None:
+        """Start the background sender"""
+        if self._task is not None:
+            return
+        if self._interval is None:
+            self._interval = self.DEFAULT_INTERVAL
+            try:
+                params = await self._glasses.connection_params()
+                if params.connected and params.interval_ms > 0:
+                    self._interval = params.interval_ms / 1000
+            except CommandError:
+                pass
+        self._wake = asyncio.Event()
+        self._idle = asyncio.Event()
+        self._idle.set()
+        self._task = asyncio.create_task(self._run())
+
+    async def stop(self, flush: bool = True) -> None:
+        """
+        Stop the background sender
+
+        Args:
+            flush: Send what is still pending first
+        """
+        if self._task is None:
+            return
+        if flush:
+            await self.flush()
+        self._task.cancel()
+        try:
+            await self._task
+        except asyncio.CancelledError:
+            pass
+        finally:
+            self._task = None
+
+    async def flush(self) -> None:
+        """Wait until every pending update has been written"""
+        self._check()
+        waiter = asyncio.ensure_future(self._idle.wait())
+        done, _ = await asyncio.wait({waiter, self._task}, return_when=asyncio.FIRST_COMPLETED)
+        if waiter not in done:
+            waiter.cancel()
+        self._check()
+
+    async def __aenter__(self):
+        await self.start()
+        return self
+
+    async def __aexit__(self, exc_type, exc_val, exc_tb):
+        await self.stop(flush=exc_type is None)
+
+    # -------------------------------------------------------------------------
+    # Updates (non-blocking)
+    # -------------------------------------------------------------------------
+
+    def submit(self, key: Hashable, data: bytes, batchable: bool = True) -> None:
+        """
+        Queue one encoded command, replacing any pending one with the same key
+
+        The replacement goes to the back of the queue, after updates
+        submitted in between, so updates are written in the order of their
+        latest submission.
+
+        Args:
+            key: Command type; updates with equal keys coalesce
+            data: Encoded command, [opcode, args...]
+            batchable: Can travel in an 0xA9 batch (extended commands only)
+        """
+        self._check()
+        if self._pending.pop(key, None) is not None:
+            self._stats.coalesced += 1
+        self._pending[key] = (bytes(data), batchable, asyncio.get_running_loop().time())
+        self._stats.submitted += 1
+        self._idle.clear()
+        self._wake.set()
+
+    # Opacity and hold both set the static override, so they share a slot
+    def set_opacity(self, value: int) -> None:
+        """Set lens opacity 0-255 (see Glasses.set_opacity)"""
+        self.submit("override", bytes([max(0, min(255, int(value)))]), batchable=False)
+
+    def hold(self, duty: int) -> None:
+        """Hold a static duty 0-100% (see Glasses.hold)"""
+        self.submit("override", bytes([0xA5, max(0, min(100, int(duty)))]))
+
+    def set_brightness(self, percent: int) -> None:
+        """Set the session brightness 0-100% (see Glasses.set_brightness)"""
+        self.submit(0xA2, Glasses._brightness_cmd(percent))
+
+    def set_lens(self, lens: int, strobe: bool = True,
+                 phase: float = 0.0, scale: int = 100) -> None:
+        """Set one lens's strobe and duty (see Glasses.set_lens)"""
+        self.submit((0xAD, lens), Glasses._lens_cmd(lens, strobe, phase, scale))
+
+    def set_feedback(self, value: float) -> None:
+        """Feedback value 0-1 for on-device pacing (see Glasses.send_feedback)"""
+        v = int(round(max(0.0, min(1.0, value)) * 0xFFFF))
+        self.submit(0xB7, struct.pack("<BH", 0xB7, v))
+
+    # -------------------------------------------------------------------------
+    # Sender
+    # -------------------------------------------------------------------------
+
+    def _check(self) -> None:
+        if self._task is None:
+            raise CommandError("Streaming controller not started")
+        if self._task.done():
+            # Re-raise why the sender stopped
+            self._task.result()
+            raise CommandError("Streaming controller stopped")
+
+    async def _write(self, updates: List[Tuple[bytes, bool, float]]) -> None:
+        # In submission order: runs of extended commands in batch frames,
+        # legacy bytes alone with the run before them sent first
+        batch: List[bytes] = []
+        for data, batchable, _t in updates:
+            if batchable:
+                batch.append(data)
+                if len(batch) == self.BATCH_MAX:
+                    await self._write_batch(batch)
+            else:
+                await self._write_batch(batch)
+                await self._glasses._send(data, response=False)
+                self._stats.writes += 1
+        await self._write_batch(batch)
+
+    async def _write_batch(self, batch: List[bytes]) -> None:
+        # Sends and empties batch
+        if not batch:
+            return
+        if len(batch) == 1:
+            await self._glasses._send(batch[0], response=False)
+        else:
+            await self._glasses._send_batch(batch, response=False)
+        batch.clear()
+        self._stats.writes += 1
+
+    async def _run(self) -> None:
+        loop = asyncio.get_running_loop()
+        next_write = 0.0
+        while True:
+            await self._wake.wait()
+            delay = next_write - loop.time()
+            if delay > 0:
+                # Rate limit; newer updates keep coalescing meanwhile
+                await asyncio.sleep(delay)
+            self._wake.clear()
+            updates = list(self._pending.values())
+            self._pending.clear()
+            if not updates:
+                self._idle.set()
+                continue
+
+            next_write = loop.time() + self._interval
+            await self._write(updates)
+
+            now = loop.time()
+            s = self._stats
+            for _data, _batchable, t in updates:
+                latency = (now - t) * 1000
+                s.sent += 1
+                s.latency_ms = latency
+                s.latency_max_ms = max(s.latency_max_ms, latency)
+                self._latency_sum += latency
+            s.latency_mean_ms = self._latency_sum / s.sent
+            if not self._pending:
+                self._idle.set()
@@ -3,10 +3,11 @@ LSL (Lab Streaming Layer) Integration Example
 Stream glasses state and receive control from LSL pipelines
 
 LSL is the standard for real-time data streaming in neuroscience research.
-This example shows bidirectional integration with LSL-compatible tools.
+This example shows bidirectional integration with LSL-compatible tools, and
+publishing the device's own strobe and breath timing for EEG epoching.
 
 Requires:
-    pip install edge-glasses pylsl
+    pip install edge-glasses[lsl]
 
 Compatible with:
     - OpenBCI GUI (via LSL)
@@ -20,7 +21,7 @@ Compatible with:
 import asyncio
 import time
 from typing import Optional
-from edge_glasses import Glasses
+from edge_glasses import Glasses, LSLMarkerOutlet
 
 try:
     from pylsl import StreamInfo, StreamOutlet, StreamInlet, resolve_stream
@@ -310,20 +311,42 @@ async def demo_neurofeedback():
         await nf.cleanup()
 
 
+async def demo_markers(duration_min: int = 5):
+    """
+    Demo: record device stimulus markers next to EEG
+    
+    Publishes EDGE_Glasses_Markers with the strobe edge and breath phase
+    times as the device ran them, stamped in LSL time. Record it with
+    LabRecorder together with the EEG stream and epoch on the markers.
+    """
+    async with Glasses() as glasses:
+        await glasses.set_connection_profile("low_latency")
+        async with LSLMarkerOutlet(glasses) as outlet:
+            print(f"Clock: {glasses.clock}")
+            print("Publishing LSL stream: EDGE_Glasses_Markers")
+            await glasses.start_session(duration=duration_min)
+            for _ in range(duration_min * 6):
+                await asyncio.sleep(10)
+                print(f"  {outlet.pushed} markers, {outlet.lost} lost | {glasses.clock}")
+
+
 async def main():
     print("EDGE Glasses - LSL Integration")
     print("=" * 40)
     print()
     print("1. LSL Bridge (publish state, receive commands)")
     print("2. EEG Neurofeedback (receive EEG, control glasses)")
+    print("3. Stimulus markers (device strobe and breath timing)")
     print()
     
-    choice = input("Select (1-2): ").strip()
+    choice = input("Select (1-3): ").strip()
     
     if choice == "1":
         await demo_bridge()
     elif choice == "2":
         await demo_neurofeedback()
+    elif choice == "3":
+        await demo_markers()
     else:
         print("Invalid choice")
 
@@ -12,7 +12,7 @@ Hardware:
 
 import asyncio
 import numpy as np
-from edge_glasses import Glasses
+from edge_glasses import Glasses, StreamingController
 
 # Uncomment when using real OpenBCI hardware:
 # from brainflow.board_shim import BoardShim, BrainFlowInputParams, BoardIds
@@ -47,6 +47,7 @@ class OpenBCIFeedback:
         self.serial_port = serial_port
         self.board = None
         self.glasses = None
+        self.stream = None
         self.running = False
         
         # Alpha band: 8-12 Hz
@@ -66,6 +67,9 @@ class OpenBCIFeedback:
         print("Connecting to EDGE Glasses...")
         self.glasses = Glasses()
         await self.glasses.connect()
+        await self.glasses.set_connection_profile("low_latency")  # Short interval for live feedback
+        self.stream = StreamingController(self.glasses)  # Newest value only, no write round trips
+        await self.stream.start()
         print("  Glasses connected!")
         
         if self.use_mock:
@@ -83,6 +87,9 @@ class OpenBCIFeedback:
     
     async def disconnect(self):
         """Disconnect from devices"""
+        if self.stream:
+            print(f"Stream: {self.stream.stats}")
+            await self.stream.stop()
         if self.glasses:
             await self.glasses.clear()
             await self.glasses.disconnect()
@@ -162,8 +169,8 @@ class OpenBCIFeedback:
                 # Map to opacity (0-255)
                 opacity = int(normalized * 255)
                 
-                # Send to glasses
-                await self.glasses.set_opacity(opacity)
+                # Send to glasses (returns at once, the stream sends it)
+                self.stream.set_opacity(opacity)
                 
                 # Status update every second
                 if int(elapsed) != int(elapsed - 0.05):
@@ -15,6 +15,7 @@ This example demonstrates:
     1. Connect to Polar HR sensor via BLE
     2. Calculate real-time HRV metrics
     3. Control glasses for HRV coherence training
+    4. Let the glasses find the resonance breathing rate themselves
 """
 
 import asyncio
@@ -25,7 +26,7 @@ from collections import deque
 from dataclasses import dataclass
 
 from bleak import BleakClient, BleakScanner
-from edge_glasses import Glasses
+from edge_glasses import Glasses, StreamingController
 
 
 # Polar BLE UUIDs
@@ -164,6 +165,7 @@ class HRVCoherenceTrainer:
     
     def __init__(self):
         self.glasses: Optional[Glasses] = None
+        self.stream: Optional[StreamingController] = None
         self.polar: Optional[PolarHRMonitor] = None
         self.running = False
         
@@ -184,6 +186,9 @@ class HRVCoherenceTrainer:
         print("Connecting to EDGE Glasses...")
         self.glasses = Glasses()
         await self.glasses.connect()
+        await self.glasses.set_connection_profile("low_latency")  # Short interval for live feedback
+        self.stream = StreamingController(self.glasses)  # Newest value only, no write round trips
+        await self.stream.start()
         print("  Glasses ready!")
         
         # Connect Polar
@@ -246,7 +251,8 @@ class HRVCoherenceTrainer:
         
         finally:
             self.running = False
-            await self.glasses.clear()
+            self.stream.set_opacity(0)
+            await self.stream.flush()
         
         # Session summary
         print()
@@ -275,9 +281,9 @@ class HRVCoherenceTrainer:
             coherence_scale = 0.3 + 0.7 * self.current_coherence
             scaled = base * coherence_scale
             
-            # Send to glasses
+            # Send to glasses (returns at once, the stream sends it)
             opacity = int(scaled * 255)
-            await self.glasses.set_opacity(opacity)
+            self.stream.set_opacity(opacity)
             
             await asyncio.sleep(step_duration)
     
@@ -285,6 +291,8 @@ class HRVCoherenceTrainer:
         """Cleanup connections"""
         if self.polar:
             await self.polar.disconnect()
+        if self.stream:
+            await self.stream.stop()
         if self.glasses:
             await self.glasses.clear()
             await self.glasses.disconnect()
@@ -300,6 +308,7 @@ class SimpleHRFeedback:
     
     def __init__(self):
         self.glasses: Optional[Glasses] = None
+        self.stream: Optional[StreamingController] = None
         self.polar: Optional[PolarHRMonitor] = None
         self.running = False
         
@@ -312,6 +321,9 @@ class SimpleHRFeedback:
         """Connect to devices"""
         self.glasses = Glasses()
         await self.glasses.connect()
+        await self.glasses.set_connection_profile("low_latency")  # Short interval for live feedback
+        self.stream = StreamingController(self.glasses)  # Newest value only, no write round trips
+        await self.stream.start()
         
         self.polar = PolarHRMonitor()
         self.polar.on_hr_update = self._on_hr
@@ -328,7 +340,7 @@ class SimpleHRFeedback:
         normalized = max(0, min(1, normalized))
         
         opacity = int(normalized * 255)
-        await self.glasses.set_opacity(opacity)
+        self.stream.set_opacity(opacity)
     
     async def run(self, duration: float = 60.0):
         """Run HR feedback loop"""
@@ -349,20 +361,80 @@ class SimpleHRFeedback:
         """Cleanup"""
         if self.polar:
             await self.polar.disconnect()
+        if self.stream:
+            await self.stream.stop()
         if self.glasses:
             await self.glasses.clear()
             await self.glasses.disconnect()
 
 
+class ResonancePacing:
+    """
+    On-device resonance pacing
+
+    The glasses run the session and pace its breathing; this only forwards
+    the strap's RR intervals. The device tries 4.5-7 breaths/min, settles on
+    the rate with the largest heart rate swing, and moves the strobe from
+    12 Hz toward 8 Hz as coherence rises.
+    """
+
+    def __init__(self):
+        self.glasses: Optional[Glasses] = None
+        self.polar: Optional[PolarHRMonitor] = None
+
+    async def connect(self):
+        """Connect to devices"""
+        self.glasses = Glasses()
+        await self.glasses.connect()
+
+        self.polar = PolarHRMonitor()
+        self.polar.on_hr_update = self._on_hr
+        await self.polar.connect()
+
+    def _on_hr(self, hr: int, rr_list: List[float]):
+        """Forward RR intervals as they arrive"""
+        if rr_list and self.glasses:
+            asyncio.ensure_future(self.glasses.send_rr(rr_list))
+
+    async def run(self, duration_minutes: float = 10.0):
+        """Run a paced session"""
+        await self.glasses.start_session(duration=int(duration_minutes + 0.5),
+                                         strobe_start=12, strobe_end=8)
+        await self.glasses.set_pacing("rr", rate_min=4.5, rate_max=7.0, strobe_hz=(12, 8))
+        print("Breathe with the glasses; the rate adapts to you")
+
+        start = time.time()
+        while (time.time() - start) < duration_minutes * 60:
+            await asyncio.sleep(10)
+            s = await self.glasses.pacing_status()
+            print(f"  {s.rate:.1f}/min ({s.search}, best {s.best_rate:.1f})  "
+                  f"HR {s.heart_rate:.0f}  swing {s.swing_bpm:.1f} bpm  "
+                  f"coherence {s.coherence:.2f}")
+
+        s = await self.glasses.pacing_status()
+        print(f"Resonance rate: {s.best_rate:.1f} breaths/min")
+
+    async def cleanup(self):
+        """Cleanup"""
+        if self.polar:
+            await self.polar.disconnect()
+        if self.glasses:
+            if self.glasses.is_connected:
+                await self.glasses.set_pacing("off")
+                await self.glasses.clear()
+            await self.glasses.disconnect()
+
+
 async def main():
     print("EDGE Glasses - Polar HR Integration")
     print("=" * 40)
     print()
     print("1. HRV Coherence Training (guided breathing)")
     print("2. Simple HR Feedback (HR -> opacity)")
+    print("3. On-device resonance pacing")
     print()
     
-    choice = input("Select (1-2): ").strip()
+    choice = input("Select (1-3): ").strip()
     
     if choice == "1":
         trainer = HRVCoherenceTrainer()
@@ -386,6 +458,18 @@ async def main():
         finally:
             await feedback.cleanup()
     
+    elif choice == "3":
+        pacing = ResonancePacing()
+        try:
+            await pacing.connect()
+            duration = input("Duration in minutes (default 10): ").strip()
+            duration = float(duration) if duration else 10.0
+            await pacing.run(duration)
+        except KeyboardInterrupt:
+            print("\nStopped!")
+        finally:
+            await pacing.cleanup()
+    
     else:
         print("Invalid choice")
 
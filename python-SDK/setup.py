@@ -33,6 +33,9 @@ setup(
         "bleak>=0.21.0",
     ],
     extras_require={
+        "lsl": [
+            "pylsl>=1.16.0",
+        ],
         "dev": [
             "pytest>=7.0.0",
             "pytest-asyncio>=0.21.0",